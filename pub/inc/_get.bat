@@ -1,6 +1,7 @@
 @echo off
 set THIS_DIR=%~sdp0
 
-copy /y %THIS_DIR%..\..\src\pro_rpc\pro_rpc.h %THIS_DIR%prorpc\
+copy /y %THIS_DIR%..\..\src\pro_rpc\pro_rpc.h      %THIS_DIR%prorpc\
+copy /y %THIS_DIR%..\..\src\pro_rpc\pro_rpc_coro.h %THIS_DIR%prorpc\
 
 pause
@@ -52,6 +52,7 @@ static const RPC_ERROR_CODE RPCE_NOT_ENOUGH_MEMORY     =    -2;
 static const RPC_ERROR_CODE RPCE_MISMATCHED_PARAMETER  = -1001;
 static const RPC_ERROR_CODE RPCE_INVALID_ARGUMENT      = -1002;
 static const RPC_ERROR_CODE RPCE_INVALID_FUNCTION      = -1003;
+static const RPC_ERROR_CODE RPCE_CANCELED              = -1066;
 static const RPC_ERROR_CODE RPCE_CLIENT_BUSY           = -1088;
 static const RPC_ERROR_CODE RPCE_SERVER_BUSY           = -1099;
 static const RPC_ERROR_CODE RPCE_NETWORK_NOT_CONNECTED = -2001;
@@ -93,6 +94,27 @@ static const RPC_DATA_TYPE RPC_DT_FLOAT64ARRAY = 166;
  * ]]]]
  */
 
+/*
+ * [[[[ function flags
+ */
+static const uint32_t RPC_FF_IDEMPOTENT = 0x00000001; /* safe to be resent */
+static const uint32_t RPC_FF_CACHEABLE  = 0x00000002; /* results can be reused */
+/*
+ * ]]]]
+ */
+
+/*
+ * [[[[ request priorities
+ */
+typedef unsigned char RPC_PRIORITY;
+
+static const RPC_PRIORITY RPC_PRI_BATCH       = 0;
+static const RPC_PRIORITY RPC_PRI_NORMAL      = 1; /* default */
+static const RPC_PRIORITY RPC_PRI_INTERACTIVE = 2;
+/*
+ * ]]]]
+ */
+
 struct RPC_ARGUMENT
 {
     RPC_ARGUMENT()
@@ -391,6 +413,18 @@ struct RPC_HDR
     uint32_t       timeoutInSeconds;
 };
 
+/*
+ * fills an argument of a later call of a pipeline with an argument of the
+ * result of an earlier call. the types of them must be the same.
+ */
+struct RPC_PIPELINE_REF
+{
+    uint16_t callIndex;   /* the later call */
+    uint16_t argIndex;    /* its argument, a placeholder */
+    uint16_t resultIndex; /* the earlier call, < callIndex */
+    uint16_t resultArg;   /* the argument of its result */
+};
+
 /////////////////////////////////////////////////////////////////////////////
 ////
 
@@ -443,11 +477,161 @@ public:
     virtual void SetMagicStr(const char* magicStr) = 0;
 
     virtual const char* GetMagicStr() const = 0;
+
+    /*
+     * true if the client has canceled the request. a long-running handler
+     * may check it and give up.
+     */
+    virtual bool IsCancelled() const = 0;
+
+    /*
+     * the priority of a request. it's set before SendRpcRequest() and
+     * carried to the server.
+     *
+     * if "rpcs_priority" is "1", the server dispatches the higher priority
+     * requests of a worker thread first, and sheds the lower priority
+     * requests first when it's overloaded. it should be "1" only if all the
+     * clients are of this version, because the old ones leave garbage in
+     * the place of the priority.
+     */
+    virtual void SetPriority(RPC_PRIORITY priority) = 0;
+
+    virtual RPC_PRIORITY GetPriority() const = 0;
+};
+
+/////////////////////////////////////////////////////////////////////////////
+////
+
+class IRpcFuture;
+
+typedef void (*RPC_FUTURE_CALLBACK)(
+    IRpcFuture* future,
+    IRpcPacket* result,
+    void*       context
+    );
+
+class IRpcFuture
+{
+public:
+
+    virtual ~IRpcFuture() {}
+
+    virtual unsigned long AddRef() = 0;
+
+    virtual unsigned long Release() = 0;
+
+    virtual uint64_t GetRequestId() const = 0;
+
+    virtual bool IsReady() const = 0;
+
+    /*
+     * returns true if the result is ready within the timeout.
+     * don't call it in the reactor's threads.
+     */
+    virtual bool WaitFor(unsigned int timeoutInMilliseconds) = 0;
+
+    /*
+     * returns NULL if the result is not ready.
+     * the result is owned by the future.
+     */
+    virtual IRpcPacket* GetResult() const = 0;
+
+    /*
+     * the callback is called once. If the result is ready, it's called
+     * immediately in the caller's thread; otherwise, it's called in the
+     * thread that completes the call.
+     */
+    virtual void Then(
+        RPC_FUTURE_CALLBACK callback,
+        void*               context
+        ) = 0;
+};
+
+/////////////////////////////////////////////////////////////////////////////
+////
+
+class IRpcScatter;
+
+typedef void (*RPC_SCATTER_CALLBACK)(
+    IRpcScatter* scatter,
+    void*        context
+    );
+
+/*
+ * the aggregated completion of a scatter-gather call. the "index"th call
+ * goes to the "index"th server of the pool.
+ */
+class IRpcScatter
+{
+public:
+
+    virtual ~IRpcScatter() {}
+
+    virtual unsigned long AddRef() = 0;
+
+    virtual unsigned long Release() = 0;
+
+    virtual size_t GetCallCount() const = 0;
+
+    /*
+     * the scatter is ready when all the results arrive, when the quorum
+     * succeeds, or when the quorum can't be reached anymore. the calls
+     * are bounded by their timeout, so it's ready by the deadline.
+     */
+    virtual bool IsReady() const = 0;
+
+    /*
+     * returns true if the scatter is ready within the timeout.
+     * don't call it in the reactor's threads.
+     */
+    virtual bool WaitFor(unsigned int timeoutInMilliseconds) = 0;
+
+    /*
+     * returns NULL if the scatter is not ready, or if the "index"th call
+     * was still in flight when it became ready. the result is owned by
+     * the scatter.
+     */
+    virtual IRpcPacket* GetResult(size_t index) const = 0;
+
+    virtual const char* GetServerIp(
+        size_t index,
+        char   serverIp[64]
+        ) const = 0;
+
+    virtual unsigned short GetServerPort(size_t index) const = 0;
+
+    /*
+     * the numbers of the results with RPCE_OK and with an error
+     */
+    virtual size_t GetOkCount() const = 0;
+
+    virtual size_t GetErrorCount() const = 0;
+
+    /*
+     * the callback is called once. If the scatter is ready, it's called
+     * immediately in the caller's thread; otherwise, it's called in the
+     * thread that completes the scatter.
+     */
+    virtual void Then(
+        RPC_SCATTER_CALLBACK callback,
+        void*                context
+        ) = 0;
 };
 
 /////////////////////////////////////////////////////////////////////////////
 ////
 
+class IRpcClient;
+
+/*
+ * the result is valid only during the callback. AddRef() it if necessary.
+ */
+typedef void (*RPC_RESULT_CALLBACK)(
+    IRpcClient* client,
+    IRpcPacket* result,
+    void*       context
+    );
+
 class IRpcClient
 {
 public:
@@ -480,6 +664,15 @@ public:
 
     virtual void UnregisterFunction(uint32_t functionId) = 0;
 
+    /*
+     * returns RPCE_CLIENT_BUSY if the pending calls reach the limit. it's
+     * "rpcc_pending_calls", or if "rpcc_adaptive_limit" is "1", a limit
+     * adjusted by the round trip time and by the RPCE_SERVER_BUSY and
+     * RPCE_NETWORK_TIMEOUT results, between "rpcc_adaptive_min" and
+     * "rpcc_pending_calls". the credits granted by the server lower it
+     * further. the calls answered by the cache or by a call in flight
+     * aren't counted.
+     */
     virtual RPC_ERROR_CODE SendRpcRequest(
         IRpcPacket*  request,
         bool         noreply             = false,
@@ -509,6 +702,127 @@ public:
     virtual void SetMagic2(int64_t magic2) = 0;
 
     virtual int64_t GetMagic2() const = 0;
+
+    /*
+     * the functions below are appended to keep the layout of the earlier
+     * versions
+     */
+
+    /*
+     * "functionFlags" is a combination of RPC_FF_XXX
+     *
+     * the calls of an RPC_FF_IDEMPOTENT function are retried on
+     * RPCE_NETWORK_BROKEN, RPCE_SERVER_BUSY and RPCE_NETWORK_TIMEOUT, at most
+     * "rpcc_retry_max" times within the original timeout. the request should
+     * not be modified until the result arrives. the retries are limited to
+     * "rpcc_retry_budget" percent of the calls, except those of
+     * RPCE_NETWORK_BROKEN, which wait for the logon after the backoff. if
+     * "rpcc_replay_on_reconnect" is "1", the calls are kept over a
+     * disconnection and resent after the logon, also within the original
+     * timeout.
+     *
+     * if "rpcc_cache_size" is greater than 0, the successful results of an
+     * RPC_FF_CACHEABLE function are cached for "rpcc_cache_ttl" seconds, keyed
+     * by the function id and the arguments. a call that hits the cache is
+     * completed from the reactor without a round trip. if "rpcc_coalesce" is
+     * "1", a call of an RPC_FF_CACHEABLE function that is the same as a call
+     * in flight isn't sent, and shares the result of that call.
+     */
+    virtual RPC_ERROR_CODE RegisterFunction2(
+        uint32_t             functionId,
+        const RPC_DATA_TYPE* callArgTypes,  /* = NULL */
+        size_t               callArgCount,  /* = 0 */
+        const RPC_DATA_TYPE* retnArgTypes,  /* = NULL */
+        size_t               retnArgCount,  /* = 0 */
+        uint32_t             functionFlags  /* = 0 */
+        ) = 0;
+
+    /*
+     * the result is delivered to the callback instead of the observer.
+     * the callback is called once if RPCE_OK is returned.
+     */
+    virtual RPC_ERROR_CODE SendRpcRequest(
+        IRpcPacket*         request,
+        RPC_RESULT_CALLBACK callback,
+        void*               context,
+        unsigned int        rpcTimeoutInSeconds = 0
+        ) = 0;
+
+    /*
+     * sends the requests in one message. if any request is invalid, none of
+     * them is sent. the server should be able to split batches.
+     */
+    virtual RPC_ERROR_CODE SendRpcRequests(
+        IRpcPacket** requests,
+        size_t       count,
+        bool         noreply             = false,
+        unsigned int rpcTimeoutInSeconds = 0
+        ) = 0;
+
+    /*
+     * sends the requests as a pipeline in one message. the server runs them
+     * in order, each after the result of the one before, and sends all the
+     * results back in one message. "refs" take the arguments of the later
+     * calls from the results of the earlier ones. if a call fails, the later
+     * ones fail with RPCE_CANCELED. the results are delivered one by one, as
+     * those of SendRpcRequest(), and the calls aren't retried.
+     */
+    virtual RPC_ERROR_CODE SendRpcPipeline(
+        IRpcPacket**            requests,
+        size_t                  count,
+        const RPC_PIPELINE_REF* refs                = NULL,
+        size_t                  refCount            = 0,
+        unsigned int            rpcTimeoutInSeconds = 0
+        ) = 0;
+
+    /*
+     * available if "rpcc_completion_queue" is "1", otherwise returns 0 at
+     * once. the results of the calls without callbacks or futures are queued
+     * instead of being delivered to the observer. returns the number of the
+     * results, each of which should be released by the caller. the calls
+     * still pending at the end of the client are queued with RPCE_ERROR, and
+     * then the pollers no longer wait.
+     */
+    virtual size_t PollResults(
+        IRpcPacket** results,
+        size_t       maxCount,
+        unsigned int timeoutInMilliseconds
+        ) = 0;
+
+    /*
+     * the result is delivered to the future instead of the observer.
+     * a completed future is returned if the request can't be sent.
+     */
+    virtual IRpcFuture* CallAsync(
+        IRpcPacket*  request,
+        unsigned int rpcTimeoutInSeconds = 0
+        ) = 0;
+
+    /*
+     * blocks until the result arrives. don't call it in the reactor's threads.
+     * "*result" should be released by the caller.
+     */
+    virtual RPC_ERROR_CODE CallSync(
+        IRpcPacket*  request,
+        IRpcPacket** result,
+        unsigned int rpcTimeoutInSeconds = 0
+        ) = 0;
+
+    /*
+     * completes the pending call with RPCE_CANCELED at once, and asks the
+     * server to drop the request if it's still queued. the late result is
+     * discarded. returns false if the call isn't pending.
+     */
+    virtual bool CancelRpc(uint64_t requestId) = 0;
+
+    /*
+     * if "rpcc_batch_window_us" isn't "0", the requests are held and sent
+     * in one message when the window expires, when they reach
+     * "rpcc_batch_max_bytes", or when Flush() is called. the server splits
+     * the message apart. SendRpcRequests() of more than one request isn't
+     * held, and one request is sent as by SendRpcRequest().
+     */
+    virtual void Flush() = 0;
 };
 
 class IRpcClientObserver
@@ -558,6 +872,197 @@ public:
 /////////////////////////////////////////////////////////////////////////////
 ////
 
+/*
+ * keeps "rpcc_pool_connections" connections to each server. each call goes
+ * through one of them, chosen by "rpcc_pool_policy".
+ */
+class IRpcClientPool
+{
+public:
+
+    virtual ~IRpcClientPool() {}
+
+    virtual unsigned long AddRef() = 0;
+
+    virtual unsigned long Release() = 0;
+
+    virtual RTP_MM_TYPE GetMmType() const = 0;
+
+    virtual size_t GetClientCount() const = 0;
+
+    /*
+     * the client is owned by the pool
+     */
+    virtual IRpcClient* GetClient(size_t index) const = 0;
+
+    virtual size_t GetLogonCount() const = 0;
+
+    /*
+     * the servers are in the order they were added
+     */
+    virtual size_t GetServerCount() const = 0;
+
+    virtual const char* GetServerIp(
+        size_t index,
+        char   serverIp[64]
+        ) const = 0;
+
+    virtual unsigned short GetServerPort(size_t index) const = 0;
+
+    virtual RPC_ERROR_CODE RegisterFunction(
+        uint32_t             functionId,
+        const RPC_DATA_TYPE* callArgTypes, /* = NULL */
+        size_t               callArgCount, /* = 0 */
+        const RPC_DATA_TYPE* retnArgTypes, /* = NULL */
+        size_t               retnArgCount  /* = 0 */
+        ) = 0;
+
+    /*
+     * if "rpcc_pool_hedge" is "1", the calls of an RPC_FF_IDEMPOTENT function
+     * are hedged. if no result arrives within the "rpcc_pool_hedge_percentile"
+     * latency, a copy is sent through another connection, preferably to
+     * another server. the first result wins. the copies are limited to
+     * "rpcc_pool_hedge_budget" percent of the hedged calls.
+     */
+    virtual RPC_ERROR_CODE RegisterFunction2(
+        uint32_t             functionId,
+        const RPC_DATA_TYPE* callArgTypes,  /* = NULL */
+        size_t               callArgCount,  /* = 0 */
+        const RPC_DATA_TYPE* retnArgTypes,  /* = NULL */
+        size_t               retnArgCount,  /* = 0 */
+        uint32_t             functionFlags  /* = 0 */
+        ) = 0;
+
+    virtual void UnregisterFunction(uint32_t functionId) = 0;
+
+    /*
+     * the calls of a bulk function (e.g., one returning a large array) go
+     * through the dedicated connection if "rpcc_pool_policy" is "size"
+     */
+    virtual void SetBulkFunction(
+        uint32_t functionId,
+        bool     bulk
+        ) = 0;
+
+    /*
+     * if "rpcc_pool_policy" is "hash", the calls with the same key go to the
+     * same server. the key is the "argIndex"th argument, or the first
+     * RPC_DT_UINT64 one by default ("argIndex" < 0).
+     */
+    virtual void SetHashArgument(
+        uint32_t functionId,
+        int      argIndex
+        ) = 0;
+
+    /*
+     * only the keys on the ring segments of the joining or leaving server
+     * are moved. the last server can't be removed.
+     */
+    virtual bool AddServer(
+        const char*    serverIp,
+        unsigned short serverPort
+        ) = 0;
+
+    virtual void RemoveServer(
+        const char*    serverIp,
+        unsigned short serverPort
+        ) = 0;
+
+    virtual RPC_ERROR_CODE SendRpcRequest(
+        IRpcPacket*  request,
+        bool         noreply             = false,
+        unsigned int rpcTimeoutInSeconds = 0
+        ) = 0;
+
+    virtual RPC_ERROR_CODE SendRpcRequest(
+        IRpcPacket*         request,
+        RPC_RESULT_CALLBACK callback,
+        void*               context,
+        unsigned int        rpcTimeoutInSeconds = 0
+        ) = 0;
+
+    virtual IRpcFuture* CallAsync(
+        IRpcPacket*  request,
+        unsigned int rpcTimeoutInSeconds = 0
+        ) = 0;
+
+    virtual RPC_ERROR_CODE CallSync(
+        IRpcPacket*  request,
+        IRpcPacket** result,
+        unsigned int rpcTimeoutInSeconds = 0
+        ) = 0;
+
+    /*
+     * sends a call to each server of the pool at once, through one of its
+     * connections. "requests[0]" goes to all the servers if "count" is 1;
+     * otherwise, "count" must be the number of the servers, and
+     * "requests[i]" goes to the "i"th one. the calls still in flight are
+     * canceled when the scatter is ready.
+     *
+     * "quorum" is the number of the results with RPCE_OK that's enough,
+     * or 0 for all.
+     *
+     * returns NULL if the arguments are invalid.
+     */
+    virtual IRpcScatter* CallScatter(
+        IRpcPacket** requests,
+        size_t       count,
+        size_t       quorum              = 0,
+        unsigned int rpcTimeoutInSeconds = 0
+        ) = 0;
+
+    /*
+     * cancels the call on all the connections that carry it
+     */
+    virtual bool CancelRpc(uint64_t requestId) = 0;
+
+    /*
+     * flushes the held requests of all the connections
+     */
+    virtual void Flush() = 0;
+};
+
+class IRpcClientPoolObserver
+{
+public:
+
+    virtual ~IRpcClientPoolObserver() {}
+
+    virtual unsigned long AddRef() = 0;
+
+    virtual unsigned long Release() = 0;
+
+    /*
+     * the first connection is up
+     */
+    virtual void OnLogon(IRpcClientPool* pool) = 0;
+
+    /*
+     * the last connection is down. the pool reconnects by itself.
+     */
+    virtual void OnLogoff(
+        IRpcClientPool* pool,
+        int             errorCode,
+        int             sslCode,
+        bool            tcpConnected
+        ) = 0;
+
+    virtual void OnRpcResult(
+        IRpcClientPool* pool,
+        IRpcPacket*     result
+        ) = 0;
+
+    virtual void OnRecvMsgFromServer(
+        IRpcClientPool* pool,
+        const void*     buf,
+        size_t          size,
+        uint16_t        charset
+        ) = 0;
+};
+
+/////////////////////////////////////////////////////////////////////////////
+////
+
 class IRpcServer
 {
 public:
@@ -582,6 +1087,17 @@ public:
 
     virtual void UnregisterFunction(uint32_t functionId) = 0;
 
+    /*
+     * if "rpcs_credits" is "1", the result carries the credits of the
+     * client, i.e., how many calls it may have in flight. they're its calls
+     * in the queue plus an equal share of the free part of the queue. the
+     * client honors them if its "rpcc_credits" is "1".
+     *
+     * if "rpcs_coalesce_bytes" isn't "0", the results are held per client
+     * and sent in one message when they reach that size, when the worker
+     * lane has no more queued requests of the client, or every
+     * "rpcs_coalesce_delay" milliseconds.
+     */
     virtual RPC_ERROR_CODE SendRpcResult(IRpcPacket* result) = 0;
 
     virtual bool SendMsgToClients(
@@ -593,6 +1109,61 @@ public:
         ) = 0;
 
     virtual void KickoutClient(uint64_t clientId) = 0;
+
+    /*
+     * the functions below are appended to keep the layout of the earlier
+     * versions
+     */
+
+    /*
+     * "groupName" is the name of a worker group, or NULL for the default
+     * group. a group is configured by "rpcs_group_<name>_workers" and
+     * "rpcs_group_<name>_pending_calls", and has its own worker threads and
+     * queue. a slow function then can only saturate its own group.
+     */
+    virtual RPC_ERROR_CODE RegisterFunction2(
+        uint32_t             functionId,
+        const RPC_DATA_TYPE* callArgTypes, /* = NULL */
+        size_t               callArgCount, /* = 0 */
+        const RPC_DATA_TYPE* retnArgTypes, /* = NULL */
+        size_t               retnArgCount, /* = 0 */
+        const char*          groupName     /* = NULL */
+        ) = 0;
+
+    /*
+     * dispatches the requests of the function by the hash of an argument,
+     * e.g., a user id, instead of by the client. the requests of a key run in
+     * the same worker thread of the group, in order if they have the same
+     * priority and "rpcs_scheduler" is "fifo". the handlers can keep the
+     * per-key state in the thread without a lock.
+     *
+     * "argIndex" is -1 for the client (the default).
+     */
+    virtual RPC_ERROR_CODE SetAffinityArgument(
+        uint32_t functionId,
+        int      argIndex
+        ) = 0;
+
+    /*
+     * sends the results to each client in one message. if any result is
+     * invalid, none of them is sent.
+     */
+    virtual RPC_ERROR_CODE SendRpcResults(
+        IRpcPacket** results,
+        size_t       count
+        ) = 0;
+
+    /*
+     * drops the cached results of the clients. "args" is NULL for all the
+     * results of the function, and "functionId" is 0 for all the results.
+     */
+    virtual bool InvalidateCache(
+        const uint64_t*     dstClients,
+        unsigned char       dstClientCount,
+        uint32_t            functionId, /* = 0 */
+        const RPC_ARGUMENT* args,       /* = NULL */
+        size_t              argCount    /* = 0 */
+        ) = 0;
 };
 
 class IRpcServerObserver
@@ -632,6 +1203,23 @@ public:
         ) = 0;
 };
 
+/*
+ * the requests are delivered by OnRpcRequestBatch() instead of
+ * OnRpcRequest(). a worker takes up to "rpcs_batch_size" queued requests of
+ * the same function from a client or a key channel, in order. the results
+ * can be sent by SendRpcResults().
+ */
+class IRpcServerObserver2 : public IRpcServerObserver
+{
+public:
+
+    virtual void OnRpcRequestBatch(
+        IRpcServer*  server,
+        IRpcPacket** requests,
+        size_t       count
+        ) = 0;
+};
+
 /////////////////////////////////////////////////////////////////////////////
 ////
 
@@ -667,6 +1255,44 @@ PRO_RPC_API
 void
 DeleteRpcClient(IRpcClient* client);
 
+PRO_RPC_API
+IRpcClientPool*
+CreateRpcClientPool(IRpcClientPoolObserver* observer,
+                    IProReactor*            reactor,
+                    const char*             argv0,      /* = NULL */
+                    const char*             configFileName,
+                    RTP_MM_TYPE             mmType,     /* = 0 */
+                    const char*             serverIp,   /* = NULL */
+                    unsigned short          serverPort, /* = 0 */
+                    const RTP_MSG_USER*     user,       /* = NULL */
+                    const char*             password,   /* = NULL */
+                    const char*             localIp);   /* = NULL */
+
+/*
+ * the servers run the same functions. the calls are balanced among them by
+ * "rpcc_pool_policy" ("p2c" or "p2c_ewma" is suggested), and a server is
+ * ejected for "rpcc_pool_eject_time" seconds after returning
+ * "rpcc_pool_eject_failures" RPCE_SERVER_BUSY/RPCE_NETWORK_TIMEOUT results
+ * in a row.
+ */
+PRO_RPC_API
+IRpcClientPool*
+CreateRpcClientPool2(IRpcClientPoolObserver* observer,
+                     IProReactor*            reactor,
+                     const char*             argv0,       /* = NULL */
+                     const char*             configFileName,
+                     RTP_MM_TYPE             mmType,      /* = 0 */
+                     const char**            serverIps,
+                     const unsigned short*   serverPorts,
+                     size_t                  serverCount,
+                     const RTP_MSG_USER*     user,        /* = NULL */
+                     const char*             password,    /* = NULL */
+                     const char*             localIp);    /* = NULL */
+
+PRO_RPC_API
+void
+DeleteRpcClientPool(IRpcClientPool* pool);
+
 PRO_RPC_API
 IRpcServer*
 CreateRpcServer(IRpcServerObserver* observer,
@@ -676,6 +1302,15 @@ CreateRpcServer(IRpcServerObserver* observer,
                 RTP_MM_TYPE         mmType,          /* = 0 */
                 unsigned short      serviceHubPort); /* = 0 */
 
+PRO_RPC_API
+IRpcServer*
+CreateRpcServer2(IRpcServerObserver2* observer,
+                 IProReactor*         reactor,
+                 const char*          argv0,           /* = NULL */
+                 const char*          configFileName,
+                 RTP_MM_TYPE          mmType,          /* = 0 */
+                 unsigned short       serviceHubPort); /* = 0 */
+
 PRO_RPC_API
 void
 DeleteRpcServer(IRpcServer* server);
@@ -18,6 +18,7 @@
 
 #include "pro_rpc.h"
 #include "rpc_client.h"
+#include "rpc_client_pool.h"
 #include "rpc_packet.h"
 #include "rpc_server.h"
 #include "pronet/pro_stl.h"
@@ -112,6 +113,85 @@ DeleteRpcClient(IRpcClient* client)
     p->Release();
 }
 
+PRO_RPC_API
+IRpcClientPool*
+CreateRpcClientPool(IRpcClientPoolObserver* observer,
+                    IProReactor*            reactor,
+                    const char*             argv0,      /* = NULL */
+                    const char*             configFileName,
+                    RTP_MM_TYPE             mmType,     /* = 0 */
+                    const char*             serverIp,   /* = NULL */
+                    unsigned short          serverPort, /* = 0 */
+                    const RTP_MSG_USER*     user,       /* = NULL */
+                    const char*             password,   /* = NULL */
+                    const char*             localIp)    /* = NULL */
+{
+    ProRtpInit();
+
+    CRpcClientPool* pool = CRpcClientPool::CreateInstance();
+    if (pool == NULL)
+    {
+        return NULL;
+    }
+
+    if (!pool->Init(observer, reactor, argv0, configFileName, mmType,
+        &serverIp, &serverPort, 1, user, password, localIp))
+    {
+        pool->Release();
+
+        return NULL;
+    }
+
+    return pool;
+}
+
+PRO_RPC_API
+IRpcClientPool*
+CreateRpcClientPool2(IRpcClientPoolObserver* observer,
+                     IProReactor*            reactor,
+                     const char*             argv0,       /* = NULL */
+                     const char*             configFileName,
+                     RTP_MM_TYPE             mmType,      /* = 0 */
+                     const char**            serverIps,
+                     const unsigned short*   serverPorts,
+                     size_t                  serverCount,
+                     const RTP_MSG_USER*     user,        /* = NULL */
+                     const char*             password,    /* = NULL */
+                     const char*             localIp)     /* = NULL */
+{
+    ProRtpInit();
+
+    CRpcClientPool* pool = CRpcClientPool::CreateInstance();
+    if (pool == NULL)
+    {
+        return NULL;
+    }
+
+    if (!pool->Init(observer, reactor, argv0, configFileName, mmType,
+        serverIps, serverPorts, serverCount, user, password, localIp))
+    {
+        pool->Release();
+
+        return NULL;
+    }
+
+    return pool;
+}
+
+PRO_RPC_API
+void
+DeleteRpcClientPool(IRpcClientPool* pool)
+{
+    if (pool == NULL)
+    {
+        return;
+    }
+
+    CRpcClientPool* p = (CRpcClientPool*)pool;
+    p->Fini();
+    p->Release();
+}
+
 PRO_RPC_API
 IRpcServer*
 CreateRpcServer(IRpcServerObserver* observer,
@@ -123,7 +203,34 @@ CreateRpcServer(IRpcServerObserver* observer,
 {
     ProRtpInit();
 
-    CRpcServer* server = CRpcServer::CreateInstance();
+    CRpcServer* server = CRpcServer::CreateInstance(false);
+    if (server == NULL)
+    {
+        return NULL;
+    }
+
+    if (!server->Init(observer, reactor, argv0, configFileName, mmType, serviceHubPort))
+    {
+        server->Release();
+
+        return NULL;
+    }
+
+    return server;
+}
+
+PRO_RPC_API
+IRpcServer*
+CreateRpcServer2(IRpcServerObserver2* observer,
+                 IProReactor*         reactor,
+                 const char*          argv0,          /* = NULL */
+                 const char*          configFileName,
+                 RTP_MM_TYPE          mmType,         /* = 0 */
+                 unsigned short       serviceHubPort) /* = 0 */
+{
+    ProRtpInit();
+
+    CRpcServer* server = CRpcServer::CreateInstance(true);
     if (server == NULL)
     {
         return NULL;
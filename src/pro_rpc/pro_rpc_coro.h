@@ -0,0 +1,539 @@
+/*
+ * Copyright (C) 2018-2019 Eric Tung <libpronet@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"),
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * This file is part of LibProRpc (https://github.com/libpronet/libprorpc)
+ */
+
+/*
+ * This is an optional, header-only C++20 layer over IRpcClient.
+ *
+ * client side:
+ *
+ *   CRpcTask Foo(IRpcClient* client, IRpcPacket* request)
+ *   {
+ *       CRpcCallResult r = co_await RpcCall(client, request, 5);
+ *       if (r.GetRpcCode() == RPCE_OK)
+ *       {
+ *           ... r->GetArgument(0, &arg) ...
+ *       }
+ *   }
+ *
+ * server side, the handler returns to the worker at the first suspension:
+ *
+ *   virtual void OnRpcRequest(IRpcServer* server, IRpcPacket* request)
+ *   {
+ *       Handle(server, CRpcPacketRef(request));
+ *   }
+ *
+ *   CRpcTask Handle(IRpcServer* server, CRpcPacketRef request)
+ *   {
+ *       CRpcCallResult r = co_await RpcCall(m_downstream, ...);
+ *       ...
+ *       server->SendRpcResult(result);
+ *   }
+ *
+ * The coroutine is resumed in the thread that completes the call (a
+ * reactor's thread), or by the executor if one is given.
+ */
+
+#if !defined(____PRO_RPC_CORO_H____)
+#define ____PRO_RPC_CORO_H____
+
+#include "pro_rpc.h"
+
+#if defined(_MSVC_LANG)
+#define PRO_RPC_CPLUSPLUS _MSVC_LANG
+#else
+#define PRO_RPC_CPLUSPLUS __cplusplus
+#endif
+
+#if PRO_RPC_CPLUSPLUS >= 202002L
+
+#include <atomic>
+#include <coroutine>
+#include <exception>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+/////////////////////////////////////////////////////////////////////////////
+////
+
+class IRpcExecutor
+{
+public:
+
+    virtual ~IRpcExecutor() {}
+
+    virtual void Post(
+        void (*routine)(void* arg),
+        void* arg
+        ) = 0;
+};
+
+/////////////////////////////////////////////////////////////////////////////
+////
+
+/*
+ * holds a reference of the packet
+ */
+class CRpcPacketRef
+{
+public:
+
+    CRpcPacketRef(IRpcPacket* packet = NULL)
+    : m_packet(packet)
+    {
+        if (m_packet != NULL)
+        {
+            m_packet->AddRef();
+        }
+    }
+
+    CRpcPacketRef(const CRpcPacketRef& other)
+    : CRpcPacketRef(other.m_packet)
+    {
+    }
+
+    CRpcPacketRef(CRpcPacketRef&& other) noexcept
+    : m_packet(other.m_packet)
+    {
+        other.m_packet = NULL;
+    }
+
+    ~CRpcPacketRef()
+    {
+        if (m_packet != NULL)
+        {
+            m_packet->Release();
+        }
+    }
+
+    CRpcPacketRef& operator=(CRpcPacketRef other) noexcept
+    {
+        std::swap(m_packet, other.m_packet);
+
+        return *this;
+    }
+
+    IRpcPacket* Get() const
+    {
+        return m_packet;
+    }
+
+    IRpcPacket* operator->() const
+    {
+        return m_packet;
+    }
+
+private:
+
+    IRpcPacket* m_packet;
+};
+
+/////////////////////////////////////////////////////////////////////////////
+////
+
+class CRpcCallResult
+{
+public:
+
+    CRpcCallResult(
+        RPC_ERROR_CODE rpcCode = RPCE_ERROR,
+        IRpcPacket*    packet  = NULL
+        )
+    : m_rpcCode(rpcCode), m_packet(packet)
+    {
+    }
+
+    RPC_ERROR_CODE GetRpcCode() const
+    {
+        return m_rpcCode;
+    }
+
+    /*
+     * NULL if the request can't be sent or the call is canceled
+     */
+    IRpcPacket* Get() const
+    {
+        return m_packet.Get();
+    }
+
+    IRpcPacket* operator->() const
+    {
+        return m_packet.Get();
+    }
+
+private:
+
+    RPC_ERROR_CODE m_rpcCode;
+    CRpcPacketRef  m_packet;
+};
+
+/////////////////////////////////////////////////////////////////////////////
+////
+
+class CRpcCancelToken;
+
+struct RPC_CORO_CALL_STATE
+{
+    RPC_CORO_CALL_STATE()
+    : refCount(1), done(false), armed(false)
+    {
+    }
+
+    void AddRef()
+    {
+        refCount.fetch_add(1);
+    }
+
+    void Release()
+    {
+        if (refCount.fetch_sub(1) == 1)
+        {
+            delete this;
+        }
+    }
+
+    /*
+     * only the first call takes effect
+     */
+    void Complete(
+        RPC_ERROR_CODE rpcCode,
+        IRpcPacket*    packet
+        )
+    {
+        if (done.exchange(true))
+        {
+            return;
+        }
+
+        result = CRpcCallResult(rpcCode, packet);
+
+        /*
+         * if the awaiter is still in await_suspend(), it won't suspend
+         */
+        if (!armed.exchange(true))
+        {
+            return;
+        }
+
+        if (executor != NULL)
+        {
+            executor->Post(&RPC_CORO_CALL_STATE::Resume_s, handle.address());
+        }
+        else
+        {
+            handle.resume();
+        }
+    }
+
+    static void Resume_s(void* arg)
+    {
+        std::coroutine_handle<>::from_address(arg).resume();
+    }
+
+    std::atomic<long>       refCount;
+    std::atomic<bool>       done;
+    std::atomic<bool>       armed;
+    std::coroutine_handle<> handle;
+    IRpcExecutor*           executor  = NULL;
+    IRpcClient*             client    = NULL;
+    uint64_t                requestId = 0;
+    CRpcCallResult          result;
+};
+
+/*
+ * Cancel() completes all the registered calls with RPCE_CANCELED, and
+ * cancels them at the server by IRpcClient::CancelRpc().
+ * The late results are discarded.
+ */
+class CRpcCancelToken
+{
+public:
+
+    CRpcCancelToken()
+    : m_canceled(false)
+    {
+    }
+
+    ~CRpcCancelToken()
+    {
+        std::lock_guard<std::mutex> mon(m_lock);
+
+        for (RPC_CORO_CALL_STATE* state : m_states)
+        {
+            state->Release();
+        }
+    }
+
+    bool IsCanceled() const
+    {
+        return m_canceled.load();
+    }
+
+    void Cancel()
+    {
+        std::vector<RPC_CORO_CALL_STATE*> states;
+
+        {
+            std::lock_guard<std::mutex> mon(m_lock);
+
+            if (m_canceled.exchange(true))
+            {
+                return;
+            }
+
+            states.swap(m_states);
+        }
+
+        for (RPC_CORO_CALL_STATE* state : states)
+        {
+            if (!state->done.load() && state->client != NULL)
+            {
+                state->client->CancelRpc(state->requestId);
+            }
+
+            state->Complete(RPCE_CANCELED, NULL); /* no-op if completed */
+            state->Release();
+        }
+    }
+
+    /*
+     * returns false if it has been canceled
+     */
+    bool Register(RPC_CORO_CALL_STATE* state)
+    {
+        std::lock_guard<std::mutex> mon(m_lock);
+
+        if (m_canceled.load())
+        {
+            return false;
+        }
+
+        /*
+         * drop the completed ones
+         */
+        size_t j = 0;
+        for (size_t i = 0; i < m_states.size(); ++i)
+        {
+            if (m_states[i]->done.load())
+            {
+                m_states[i]->Release();
+            }
+            else
+            {
+                m_states[j++] = m_states[i];
+            }
+        }
+        m_states.resize(j);
+
+        state->AddRef();
+        m_states.push_back(state);
+
+        return true;
+    }
+
+private:
+
+    std::atomic<bool>                 m_canceled;
+    std::vector<RPC_CORO_CALL_STATE*> m_states;
+    std::mutex                        m_lock;
+};
+
+/////////////////////////////////////////////////////////////////////////////
+////
+
+class CRpcCallAwaitable
+{
+public:
+
+    CRpcCallAwaitable(
+        IRpcClient*      client,
+        IRpcPacket*      request,
+        unsigned int     rpcTimeoutInSeconds,
+        IRpcExecutor*    executor,
+        CRpcCancelToken* cancelToken
+        )
+    : m_client(client),
+      m_request(request),
+      m_rpcTimeoutInSeconds(rpcTimeoutInSeconds),
+      m_executor(executor),
+      m_cancelToken(cancelToken),
+      m_state(NULL)
+    {
+    }
+
+    CRpcCallAwaitable(const CRpcCallAwaitable&) = delete;
+
+    CRpcCallAwaitable& operator=(const CRpcCallAwaitable&) = delete;
+
+    ~CRpcCallAwaitable()
+    {
+        if (m_state != NULL)
+        {
+            m_state->Release();
+        }
+    }
+
+    bool await_ready() const noexcept
+    {
+        return false;
+    }
+
+    bool await_suspend(std::coroutine_handle<> handle)
+    {
+        if (m_client == NULL || m_request.Get() == NULL)
+        {
+            m_result = CRpcCallResult(RPCE_INVALID_ARGUMENT, NULL);
+
+            return false;
+        }
+
+        m_state = new RPC_CORO_CALL_STATE;
+        m_state->handle    = handle;
+        m_state->executor  = m_executor;
+        m_state->client    = m_client;
+        m_state->requestId = m_request->GetRequestId();
+
+        if (m_cancelToken != NULL && !m_cancelToken->Register(m_state))
+        {
+            m_state->done.store(true);
+            m_state->result = CRpcCallResult(RPCE_CANCELED, NULL);
+
+            return false;
+        }
+
+        m_state->AddRef(); /* for the callback */
+
+        RPC_ERROR_CODE rpcCode = m_client->SendRpcRequest(
+            m_request.Get(), &CRpcCallAwaitable::OnRpcResult_s, m_state, m_rpcTimeoutInSeconds);
+        if (rpcCode != RPCE_OK)
+        {
+            m_state->Release();
+            m_state->Complete(rpcCode, NULL); /* no-op if canceled */
+
+            return false;
+        }
+
+        /*
+         * the token may have been canceled before the request was sent,
+         * when there was nothing to cancel. it's a no-op if the result has
+         * arrived.
+         */
+        if (m_state->done.load())
+        {
+            m_client->CancelRpc(m_state->requestId);
+        }
+
+        /*
+         * if the call has been completed, go on without suspending;
+         * otherwise, the coroutine will be resumed by Complete()
+         */
+        return !m_state->armed.exchange(true);
+    }
+
+    CRpcCallResult await_resume()
+    {
+        if (m_state != NULL)
+        {
+            return std::move(m_state->result);
+        }
+
+        return m_result;
+    }
+
+private:
+
+    static void OnRpcResult_s(
+        IRpcClient* client,
+        IRpcPacket* result,
+        void*       context
+        )
+    {
+        RPC_CORO_CALL_STATE* state = (RPC_CORO_CALL_STATE*)context;
+        state->Complete(result->GetRpcCode(), result);
+        state->Release();
+    }
+
+private:
+
+    IRpcClient* const      m_client;
+    CRpcPacketRef          m_request;
+    const unsigned int     m_rpcTimeoutInSeconds;
+    IRpcExecutor* const    m_executor;
+    CRpcCancelToken* const m_cancelToken;
+    RPC_CORO_CALL_STATE*   m_state;
+    CRpcCallResult         m_result;
+};
+
+/*
+ * co_await RpcCall(...) yields a CRpcCallResult
+ */
+inline
+CRpcCallAwaitable
+RpcCall(IRpcClient*      client,
+        IRpcPacket*      request,
+        unsigned int     rpcTimeoutInSeconds = 0,
+        IRpcExecutor*    executor            = NULL,
+        CRpcCancelToken* cancelToken         = NULL)
+{
+    return CRpcCallAwaitable(client, request, rpcTimeoutInSeconds, executor, cancelToken);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+////
+
+/*
+ * a fire-and-forget coroutine. It starts eagerly and frees itself when done.
+ */
+class CRpcTask
+{
+public:
+
+    struct promise_type
+    {
+        CRpcTask get_return_object() noexcept
+        {
+            return CRpcTask();
+        }
+
+        std::suspend_never initial_suspend() noexcept
+        {
+            return std::suspend_never();
+        }
+
+        std::suspend_never final_suspend() noexcept
+        {
+            return std::suspend_never();
+        }
+
+        void return_void() noexcept
+        {
+        }
+
+        void unhandled_exception() noexcept
+        {
+            std::terminate();
+        }
+    };
+};
+
+/////////////////////////////////////////////////////////////////////////////
+////
+
+#endif /* PRO_RPC_CPLUSPLUS >= 202002L */
+
+#endif /* ____PRO_RPC_CORO_H____ */
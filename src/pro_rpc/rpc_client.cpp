@@ -18,9 +18,11 @@
 
 #include "rpc_client.h"
 #include "pro_rpc.h"
+#include "rpc_future.h"
 #include "rpc_packet.h"
 #include "rpc_server.h"
 #include "promsg/msg_client.h"
+#include "pronet/pro_buffer.h"
 #include "pronet/pro_config_file.h"
 #include "pronet/pro_memory_pool.h"
 #include "pronet/pro_net.h"
@@ -31,6 +33,8 @@
 #include "pronet/pro_z.h"
 #include "pronet/rtp_base.h"
 #include "pronet/rtp_msg.h"
+#include <algorithm>
+#include <cmath>
 
 /////////////////////////////////////////////////////////////////////////////
 ////
@@ -39,6 +43,14 @@ static const RTP_MSG_USER  RPC_ROOT_ID(1, 1, 0); /* 1-1 */
 static const unsigned char RPC_CID = 2;
 static const uint16_t      RPC_IID = 1;
 
+#define RETRY_MAX_TOKENS      10.0
+#define ADAPTIVE_INITIAL      100.0
+#define ADAPTIVE_SHORT_ALPHA  0.2
+#define ADAPTIVE_LONG_ALPHA   0.01
+#define ADAPTIVE_TOLERANCE    2.0
+#define ADAPTIVE_SMOOTHING    0.2
+#define ADAPTIVE_BACKOFF      0.9
+
 /////////////////////////////////////////////////////////////////////////////
 ////
 
@@ -71,12 +83,179 @@ ReadConfig_i(const CProStlVector<PRO_CONFIG_ITEM>& configs,
                 configInfo.rpcc_rpc_timeout = value;
             }
         }
+        else if (stricmp(configName.c_str(), "rpcc_completion_queue") == 0)
+        {
+            configInfo.rpcc_completion_queue = atoi(configValue.c_str()) != 0;
+        }
+        else if (stricmp(configName.c_str(), "rpcc_retry_max") == 0)
+        {
+            int value = atoi(configValue.c_str());
+            if (value >= 0 && value <= 10)
+            {
+                configInfo.rpcc_retry_max = value;
+            }
+        }
+        else if (stricmp(configName.c_str(), "rpcc_retry_budget") == 0)
+        {
+            int value = atoi(configValue.c_str());
+            if (value > 0 && value <= 100)
+            {
+                configInfo.rpcc_retry_budget = value;
+            }
+        }
+        else if (stricmp(configName.c_str(), "rpcc_retry_backoff") == 0)
+        {
+            int value = atoi(configValue.c_str());
+            if (value > 0 && value <= 10000)
+            {
+                configInfo.rpcc_retry_backoff = value;
+            }
+        }
+        else if (stricmp(configName.c_str(), "rpcc_replay_on_reconnect") == 0)
+        {
+            configInfo.rpcc_replay_on_reconnect = atoi(configValue.c_str()) != 0;
+        }
+        else if (stricmp(configName.c_str(), "rpcc_cache_size") == 0)
+        {
+            int value = atoi(configValue.c_str());
+            if (value >= 0 && value <= 1000000)
+            {
+                configInfo.rpcc_cache_size = value;
+            }
+        }
+        else if (stricmp(configName.c_str(), "rpcc_cache_ttl") == 0)
+        {
+            int value = atoi(configValue.c_str());
+            if (value > 0 && value <= 86400)
+            {
+                configInfo.rpcc_cache_ttl = value;
+            }
+        }
+        else if (stricmp(configName.c_str(), "rpcc_coalesce") == 0)
+        {
+            configInfo.rpcc_coalesce = atoi(configValue.c_str()) != 0;
+        }
+        else if (stricmp(configName.c_str(), "rpcc_adaptive_limit") == 0)
+        {
+            configInfo.rpcc_adaptive_limit = atoi(configValue.c_str()) != 0;
+        }
+        else if (stricmp(configName.c_str(), "rpcc_adaptive_min") == 0)
+        {
+            int value = atoi(configValue.c_str());
+            if (value > 0 && value <= 10000)
+            {
+                configInfo.rpcc_adaptive_min = value;
+            }
+        }
+        else if (stricmp(configName.c_str(), "rpcc_credits") == 0)
+        {
+            configInfo.rpcc_credits = atoi(configValue.c_str()) != 0;
+        }
+        else if (stricmp(configName.c_str(), "rpcc_batch_window_us") == 0)
+        {
+            int value = atoi(configValue.c_str());
+            if (value >= 0 && value <= 1000000)
+            {
+                configInfo.rpcc_batch_window_us = value;
+            }
+        }
+        else if (stricmp(configName.c_str(), "rpcc_batch_max_bytes") == 0)
+        {
+            int value = atoi(configValue.c_str());
+            if (value > 0 && value <= 1048576)
+            {
+                configInfo.rpcc_batch_max_bytes = value;
+            }
+        }
         else
         {
         }
     } /* end of for () */
 }
 
+static
+CRpcPacket*
+CreateErrorResult_i(uint64_t        clientId,
+                    const RPC_HDR2& hdr,
+                    RPC_ERROR_CODE  rpcCode)
+{
+    CRpcPacket* result = CRpcPacket::CreateInstance(hdr.requestId, hdr.functionId, false);
+    if (result == NULL)
+    {
+        return NULL;
+    }
+
+    result->SetClientId(clientId);
+    result->SetRpcCode(rpcCode);
+    result->SetMagic1(hdr.magic1);
+    result->SetMagic2(hdr.magic2);
+    result->SetMagicStr(hdr.magicStr.c_str());
+
+    result->CleanAndBeginPushArgument();
+    if (!result->EndPushArgument())
+    {
+        result->Release();
+        result = NULL;
+    }
+
+    return result;
+}
+
+/*
+ * not a cache hit, a follower, or a call waiting to be resent
+ */
+static
+bool
+IsOnWire_i(const RPC_HDR2& hdr)
+{
+    return hdr.hit == NULL && hdr.leaderId == 0 && !hdr.backoff;
+}
+
+static
+CRpcPacket*
+CloneResult_i(uint64_t          clientId,
+              const RPC_HDR2&   hdr,
+              const CRpcPacket* cached)
+{
+    CRpcPacket* result = CRpcPacket::CreateInstance(
+        hdr.requestId,
+        hdr.functionId,
+        true /* this is a rebuilt packet */
+        );
+    if (result == NULL)
+    {
+        return NULL;
+    }
+
+    result->SetClientId(clientId);
+    result->SetRpcCode(RPCE_OK);
+    result->SetMagic1(hdr.magic1);
+    result->SetMagic2(hdr.magic2);
+    result->SetMagicStr(hdr.magicStr.c_str());
+
+    CProStlVector<RPC_ARGUMENT> args(cached->GetArgumentCount());
+
+    result->CleanAndBeginPushArgument();
+    if (args.size() > 0)
+    {
+        cached->GetArguments(&args[0], args.size());
+        if (!result->PushArguments(&args[0], args.size()))
+        {
+            result->Release();
+
+            return NULL;
+        }
+    }
+
+    if (!result->EndPushArgument())
+    {
+        result->Release();
+        result = NULL;
+    }
+
+    return result;
+}
+
 /////////////////////////////////////////////////////////////////////////////
 ////
 
@@ -95,11 +274,40 @@ CRpcClient::CRpcClient(int64_t magic,  /* = 0 */
     m_clientId = 0;
     m_magic    = magic;
     m_magic2   = magic2;
+
+    m_retryTokens = RETRY_MAX_TOKENS;
+    m_callLimit   = ADAPTIVE_INITIAL;
+    m_shortRtt    = 0;
+    m_longRtt     = 0;
+    m_credits     = -1;
+    m_wireCalls   = 0;
+    m_errorPacket = NULL;
+    m_cqClosed    = false;
+
+    m_batchBytes      = 0;
+    m_batchTimerId    = 0;
+    m_batchGeneration = 0;
 }
 
 CRpcClient::~CRpcClient()
 {
     Fini();
+
+    int i = 0;
+    int c = (int)m_completionQueue.size();
+
+    for (; i < c; ++i)
+    {
+        m_completionQueue[i]->Release();
+    }
+
+    m_completionQueue.clear();
+
+    if (m_errorPacket != NULL)
+    {
+        m_errorPacket->Release();
+        m_errorPacket = NULL;
+    }
 }
 
 bool
@@ -172,12 +380,32 @@ CRpcClient::Init(IRpcClientObserver* observer,
             goto EXIT;
         }
 
+        /*
+         * the error result of the calls when the memory runs out. it's kept
+         * until the end of the client.
+         */
+        if (m_errorPacket == NULL)
+        {
+            RPC_HDR2 hdr;
+            m_errorPacket = CreateErrorResult_i(0, hdr, RPCE_NOT_ENOUGH_MEMORY);
+            if (m_errorPacket == NULL)
+            {
+                goto EXIT;
+            }
+        }
+
         observer->AddRef();
         m_observer   = observer;
         m_configInfo = configInfo;
         m_packet     = packet;
     }
 
+    {
+        CProThreadMutexGuard mon(m_cqLock);
+
+        m_cqClosed = false;
+    }
+
     return true;
 
 EXIT:
@@ -195,8 +423,9 @@ EXIT:
 void
 CRpcClient::Fini()
 {
-    IRpcClientObserver* observer = NULL;
-    CRpcPacket*         packet   = NULL;
+    IRpcClientObserver*            observer = NULL;
+    CRpcPacket*                    packet   = NULL;
+    CProStlMap<uint64_t, RPC_HDR2> timerId2Hdr;
 
     {
         CProThreadMutexGuard mon(m_lock);
@@ -215,14 +444,64 @@ CRpcClient::Fini()
         }
 
         m_requestId2TimerId.clear();
+        timerId2Hdr = m_timerId2Hdr;
         m_timerId2Hdr.clear();
+        m_wireCalls = 0;
         m_funtionId2Info.clear();
+        m_cacheKey2RequestId.clear();
+        m_leaderId2FollowerId.clear();
+        InvalidateCache_i(0, 0);
+        ClearBatch_i();
         packet = m_packet;
         m_packet = NULL;
         observer = m_observer;
         m_observer = NULL;
     }
 
+    /*
+     * release the contexts of the callbacks, and wake up the waiters of the
+     * futures and of the completion queue
+     */
+    auto itr = timerId2Hdr.begin();
+    auto end = timerId2Hdr.end();
+
+    for (; itr != end; ++itr)
+    {
+        RPC_HDR2& hdr = itr->second;
+        if (hdr.callback == NULL && hdr.future == NULL && !hdr.queued)
+        {
+            if (hdr.request != NULL)
+            {
+                hdr.request->Release();
+            }
+            if (hdr.hit != NULL)
+            {
+                hdr.hit->Release();
+            }
+
+            continue;
+        }
+
+        CRpcPacket* result = MakeErrorResult_i(0, hdr, RPCE_ERROR);
+        assert(result != NULL);
+        if (result != NULL)
+        {
+            DispatchResult(NULL, hdr, result);
+            result->Release();
+        }
+    }
+
+    /*
+     * the queued results are left to the pollers, and the others return
+     */
+    {
+        CProThreadMutexGuard mon(m_cqLock);
+
+        m_cqClosed = true;
+    }
+
+    m_cqCond.Signalall();
+
     packet->Release();
     observer->Release();
 
@@ -299,6 +578,18 @@ CRpcClient::RegisterFunction(uint32_t             functionId,
                              size_t               callArgCount, /* = 0 */
                              const RPC_DATA_TYPE* retnArgTypes, /* = NULL */
                              size_t               retnArgCount) /* = 0 */
+{
+    return RegisterFunction2(
+        functionId, callArgTypes, callArgCount, retnArgTypes, retnArgCount, 0);
+}
+
+RPC_ERROR_CODE
+CRpcClient::RegisterFunction2(uint32_t             functionId,
+                              const RPC_DATA_TYPE* callArgTypes,  /* = NULL */
+                              size_t               callArgCount,  /* = 0 */
+                              const RPC_DATA_TYPE* retnArgTypes,  /* = NULL */
+                              size_t               retnArgCount,  /* = 0 */
+                              uint32_t             functionFlags) /* = 0 */
 {
     assert(functionId > 0);
     if (functionId == 0)
@@ -346,6 +637,7 @@ CRpcClient::RegisterFunction(uint32_t             functionId,
         RPC_FUNCTION_INFO& info = m_funtionId2Info[functionId]; /* insert */
         info.callArgTypes.clear();
         info.retnArgTypes.clear();
+        info.flags = functionFlags;
 
         for (int m = 0; m < (int)callArgCount; ++m)
         {
@@ -378,6 +670,7 @@ CRpcClient::UnregisterFunction(uint32_t functionId)
         }
 
         m_funtionId2Info.erase(functionId);
+        InvalidateCache_i(functionId, 0);
     }
 }
 
@@ -385,615 +678,2492 @@ RPC_ERROR_CODE
 CRpcClient::SendRpcRequest(IRpcPacket*  request,
                            bool         noreply,             /* = false */
                            unsigned int rpcTimeoutInSeconds) /* = 0 */
+{
+    return SendRpcRequest_i(request, noreply, rpcTimeoutInSeconds, NULL, NULL, NULL);
+}
+
+RPC_ERROR_CODE
+CRpcClient::SendRpcRequest(IRpcPacket*         request,
+                           RPC_RESULT_CALLBACK callback,
+                           void*               context,
+                           unsigned int        rpcTimeoutInSeconds) /* = 0 */
+{
+    assert(callback != NULL);
+    if (callback == NULL)
+    {
+        return RPCE_INVALID_ARGUMENT;
+    }
+
+    return SendRpcRequest_i(request, false, rpcTimeoutInSeconds, callback, context, NULL);
+}
+
+IRpcFuture*
+CRpcClient::CallAsync(IRpcPacket*  request,
+                      unsigned int rpcTimeoutInSeconds) /* = 0 */
 {
     assert(request != NULL);
     if (request == NULL)
+    {
+        return NULL;
+    }
+
+    CRpcFuture* future = CRpcFuture::CreateInstance(request->GetRequestId());
+    if (future == NULL)
+    {
+        return NULL;
+    }
+
+    RPC_ERROR_CODE rpcCode = SendRpcRequest_i(
+        request, false, rpcTimeoutInSeconds, NULL, NULL, future);
+    if (rpcCode != RPCE_OK)
+    {
+        RPC_HDR2 hdr;
+        hdr.requestId  = request->GetRequestId();
+        hdr.functionId = request->GetFunctionId();
+        hdr.magic1     = request->GetMagic1();
+        hdr.magic2     = request->GetMagic2();
+        hdr.magicStr   = request->GetMagicStr();
+
+        CRpcPacket* result = CreateErrorResult_i(GetClientId(), hdr, rpcCode);
+        if (result == NULL)
+        {
+            future->Release();
+
+            return NULL;
+        }
+
+        future->Complete(result);
+        result->Release();
+    }
+
+    return future;
+}
+
+RPC_ERROR_CODE
+CRpcClient::CallSync(IRpcPacket*  request,
+                     IRpcPacket** result,
+                     unsigned int rpcTimeoutInSeconds) /* = 0 */
+{
+    assert(request != NULL);
+    assert(result != NULL);
+    if (request == NULL || result == NULL)
     {
         return RPCE_INVALID_ARGUMENT;
     }
 
-    if (rpcTimeoutInSeconds == 0)
+    *result = NULL;
+
+    IRpcFuture* future = CallAsync(request, rpcTimeoutInSeconds);
+    if (future == NULL)
     {
-        rpcTimeoutInSeconds = m_configInfo.rpcc_rpc_timeout;
+        return RPCE_NOT_ENOUGH_MEMORY;
     }
 
-    CRpcPacket* request2 = (CRpcPacket*)request;
-    request2->SetNoreply(noreply);
-    request2->SetTimeout(rpcTimeoutInSeconds);
+    /*
+     * the pending call will be completed by the timer
+     */
+    future->WaitFor((unsigned int)-1);
+
+    IRpcPacket* result2 = future->GetResult();
+    result2->AddRef();
+    future->Release();
+
+    *result = result2;
+
+    return result2->GetRpcCode();
+}
+
+bool
+CRpcClient::CancelRpc(uint64_t requestId)
+{
+    uint64_t timerId = 0;
 
     {
         CProThreadMutexGuard mon(m_lock);
 
         if (m_observer == NULL || m_reactor == NULL || m_packet == NULL)
         {
-            return RPCE_ERROR;
+            return false;
         }
 
-        if (m_msgClient == NULL || m_clientId == 0)
+        auto itr = m_requestId2TimerId.find(requestId);
+        if (itr == m_requestId2TimerId.end())
         {
-            return RPCE_NETWORK_NOT_CONNECTED;
+            return false;
         }
 
-        if (m_timerId2Hdr.size() >= m_configInfo.rpcc_pending_calls)
-        {
-            return RPCE_CLIENT_BUSY;
-        }
+        timerId = itr->second;
 
-        auto itr = m_funtionId2Info.find(request->GetFunctionId());
-        if (itr == m_funtionId2Info.end())
+        auto itr2 = m_timerId2Hdr.find(timerId);
+        if (itr2 == m_timerId2Hdr.end())
         {
-            return RPCE_INVALID_FUNCTION;
+            return false;
         }
 
-        const RPC_FUNCTION_INFO& info = itr->second;
-        if (!CmpRpcPacketTypes(request, info.callArgTypes))
-        {
-            return RPCE_MISMATCHED_PARAMETER;
-        }
+        const RPC_HDR2& hdr = itr2->second;
 
-        if (!m_msgClient->SendMsg(
-            request->GetTotalBuffer(), request->GetTotalSize(), 0, &RPC_ROOT_ID, 1))
+        /*
+         * a call held for the next batch hasn't been sent yet
+         */
+        bool held = false;
+
+        for (int i = 0; i < (int)m_batchRequests.size(); ++i)
         {
-            return RPCE_NETWORK_BUSY;
+            if (m_batchRequests[i]->GetRequestId() == requestId)
+            {
+                m_batchBytes -= m_batchRequests[i]->GetTotalSize();
+                m_batchRequests[i]->Release();
+                m_batchRequests.erase(m_batchRequests.begin() + i);
+                held = true;
+                break;
+            }
         }
 
-        if (!noreply)
+        /*
+         * only a call that has been sent by itself can be canceled at the
+         * server. a leader shares its result with the followers.
+         */
+        if (!held && hdr.hit == NULL && hdr.leaderId == 0 && !hdr.parked &&
+            m_leaderId2FollowerId.find(requestId) == m_leaderId2FollowerId.end() &&
+            m_msgClient != NULL && m_clientId != 0)
         {
-            RPC_HDR2 hdr;
-            hdr.requestId  = request->GetRequestId();
-            hdr.functionId = request->GetFunctionId();
-            hdr.magic1     = request->GetMagic1();
-            hdr.magic2     = request->GetMagic2();
-            hdr.magicStr   = request->GetMagicStr();
+            RPC_CTRL_HDR ctrl;
+            CRpcPacket::MakeRpcCtrl(RPC_CT_CANCEL, hdr.functionId, requestId, ctrl);
 
-            uint64_t timerId = m_reactor->SetupTimer(
-                this, (uint64_t)rpcTimeoutInSeconds * 1000, 0);
-
-            m_timerId2Hdr[timerId]             = hdr;
-            m_requestId2TimerId[hdr.requestId] = timerId;
+            m_msgClient->SendMsg(&ctrl, sizeof(RPC_CTRL_HDR), 0, &RPC_ROOT_ID, 1);
         }
     }
 
-    return RPCE_OK;
+    FailRpc(timerId, RPCE_CANCELED);
+
+    return true;
 }
 
-bool
-CRpcClient::SendMsgToServer(const void* buf,
-                            size_t      size,
-                            uint16_t    charset)
+RPC_ERROR_CODE
+CRpcClient::SendRpcRequest_i(IRpcPacket*         request,
+                             bool                noreply,
+                             unsigned int        rpcTimeoutInSeconds,
+                             RPC_RESULT_CALLBACK callback,
+                             void*               context,
+                             CRpcFuture*         future)
 {
-    assert(buf != NULL);
-    assert(size > 0);
-    if (buf == NULL || size == 0)
+    assert(request != NULL);
+    if (request == NULL)
     {
-        return false;
+        return RPCE_INVALID_ARGUMENT;
     }
 
-    bool ret = false;
+    if (rpcTimeoutInSeconds == 0)
+    {
+        rpcTimeoutInSeconds = m_configInfo.rpcc_rpc_timeout;
+    }
+
+    CRpcPacket* request2 = (CRpcPacket*)request;
+    request2->SetNoreply(noreply);
+    request2->SetTimeout(rpcTimeoutInSeconds);
+
+    bool flush = false;
 
     {
         CProThreadMutexGuard mon(m_lock);
 
         if (m_observer == NULL || m_reactor == NULL || m_packet == NULL)
         {
-            return false;
+            return RPCE_ERROR;
         }
 
         if (m_msgClient == NULL || m_clientId == 0)
         {
-            return false;
+            return RPCE_NETWORK_NOT_CONNECTED;
         }
 
-        ret = m_msgClient->SendMsg(buf, size, charset, &RPC_ROOT_ID, 1);
-    }
-
-    return ret;
-}
+        if (m_timerId2Hdr.size() >= m_configInfo.rpcc_pending_calls)
+        {
+            return RPCE_CLIENT_BUSY;
+        }
 
-bool
+        auto itr = m_funtionId2Info.find(request->GetFunctionId());
+        if (itr == m_funtionId2Info.end())
+        {
+            return RPCE_INVALID_FUNCTION;
+        }
+
+        const RPC_FUNCTION_INFO& info = itr->second;
+        if (!CmpRpcPacketTypes(request, info.callArgTypes))
+        {
+            return RPCE_MISMATCHED_PARAMETER;
+        }
+
+        uint64_t cacheKey = 0;
+
+        if (!noreply && (info.flags & RPC_FF_CACHEABLE) != 0 &&
+            (m_configInfo.rpcc_cache_size > 0 || m_configInfo.rpcc_coalesce))
+        {
+            CProStlVector<RPC_ARGUMENT> args(request->GetArgumentCount());
+            if (args.size() > 0)
+            {
+                request->GetArguments(&args[0], args.size());
+            }
+
+            cacheKey = CalcRpcCacheKey(
+                request->GetFunctionId(), args.size() > 0 ? &args[0] : NULL, args.size());
+
+            /*
+             * the hit is completed by the reactor, never in the caller's stack
+             */
+            CRpcPacket* hit = FindCache_i(cacheKey);
+            if (hit != NULL)
+            {
+                AddPendingCall(request, rpcTimeoutInSeconds,
+                    callback, context, future, cacheKey, hit, 0, true);
+
+                return RPCE_OK;
+            }
+
+            /*
+             * the same call is in flight. wait for its result.
+             */
+            if (m_configInfo.rpcc_coalesce)
+            {
+                auto itr2 = m_cacheKey2RequestId.find(cacheKey);
+                if (itr2 != m_cacheKey2RequestId.end() &&
+                    m_requestId2TimerId.find(itr2->second) != m_requestId2TimerId.end())
+                {
+                    AddPendingCall(request, rpcTimeoutInSeconds,
+                        callback, context, future, cacheKey, NULL, itr2->second, true);
+
+                    return RPCE_OK;
+                }
+            }
+        }
+
+        /*
+         * the hits and the followers above don't reach the server
+         */
+        if (m_wireCalls >= GetCallLimit_i())
+        {
+            return RPCE_CLIENT_BUSY;
+        }
+
+        if (m_configInfo.rpcc_batch_window_us > 0)
+        {
+            /*
+             * held for the next batch. the reactor timers are in
+             * milliseconds, so the window is rounded up.
+             */
+            request->AddRef();
+            m_batchRequests.push_back(request);
+            m_batchBytes += request->GetTotalSize();
+
+            if (m_batchTimerId == 0)
+            {
+                m_batchTimerId = m_reactor->SetupTimer(
+                    this, (m_configInfo.rpcc_batch_window_us + 999) / 1000, 0);
+            }
+
+            flush = m_batchBytes >= m_configInfo.rpcc_batch_max_bytes;
+        }
+        else if (!m_msgClient->SendMsg(
+            request->GetTotalBuffer(), request->GetTotalSize(), 0, &RPC_ROOT_ID, 1))
+        {
+            return RPCE_NETWORK_BUSY;
+        }
+        else
+        {
+        }
+
+        if (!noreply)
+        {
+            AddPendingCall(request, rpcTimeoutInSeconds,
+                callback, context, future, cacheKey, NULL, 0, true);
+
+            if (cacheKey != 0 && m_configInfo.rpcc_coalesce)
+            {
+                m_cacheKey2RequestId[cacheKey] = request->GetRequestId();
+            }
+        }
+    }
+
+    if (flush)
+    {
+        Flush();
+    }
+
+    return RPCE_OK;
+}
+
+void
+CRpcClient::Flush()
+{
+    CProStlVector<IRpcPacket*> requests;
+    uint64_t                   generation = 0;
+
+    {
+        CProThreadMutexGuard mon(m_lock);
+
+        if (m_observer == NULL || m_reactor == NULL || m_packet == NULL)
+        {
+            return;
+        }
+
+        if (m_batchTimerId > 0)
+        {
+            m_reactor->CancelTimer(m_batchTimerId);
+            m_batchTimerId = 0;
+        }
+
+        requests.swap(m_batchRequests);
+        m_batchBytes = 0;
+        generation   = m_batchGeneration;
+    }
+
+    if (requests.size() == 0)
+    {
+        return;
+    }
+
+    /*
+     * the batch is encoded outside the lock. it's encoded again if some
+     * calls complete, retry or park meanwhile, since they aren't sent.
+     * "sending" only shrinks, and "requests" holds the references.
+     */
+    CProStlVector<IRpcPacket*> sending = requests;
+    CProStlVector<uint64_t>    timerIds;
+    CProBuffer                 batch;
+    RPC_ERROR_CODE             rpcCode = RPCE_OK;
+
+    while (1)
+    {
+        if (sending.size() > 1 &&
+            !CRpcPacket::MakeRpcBatch(&sending[0], sending.size(), batch))
+        {
+            rpcCode = RPCE_NOT_ENOUGH_MEMORY;
+        }
+
+        CProThreadMutexGuard mon(m_lock);
+
+        /*
+         * a broken connection has taken care of the calls, and a new one
+         * may have resent them
+         */
+        if (m_observer == NULL || m_reactor == NULL || m_packet == NULL ||
+            m_msgClient == NULL || m_clientId == 0 || generation != m_batchGeneration)
+        {
+            break;
+        }
+
+        CProStlVector<IRpcPacket*> requests2;
+        CProStlVector<uint64_t>    timerIds2;
+
+        int i = 0;
+        int c = (int)sending.size();
+
+        for (; i < c; ++i)
+        {
+            if (sending[i]->GetNoreply())
+            {
+                requests2.push_back(sending[i]);
+                continue;
+            }
+
+            auto itr = m_requestId2TimerId.find(sending[i]->GetRequestId());
+            if (itr == m_requestId2TimerId.end())
+            {
+                continue;
+            }
+
+            const RPC_HDR2& hdr = m_timerId2Hdr[itr->second];
+            if (hdr.attempts == 0 && !hdr.backoff && !hdr.parked)
+            {
+                requests2.push_back(sending[i]);
+                timerIds2.push_back(itr->second);
+            }
+        }
+
+        if (rpcCode == RPCE_OK && requests2.size() > 1 &&
+            requests2.size() != sending.size())
+        {
+            sending.swap(requests2);
+            continue;
+        }
+
+        if (requests2.size() > 0)
+        {
+            const void* buf  = requests2[0]->GetTotalBuffer();
+            size_t      size = requests2[0]->GetTotalSize();
+
+            if (requests2.size() > 1)
+            {
+                buf  = batch.Data();
+                size = batch.Size();
+            }
+            else
+            {
+                rpcCode = RPCE_OK;
+            }
+
+            if (rpcCode == RPCE_OK && !m_msgClient->SendMsg(buf, size, 0, &RPC_ROOT_ID, 1))
+            {
+                rpcCode = RPCE_NETWORK_BUSY;
+            }
+
+            if (rpcCode != RPCE_OK)
+            {
+                timerIds.swap(timerIds2);
+            }
+        }
+
+        break;
+    }
+
+    int i = 0;
+    int c = (int)timerIds.size();
+
+    for (; i < c; ++i)
+    {
+        FailRpc(timerIds[i], rpcCode);
+    }
+
+    int j = 0;
+    int d = (int)requests.size();
+
+    for (; j < d; ++j)
+    {
+        requests[j]->Release();
+    }
+}
+
+RPC_ERROR_CODE
+CRpcClient::SendRpcRequests(IRpcPacket** requests,
+                            size_t       count,
+                            bool         noreply,             /* = false */
+                            unsigned int rpcTimeoutInSeconds) /* = 0 */
+{
+    assert(requests != NULL);
+    assert(count > 0);
+    if (requests == NULL || count == 0)
+    {
+        return RPCE_INVALID_ARGUMENT;
+    }
+
+    for (int i = 0; i < (int)count; ++i)
+    {
+        assert(requests[i] != NULL);
+        if (requests[i] == NULL)
+        {
+            return RPCE_INVALID_ARGUMENT;
+        }
+    }
+
+    if (count == 1)
+    {
+        return SendRpcRequest_i(requests[0], noreply, rpcTimeoutInSeconds, NULL, NULL, NULL);
+    }
+
+    if (rpcTimeoutInSeconds == 0)
+    {
+        rpcTimeoutInSeconds = m_configInfo.rpcc_rpc_timeout;
+    }
+
+    for (int j = 0; j < (int)count; ++j)
+    {
+        CRpcPacket* request = (CRpcPacket*)requests[j];
+        request->SetNoreply(noreply);
+        request->SetTimeout(rpcTimeoutInSeconds);
+    }
+
+    /*
+     * encode the batch outside the lock
+     */
+    CProBuffer batch;
+    if (!CRpcPacket::MakeRpcBatch(requests, count, batch))
+    {
+        return RPCE_NOT_ENOUGH_MEMORY;
+    }
+
+    {
+        CProThreadMutexGuard mon(m_lock);
+
+        if (m_observer == NULL || m_reactor == NULL || m_packet == NULL)
+        {
+            return RPCE_ERROR;
+        }
+
+        if (m_msgClient == NULL || m_clientId == 0)
+        {
+            return RPCE_NETWORK_NOT_CONNECTED;
+        }
+
+        if (!noreply && m_wireCalls + count > GetCallLimit_i())
+        {
+            return RPCE_CLIENT_BUSY;
+        }
+
+        /*
+         * all or nothing
+         */
+        for (int k = 0; k < (int)count; ++k)
+        {
+            auto itr = m_funtionId2Info.find(requests[k]->GetFunctionId());
+            if (itr == m_funtionId2Info.end())
+            {
+                return RPCE_INVALID_FUNCTION;
+            }
+
+            const RPC_FUNCTION_INFO& info = itr->second;
+            if (!CmpRpcPacketTypes(requests[k], info.callArgTypes))
+            {
+                return RPCE_MISMATCHED_PARAMETER;
+            }
+        }
+
+        if (!m_msgClient->SendMsg(batch.Data(), batch.Size(), 0, &RPC_ROOT_ID, 1))
+        {
+            return RPCE_NETWORK_BUSY;
+        }
+
+        if (!noreply)
+        {
+            for (int m = 0; m < (int)count; ++m)
+            {
+                AddPendingCall(
+                    requests[m], rpcTimeoutInSeconds, NULL, NULL, NULL, 0, NULL, 0, true);
+            }
+        }
+    }
+
+    return RPCE_OK;
+}
+
+RPC_ERROR_CODE
+CRpcClient::SendRpcPipeline(IRpcPacket**            requests,
+                            size_t                  count,
+                            const RPC_PIPELINE_REF* refs,                /* = NULL */
+                            size_t                  refCount,            /* = 0 */
+                            unsigned int            rpcTimeoutInSeconds) /* = 0 */
+{
+    assert(requests != NULL);
+    assert(count > 0);
+    if (requests == NULL || count == 0 || count > 65535 || (refs == NULL && refCount > 0))
+    {
+        return RPCE_INVALID_ARGUMENT;
+    }
+
+    for (int i = 0; i < (int)count; ++i)
+    {
+        assert(requests[i] != NULL);
+        if (requests[i] == NULL)
+        {
+            return RPCE_INVALID_ARGUMENT;
+        }
+    }
+
+    /*
+     * a call refers to an earlier one
+     */
+    for (int j = 0; j < (int)refCount; ++j)
+    {
+        const RPC_PIPELINE_REF& ref = refs[j];
+        if (ref.callIndex >= count || ref.resultIndex >= ref.callIndex ||
+            ref.argIndex >= requests[ref.callIndex]->GetArgumentCount())
+        {
+            return RPCE_INVALID_ARGUMENT;
+        }
+    }
+
+    if (rpcTimeoutInSeconds == 0)
+    {
+        rpcTimeoutInSeconds = m_configInfo.rpcc_rpc_timeout;
+    }
+
+    for (int k = 0; k < (int)count; ++k)
+    {
+        CRpcPacket* request = (CRpcPacket*)requests[k];
+        request->SetNoreply(false);
+        request->SetTimeout(rpcTimeoutInSeconds);
+    }
+
+    /*
+     * encode the pipeline outside the lock
+     */
+    CProBuffer pipeline;
+    if (!CRpcPacket::MakeRpcPipeline(requests, count, refs, refCount, pipeline))
+    {
+        return RPCE_NOT_ENOUGH_MEMORY;
+    }
+
+    {
+        CProThreadMutexGuard mon(m_lock);
+
+        if (m_observer == NULL || m_reactor == NULL || m_packet == NULL)
+        {
+            return RPCE_ERROR;
+        }
+
+        if (m_msgClient == NULL || m_clientId == 0)
+        {
+            return RPCE_NETWORK_NOT_CONNECTED;
+        }
+
+        if (m_wireCalls + count > GetCallLimit_i())
+        {
+            return RPCE_CLIENT_BUSY;
+        }
+
+        for (int m = 0; m < (int)count; ++m)
+        {
+            auto itr = m_funtionId2Info.find(requests[m]->GetFunctionId());
+            if (itr == m_funtionId2Info.end())
+            {
+                return RPCE_INVALID_FUNCTION;
+            }
+
+            const RPC_FUNCTION_INFO& info = itr->second;
+            if (!CmpRpcPacketTypes(requests[m], info.callArgTypes))
+            {
+                return RPCE_MISMATCHED_PARAMETER;
+            }
+        }
+
+        if (!m_msgClient->SendMsg(pipeline.Data(), pipeline.Size(), 0, &RPC_ROOT_ID, 1))
+        {
+            return RPCE_NETWORK_BUSY;
+        }
+
+        /*
+         * a call of a pipeline can't be resent by itself
+         */
+        for (int n = 0; n < (int)count; ++n)
+        {
+            AddPendingCall(
+                requests[n], rpcTimeoutInSeconds, NULL, NULL, NULL, 0, NULL, 0, false);
+        }
+    }
+
+    return RPCE_OK;
+}
+
+void
+CRpcClient::AddPendingCall(IRpcPacket*         request,
+                           unsigned int        rpcTimeoutInSeconds,
+                           RPC_RESULT_CALLBACK callback,
+                           void*               context,
+                           CRpcFuture*         future,
+                           uint64_t            cacheKey,   /* = 0 */
+                           CRpcPacket*         hit,        /* = NULL */
+                           uint64_t            leaderId,   /* = 0 */
+                           bool                resendable) /* = true */
+{
+    assert(request != NULL);
+    assert(rpcTimeoutInSeconds > 0);
+
+    RPC_HDR2 hdr;
+    hdr.requestId  = request->GetRequestId();
+    hdr.functionId = request->GetFunctionId();
+    hdr.magic1     = request->GetMagic1();
+    hdr.magic2     = request->GetMagic2();
+    hdr.magicStr   = request->GetMagicStr();
+    hdr.callback   = callback;
+    hdr.context    = context;
+    hdr.future     = future;
+    hdr.queued     = callback == NULL && future == NULL && m_configInfo.rpcc_completion_queue;
+    hdr.deadline   = ProGetTickCount64() + (int64_t)rpcTimeoutInSeconds * 1000;
+    hdr.slice      = (int64_t)rpcTimeoutInSeconds * 1000;
+    hdr.sendTick   = ProGetTickCount64();
+    hdr.cacheKey   = cacheKey;
+    hdr.leaderId   = leaderId;
+
+    if (future != NULL)
+    {
+        future->AddRef();
+    }
+
+    /*
+     * a follower isn't sent. it's completed by its leader or by its own timer.
+     */
+    if (leaderId != 0)
+    {
+        uint64_t timerId = m_reactor->SetupTimer(this, (uint64_t)hdr.slice, 0);
+
+        AddHdr_i(timerId, hdr);
+        m_requestId2TimerId[hdr.requestId] = timerId;
+        m_leaderId2FollowerId.insert(std::make_pair(leaderId, hdr.requestId));
+
+        return;
+    }
+
+    if (hit != NULL)
+    {
+        hit->AddRef();
+        hdr.hit = hit;
+
+        uint64_t timerId = m_reactor->SetupTimer(this, 1, 0);
+
+        AddHdr_i(timerId, hdr);
+        m_requestId2TimerId[hdr.requestId] = timerId;
+
+        return;
+    }
+
+    /*
+     * an idempotent call is split into several attempts within the original
+     * deadline, and the encoded request is kept for the resending
+     */
+    if (resendable &&
+        (m_configInfo.rpcc_retry_max > 0 || m_configInfo.rpcc_replay_on_reconnect))
+    {
+        auto itr = m_funtionId2Info.find(hdr.functionId);
+        if (itr != m_funtionId2Info.end() && (itr->second.flags & RPC_FF_IDEMPOTENT) != 0)
+        {
+            request->AddRef();
+            hdr.request = request;
+            hdr.slice   = hdr.slice / (m_configInfo.rpcc_retry_max + 1);
+            if (hdr.slice < 1)
+            {
+                hdr.slice = 1;
+            }
+
+            m_retryTokens += m_configInfo.rpcc_retry_budget / 100.0;
+            if (m_retryTokens > RETRY_MAX_TOKENS)
+            {
+                m_retryTokens = RETRY_MAX_TOKENS;
+            }
+        }
+    }
+
+    uint64_t timerId = m_reactor->SetupTimer(this, (uint64_t)hdr.slice, 0);
+
+    AddHdr_i(timerId, hdr);
+    m_requestId2TimerId[hdr.requestId] = timerId;
+}
+
+size_t
+CRpcClient::PollResults(IRpcPacket** results,
+                        size_t       maxCount,
+                        unsigned int timeoutInMilliseconds)
+{
+    assert(results != NULL);
+    assert(maxCount > 0);
+    if (results == NULL || maxCount == 0)
+    {
+        return 0;
+    }
+
+    {
+        CProThreadMutexGuard mon(m_lock);
+
+        if (!m_configInfo.rpcc_completion_queue)
+        {
+            return 0;
+        }
+    }
+
+    int64_t deadline = ProGetTickCount64() + timeoutInMilliseconds;
+    size_t  count    = 0;
+
+    m_cqLock.Lock();
+
+    while (m_completionQueue.empty() && !m_cqClosed)
+    {
+        int64_t tick = ProGetTickCount64();
+        if (tick >= deadline)
+        {
+            break;
+        }
+
+        m_cqCond.Waittime(&m_cqLock, (unsigned int)(deadline - tick));
+    }
+
+    while (count < maxCount && !m_completionQueue.empty())
+    {
+        results[count] = m_completionQueue.front();
+        m_completionQueue.pop_front();
+        ++count;
+    }
+
+    bool more = !m_completionQueue.empty();
+
+    m_cqLock.Unlock();
+
+    if (more)
+    {
+        m_cqCond.Signal(); /* wake up the next poller */
+    }
+
+    return count;
+}
+
+void
+CRpcClient::PushResult(CRpcPacket* result)
+{
+    assert(result != NULL);
+
+    {
+        CProThreadMutexGuard mon(m_cqLock);
+
+        result->AddRef();
+        m_completionQueue.push_back(result);
+    }
+
+    m_cqCond.Signal();
+}
+
+bool
+CRpcClient::SendMsgToServer(const void* buf,
+                            size_t      size,
+                            uint16_t    charset)
+{
+    assert(buf != NULL);
+    assert(size > 0);
+    if (buf == NULL || size == 0)
+    {
+        return false;
+    }
+
+    bool ret = false;
+
+    {
+        CProThreadMutexGuard mon(m_lock);
+
+        if (m_observer == NULL || m_reactor == NULL || m_packet == NULL)
+        {
+            return false;
+        }
+
+        if (m_msgClient == NULL || m_clientId == 0)
+        {
+            return false;
+        }
+
+        ret = m_msgClient->SendMsg(buf, size, charset, &RPC_ROOT_ID, 1);
+    }
+
+    return ret;
+}
+
+bool
 CRpcClient::SendMsgToClients(const void*     buf,
                              size_t          size,
                              uint16_t        charset,
                              const uint64_t* dstClients,
                              unsigned char   dstClientCount)
 {
-    assert(buf != NULL);
-    assert(size > 0);
-    assert(dstClients != NULL);
-    assert(dstClientCount > 0);
-    if (buf == NULL || size == 0 || dstClients == NULL || dstClientCount == 0)
+    assert(buf != NULL);
+    assert(size > 0);
+    assert(dstClients != NULL);
+    assert(dstClientCount > 0);
+    if (buf == NULL || size == 0 || dstClients == NULL || dstClientCount == 0)
+    {
+        return false;
+    }
+
+    CProStlVector<RTP_MSG_USER> dstUsers;
+
+    for (int i = 0; i < (int)dstClientCount; ++i)
+    {
+        RTP_MSG_USER user(RPC_CID, dstClients[i], RPC_IID);
+        dstUsers.push_back(user);
+    }
+
+    bool ret = false;
+
+    {
+        CProThreadMutexGuard mon(m_lock);
+
+        if (m_observer == NULL || m_reactor == NULL || m_packet == NULL)
+        {
+            return false;
+        }
+
+        if (m_msgClient == NULL || m_clientId == 0)
+        {
+            return false;
+        }
+
+        ret = m_msgClient->SendMsg(
+            buf, size, charset, &dstUsers[0], (unsigned char)dstUsers.size());
+    }
+
+    return ret;
+}
+
+bool
+CRpcClient::Reconnect()
+{
+    return CMsgClient::Reconnect();
+}
+
+void
+CRpcClient::SetMagic(int64_t magic)
+{
+    CProThreadMutexGuard mon(m_lock);
+
+    m_magic = magic;
+}
+
+int64_t
+CRpcClient::GetMagic() const
+{
+    int64_t magic = 0;
+
+    {
+        CProThreadMutexGuard mon(m_lock);
+
+        magic = m_magic;
+    }
+
+    return magic;
+}
+
+void
+CRpcClient::SetMagic2(int64_t magic2)
+{
+    CProThreadMutexGuard mon(m_lock);
+
+    m_magic2 = magic2;
+}
+
+int64_t
+CRpcClient::GetMagic2() const
+{
+    int64_t magic2 = 0;
+
+    {
+        CProThreadMutexGuard mon(m_lock);
+
+        magic2 = m_magic2;
+    }
+
+    return magic2;
+}
+
+size_t
+CRpcClient::GetPendingCalls() const
+{
+    size_t count = 0;
+
+    {
+        CProThreadMutexGuard mon(m_lock);
+
+        count = m_wireCalls;
+    }
+
+    return count;
+}
+
+size_t
+CRpcClient::GetCallLimit() const
+{
+    size_t limit = 0;
+
+    {
+        CProThreadMutexGuard mon(m_lock);
+
+        limit = GetCallLimit_i();
+    }
+
+    return limit;
+}
+
+uint32_t
+CRpcClient::GetFunctionFlags(uint32_t functionId) const
+{
+    uint32_t flags = 0;
+
+    {
+        CProThreadMutexGuard mon(m_lock);
+
+        auto itr = m_funtionId2Info.find(functionId);
+        if (itr != m_funtionId2Info.end())
+        {
+            flags = itr->second.flags;
+        }
+    }
+
+    return flags;
+}
+
+void
+CRpcClient::OnOkMsg(IRtpMsgClient*      msgClient,
+                    const RTP_MSG_USER* myUser,
+                    const char*         myPublicIp)
+{
+    assert(msgClient != NULL);
+    assert(myUser != NULL);
+    assert(myPublicIp != NULL);
+    assert(myPublicIp[0] != '\0');
+    if (msgClient == NULL || myUser == NULL || myPublicIp == NULL || myPublicIp[0] == '\0')
+    {
+        return;
+    }
+
+    uint64_t clientId = myUser->UserId();
+
+    IRpcClientObserver* observer = NULL;
+
+    {
+        CProThreadMutexGuard mon(m_lock);
+
+        if (m_observer == NULL || m_reactor == NULL || m_packet == NULL || m_msgClient == NULL)
+        {
+            return;
+        }
+
+        if (msgClient != m_msgClient)
+        {
+            return;
+        }
+
+        m_clientId = clientId;
+        m_credits  = -1;
+
+        /*
+         * replay the calls kept over the reconnection
+         */
+        CProStlVector<uint64_t> timerIds;
+
+        auto itr = m_timerId2Hdr.begin();
+        auto end = m_timerId2Hdr.end();
+
+        for (; itr != end; ++itr)
+        {
+            if (itr->second.parked)
+            {
+                timerIds.push_back(itr->first);
+            }
+        }
+
+        for (int i = 0; i < (int)timerIds.size(); ++i)
+        {
+            ResendRpc_i(timerIds[i]);
+        }
+
+        m_observer->AddRef();
+        observer = m_observer;
+    }
+
+    if (0)
+    {{{
+        char suiteName[64] = "";
+        msgClient->GetSslSuite(suiteName);
+
+        CProStlString timeString;
+        ProGetLocalTimeString(timeString);
+
+        printf(
+            "\n"
+            "%s \n"
+            " CRpcClient::OnOkMsg(id : %llu, publicIp : %s,"
+            " sslSuite : %s, server : %s:%u, mmType : %u) \n"
+            ,
+            timeString.c_str(),
+            (unsigned long long)clientId,
+            myPublicIp,
+            suiteName,
+            m_msgConfigInfo.msgc_server_ip.c_str(),
+            (unsigned int)m_msgConfigInfo.msgc_server_port,
+            (unsigned int)m_msgConfigInfo.msgc_mm_type
+            );
+    }}}
+
+    observer->OnLogon(this, clientId, myPublicIp);
+    observer->Release();
+}
+
+void
+CRpcClient::OnRecvMsg(IRtpMsgClient*      msgClient,
+                      const void*         buf,
+                      size_t              size,
+                      uint16_t            charset,
+                      const RTP_MSG_USER* srcUser)
+{
+    assert(msgClient != NULL);
+    assert(buf != NULL);
+    assert(size > 0);
+    assert(srcUser != NULL);
+    if (msgClient == NULL || buf == NULL || size == 0 || srcUser == NULL)
+    {
+        return;
+    }
+
+    if (srcUser->classId != RPC_ROOT_ID.classId || srcUser->UserId() != RPC_ROOT_ID.UserId())
+    {
+        RecvMsg(msgClient, buf, size, charset, srcUser->UserId());
+
+        return;
+    }
+
+    RPC_HDR                       hdr;
+    CProStlVector<RPC_ARGUMENT>   args;
+    CProStlVector<RPC_BATCH_ITEM> items;
+    RPC_CTRL_HDR                  ctrl;
+
+    if (CRpcPacket::ParseRpcPacket(buf, size, hdr, args))
+    {
+        RecvRpc(msgClient, hdr, args);
+    }
+    else if (CRpcPacket::ParseRpcBatch(buf, size, items))
+    {
+        int i = 0;
+        int c = (int)items.size();
+
+        for (; i < c; ++i)
+        {
+            if (CRpcPacket::ParseRpcPacket(items[i].buffer, items[i].size, hdr, args))
+            {
+                RecvRpc(msgClient, hdr, args);
+            }
+        }
+    }
+    else if (CRpcPacket::ParseRpcCtrl(buf, size, ctrl))
+    {
+        RecvCtrl(msgClient, ctrl);
+    }
+    else
+    {
+        RecvMsg(msgClient, buf, size, charset, 0);
+    }
+}
+
+void
+CRpcClient::RecvRpc(IRtpMsgClient*                     msgClient,
+                    RPC_HDR                            hdr,
+                    const CProStlVector<RPC_ARGUMENT>& args)
+{
+    assert(msgClient != NULL);
+
+    if (hdr.requestId == 0 || hdr.functionId == 0)
+    {
+        return;
+    }
+
+    IRpcClientObserver*     observer = NULL;
+    CRpcPacket*             result   = NULL;
+    RPC_HDR2                hdr2;
+    CProStlVector<uint64_t> followerIds;
+
+    {
+        CProThreadMutexGuard mon(m_lock);
+
+        if (m_observer == NULL || m_reactor == NULL || m_packet == NULL || m_msgClient == NULL)
+        {
+            return;
+        }
+
+        if (msgClient != m_msgClient)
+        {
+            return;
+        }
+
+        /*
+         * the reserved bytes of the old servers may be garbage
+         */
+        int credits = m_configInfo.rpcc_credits ? GetRpcCredits(hdr) : -1;
+        if (credits >= 0)
+        {
+            m_credits = credits;
+        }
+
+        {
+            auto itr = m_funtionId2Info.find(hdr.functionId);
+            if (itr == m_funtionId2Info.end())
+            {
+                return;
+            }
+
+            const RPC_FUNCTION_INFO& info = itr->second;
+            if (!CmpRpcArgsTypes(args, info.retnArgTypes))
+            {
+                return;
+            }
+        }
+
+        auto itr = m_requestId2TimerId.find(hdr.requestId);
+        if (itr == m_requestId2TimerId.end())
+        {
+            return;
+        }
+
+        if (hdr.rpcCode == RPCE_OK)
+        {
+            UpdateLimit_i(ProGetTickCount64() - m_timerId2Hdr[itr->second].sendTick, false);
+        }
+        else if (hdr.rpcCode == RPCE_SERVER_BUSY)
+        {
+            UpdateLimit_i(0, true);
+        }
+        else
+        {
+        }
+
+        if (hdr.rpcCode == RPCE_SERVER_BUSY && RetryRpc_i(itr->second, hdr.rpcCode))
+        {
+            return;
+        }
+
+        hdr2 = m_timerId2Hdr[itr->second];
+
+        m_reactor->CancelTimer(itr->second);
+        EraseHdr_i(itr->second);
+        m_requestId2TimerId.erase(itr);
+
+        TakeFollowers_i(hdr2, followerIds);
+
+        if (hdr.rpcCode == RPCE_OK)
+        {
+            result = CRpcPacket::CreateInstance(
+                hdr.requestId,
+                hdr.functionId,
+                true /* this is a rebuilt packet */
+                );
+            if (result == NULL)
+            {
+                hdr.rpcCode = RPCE_NOT_ENOUGH_MEMORY;
+            }
+        }
+
+        if (result != NULL)
+        {
+            assert(hdr.rpcCode == RPCE_OK);
+
+            result->SetClientId(m_clientId);
+            result->SetRpcCode(hdr.rpcCode);
+            result->SetMagic1(hdr2.magic1);
+            result->SetMagic2(hdr2.magic2);
+            result->SetMagicStr(hdr2.magicStr.c_str());
+
+            if (args.size() > 0)
+            {
+                result->CleanAndBeginPushArgument();
+                if (!result->PushArguments(&args[0], args.size()) || !result->EndPushArgument())
+                {
+                    hdr.rpcCode = RPCE_NOT_ENOUGH_MEMORY;
+                    result->Release();
+                    result = NULL;
+                }
+            }
+            else
+            {
+                result->CleanAndBeginPushArgument();
+                if (!result->EndPushArgument())
+                {
+                    hdr.rpcCode = RPCE_NOT_ENOUGH_MEMORY;
+                    result->Release();
+                    result = NULL;
+                }
+            }
+        }
+
+        if (result != NULL && hdr2.cacheKey != 0)
+        {
+            AddCache_i(hdr2.cacheKey, hdr2.functionId, result);
+        }
+
+        if (result == NULL && (hdr2.callback != NULL || hdr2.future != NULL || hdr2.queued))
+        {
+            result = MakeErrorResult_i(m_clientId, hdr2, hdr.rpcCode);
+        }
+
+        /*
+         * the observer's result is valid only during the callback. the other
+         * calls keep their results, and have their own error results.
+         */
+        if (result == NULL)
+        {
+            assert(hdr.rpcCode != RPCE_OK);
+            assert(hdr2.callback == NULL && hdr2.future == NULL && !hdr2.queued);
+
+            m_packet->AddRef();
+            result = m_packet;
+
+            result->SetClientId(m_clientId);
+            result->SetRequestId(hdr.requestId);
+            result->SetFunctionId(hdr.functionId);
+            result->SetRpcCode(hdr.rpcCode);
+            result->SetMagic1(hdr2.magic1);
+            result->SetMagic2(hdr2.magic2);
+            result->SetMagicStr(hdr2.magicStr.c_str());
+        }
+
+        if (hdr2.callback == NULL && hdr2.future == NULL && !hdr2.queued && !hdr2.dropped)
+        {
+            m_observer->AddRef();
+            observer = m_observer;
+        }
+    }
+
+    DispatchResult(observer, hdr2, result);
+    if (observer != NULL)
+    {
+        observer->Release();
+    }
+
+    for (int i = 0; i < (int)followerIds.size(); ++i)
+    {
+        CompleteFollower(followerIds[i], hdr.rpcCode == RPCE_OK ? result : NULL, hdr.rpcCode);
+    }
+
+    result->Release();
+}
+
+void
+CRpcClient::DispatchResult(IRpcClientObserver* observer, /* = NULL */
+                           const RPC_HDR2&     hdr,
+                           CRpcPacket*         result)
+{
+    assert(result != NULL);
+
+    if (hdr.callback != NULL)
+    {
+        hdr.callback(this, result, hdr.context);
+    }
+    else if (hdr.future != NULL)
+    {
+        hdr.future->Complete(result);
+        hdr.future->Release();
+    }
+    else if (hdr.queued)
+    {
+        PushResult(result);
+    }
+    else if (observer != NULL)
+    {
+        observer->OnRpcResult(this, result);
+    }
+    else
+    {
+    }
+
+    if (hdr.request != NULL)
+    {
+        hdr.request->Release();
+    }
+    if (hdr.hit != NULL)
+    {
+        hdr.hit->Release();
+    }
+}
+
+void
+CRpcClient::RecvCtrl(IRtpMsgClient*      msgClient,
+                     const RPC_CTRL_HDR& ctrl)
+{
+    assert(msgClient != NULL);
+
+    {
+        CProThreadMutexGuard mon(m_lock);
+
+        if (m_observer == NULL || m_reactor == NULL || m_packet == NULL || m_msgClient == NULL)
+        {
+            return;
+        }
+
+        if (msgClient != m_msgClient)
+        {
+            return;
+        }
+
+        if (ctrl.ctrlType == RPC_CT_INVALIDATE)
+        {
+            InvalidateCache_i(ctrl.functionId, ctrl.param);
+        }
+    }
+}
+
+void
+CRpcClient::RecvMsg(IRtpMsgClient* msgClient,
+                    const void*    buf,
+                    size_t         size,
+                    uint16_t       charset,
+                    uint64_t       srcClientId)
+{
+    assert(msgClient != NULL);
+    assert(buf != NULL);
+    assert(size > 0);
+
+    IRpcClientObserver* observer = NULL;
+
+    {
+        CProThreadMutexGuard mon(m_lock);
+
+        if (m_observer == NULL || m_reactor == NULL || m_packet == NULL || m_msgClient == NULL)
+        {
+            return;
+        }
+
+        if (msgClient != m_msgClient)
+        {
+            return;
+        }
+
+        m_observer->AddRef();
+        observer = m_observer;
+    }
+
+    if (srcClientId == 0)
+    {
+        observer->OnRecvMsgFromServer(this, buf, size, charset);
+    }
+    else
+    {
+        observer->OnRecvMsgFromClient(this, buf, size, charset, srcClientId);
+    }
+
+    observer->Release();
+}
+
+void
+CRpcClient::OnCloseMsg(IRtpMsgClient* msgClient,
+                       int            errorCode,
+                       int            sslCode,
+                       bool           tcpConnected)
+{
+    assert(msgClient != NULL);
+    if (msgClient == NULL)
+    {
+        return;
+    }
+
+    IRpcClientObserver*            observer = NULL;
+    CRpcPacket*                    result   = NULL;
+    uint64_t                       clientId = 0;
+    CProStlMap<uint64_t, RPC_HDR2> timerId2Hdr;
+
+    {
+        CProThreadMutexGuard mon(m_lock);
+
+        if (m_observer == NULL || m_reactor == NULL || m_packet == NULL || m_msgClient == NULL)
+        {
+            return;
+        }
+
+        if (msgClient != m_msgClient)
+        {
+            return;
+        }
+
+        clientId = m_clientId;
+        m_clientId = 0;
+        m_credits  = -1;
+        ClearBatch_i();
+        ++m_batchGeneration; /* the batch being flushed is dropped */
+
+        /*
+         * the cache hits and the retryable calls are kept, and the others are
+         * completed with RPCE_NETWORK_BROKEN
+         */
+        CProStlVector<uint64_t> timerIds;
+
+        auto itr = m_timerId2Hdr.begin();
+        auto end = m_timerId2Hdr.end();
+
+        for (; itr != end; ++itr)
+        {
+            timerIds.push_back(itr->first);
+        }
+
+        for (int i = 0; i < (int)timerIds.size(); ++i)
+        {
+            if (m_timerId2Hdr[timerIds[i]].hit != NULL ||
+                m_timerId2Hdr[timerIds[i]].leaderId != 0)
+            {
+                continue;
+            }
+
+            if (m_configInfo.rpcc_replay_on_reconnect)
+            {
+                if (ParkRpc_i(timerIds[i]))
+                {
+                    continue;
+                }
+            }
+            else if (RetryRpc_i(timerIds[i], RPCE_NETWORK_BROKEN))
+            {
+                continue;
+            }
+
+            RPC_HDR2& hdr = m_timerId2Hdr[timerIds[i]];
+            m_requestId2TimerId.erase(hdr.requestId);
+            timerId2Hdr[timerIds[i]] = hdr;
+            EraseHdr_i(timerIds[i]);
+
+            CProStlVector<uint64_t> followerIds;
+            TakeFollowers_i(timerId2Hdr[timerIds[i]], followerIds);
+        }
+
+        /*
+         * the followers of the kept calls are kept
+         */
+        for (int j = 0; j < (int)timerIds.size(); ++j)
+        {
+            auto itr2 = m_timerId2Hdr.find(timerIds[j]);
+            if (itr2 == m_timerId2Hdr.end() || itr2->second.leaderId == 0)
+            {
+                continue;
+            }
+
+            const RPC_HDR2& hdr = itr2->second;
+            if (m_requestId2TimerId.find(hdr.leaderId) != m_requestId2TimerId.end())
+            {
+                continue;
+            }
+
+            m_requestId2TimerId.erase(hdr.requestId);
+            timerId2Hdr[timerIds[j]] = hdr;
+            EraseHdr_i(timerIds[j]);
+        }
+
+        m_observer->AddRef();
+        m_packet->AddRef();
+        observer = m_observer;
+        result   = m_packet;
+    }
+
+    if (0)
+    {{{
+        CProStlString timeString;
+        ProGetLocalTimeString(timeString);
+
+        printf(
+            "\n"
+            "%s \n"
+            " CRpcClient::OnCloseMsg(id : %llu,"
+            " errorCode : [%d, %d], tcpConnected : %d, server : %s:%u, mmType : %u) \n"
+            ,
+            timeString.c_str(),
+            (unsigned long long)clientId,
+            errorCode,
+            sslCode,
+            (int)tcpConnected,
+            m_msgConfigInfo.msgc_server_ip.c_str(),
+            (unsigned int)m_msgConfigInfo.msgc_server_port,
+            (unsigned int)m_msgConfigInfo.msgc_mm_type
+            );
+    }}}
+
+    auto itr = timerId2Hdr.begin();
+    auto end = timerId2Hdr.end();
+
+    for (; itr != end; ++itr)
+    {
+        RPC_HDR2& hdr = itr->second;
+
+        CRpcPacket* result2 = NULL;
+        if (hdr.callback != NULL || hdr.future != NULL || hdr.queued)
+        {
+            result2 = MakeErrorResult_i(clientId, hdr, RPCE_NETWORK_BROKEN);
+        }
+
+        if (result2 != NULL)
+        {
+            DispatchResult(observer, hdr, result2);
+            result2->Release();
+
+            continue;
+        }
+
+        assert(hdr.callback == NULL && hdr.future == NULL && !hdr.queued);
+
+        result->SetClientId(clientId);
+        result->SetRequestId(hdr.requestId);
+        result->SetFunctionId(hdr.functionId);
+        result->SetRpcCode(RPCE_NETWORK_BROKEN);
+        result->SetMagic1(hdr.magic1);
+        result->SetMagic2(hdr.magic2);
+        result->SetMagicStr(hdr.magicStr.c_str());
+
+        DispatchResult(hdr.dropped ? NULL : observer, hdr, result);
+    }
+
+    observer->OnLogoff(this, errorCode, sslCode, tcpConnected);
+    observer->Release();
+    result->Release();
+}
+
+void
+CRpcClient::OnTimer(void*    factory,
+                    uint64_t timerId,
+                    int64_t  tick,
+                    int64_t  userData)
+{
+    assert(factory != NULL);
+    assert(timerId > 0);
+    if (factory == NULL || timerId == 0)
     {
-        return false;
+        return;
+    }
+
+    IRpcClientObserver* observer = NULL;
+    CRpcPacket*         result   = NULL;
+    RPC_ERROR_CODE      rpcCode  = RPCE_NETWORK_TIMEOUT;
+    bool                flush    = false;
+    RPC_HDR2            hdr;
+
+    {
+        CProThreadMutexGuard mon(m_lock);
+
+        if (m_observer == NULL || m_reactor == NULL || m_packet == NULL)
+        {
+            return;
+        }
+
+        /*
+         * the batch window
+         */
+        flush = timerId == m_batchTimerId;
+    }
+
+    if (flush)
+    {
+        Flush();
+
+        return;
+    }
+
+    {
+        CProThreadMutexGuard mon(m_lock);
+
+        if (m_observer == NULL || m_reactor == NULL || m_packet == NULL)
+        {
+            return;
+        }
+
+        auto itr = m_timerId2Hdr.find(timerId);
+        if (itr == m_timerId2Hdr.end())
+        {
+            return;
+        }
+
+        /*
+         * a cache hit
+         */
+        if (itr->second.hit != NULL)
+        {
+            hdr    = itr->second;
+            result = CloneResult_i(m_clientId, hdr, hdr.hit);
+            if (result == NULL)
+            {
+                rpcCode = RPCE_NOT_ENOUGH_MEMORY;
+            }
+            else
+            {
+                m_reactor->CancelTimer(timerId);
+                m_requestId2TimerId.erase(hdr.requestId);
+                EraseHdr_i(timerId);
+
+                if (hdr.callback == NULL && hdr.future == NULL && !hdr.queued)
+                {
+                    m_observer->AddRef();
+                    observer = m_observer;
+                }
+            }
+        }
+        /*
+         * the backoff is over
+         */
+        else if (itr->second.backoff)
+        {
+            if (ResendRpc_i(timerId))
+            {
+                return;
+            }
+
+            if (m_clientId == 0 && (m_configInfo.rpcc_replay_on_reconnect ||
+                itr->second.rpcCode == RPCE_NETWORK_BROKEN) && ParkRpc_i(timerId))
+            {
+                return;
+            }
+
+            rpcCode = itr->second.rpcCode;
+        }
+    }
+
+    if (result == NULL)
+    {
+        FailRpc(timerId, rpcCode);
+
+        return;
+    }
+
+    DispatchResult(observer, hdr, result);
+    if (observer != NULL)
+    {
+        observer->Release();
+    }
+    result->Release();
+}
+
+void
+CRpcClient::FailRpc(uint64_t       timerId,
+                    RPC_ERROR_CODE rpcCode)
+{
+    IRpcClientObserver*     observer = NULL;
+    CRpcPacket*             result   = NULL;
+    uint64_t                clientId = 0;
+    RPC_HDR2                hdr;
+    CProStlVector<uint64_t> followerIds;
+
+    {
+        CProThreadMutexGuard mon(m_lock);
+
+        if (m_observer == NULL || m_reactor == NULL || m_packet == NULL)
+        {
+            return;
+        }
+
+        auto itr = m_timerId2Hdr.find(timerId);
+        if (itr == m_timerId2Hdr.end())
+        {
+            return;
+        }
+
+        if (itr->second.dropped && rpcCode == RPCE_CANCELED)
+        {
+            return;
+        }
+
+        if (rpcCode == RPCE_NETWORK_TIMEOUT && !itr->second.backoff &&
+            itr->second.hit == NULL && itr->second.leaderId == 0)
+        {
+            UpdateLimit_i(0, true);
+        }
+
+        if (RetryRpc_i(timerId, rpcCode))
+        {
+            return;
+        }
+
+        if (rpcCode == RPCE_NETWORK_TIMEOUT && WaitRpc_i(timerId))
+        {
+            return;
+        }
+
+        hdr = itr->second;
+
+        /*
+         * the caller of a shared call is gone. the call goes on for the
+         * followers.
+         */
+        if (rpcCode == RPCE_CANCELED &&
+            m_leaderId2FollowerId.find(hdr.requestId) != m_leaderId2FollowerId.end())
+        {
+            itr->second.callback = NULL;
+            itr->second.context  = NULL;
+            itr->second.future   = NULL;
+            itr->second.queued   = false;
+            itr->second.dropped  = true;
+            hdr.request          = NULL; /* still owned by the call */
+        }
+        else
+        {
+            m_reactor->CancelTimer(timerId);
+            m_requestId2TimerId.erase(hdr.requestId);
+            EraseHdr_i(timerId);
+
+            TakeFollowers_i(hdr, followerIds);
+        }
+
+        if (hdr.callback == NULL && hdr.future == NULL && !hdr.queued && !hdr.dropped)
+        {
+            m_observer->AddRef();
+            observer = m_observer;
+        }
+
+        m_packet->AddRef();
+        result   = m_packet;
+        clientId = m_clientId;
+    }
+
+    CRpcPacket* result2 = NULL;
+    if (hdr.callback != NULL || hdr.future != NULL || hdr.queued)
+    {
+        result2 = MakeErrorResult_i(clientId, hdr, rpcCode);
+    }
+
+    if (result2 != NULL)
+    {
+        result->Release();
+        result = result2;
+    }
+    else
+    {
+        assert(hdr.callback == NULL && hdr.future == NULL && !hdr.queued);
+
+        result->SetClientId(clientId);
+        result->SetRequestId(hdr.requestId);
+        result->SetFunctionId(hdr.functionId);
+        result->SetRpcCode(rpcCode);
+        result->SetMagic1(hdr.magic1);
+        result->SetMagic2(hdr.magic2);
+        result->SetMagicStr(hdr.magicStr.c_str());
     }
 
-    CProStlVector<RTP_MSG_USER> dstUsers;
+    DispatchResult(observer, hdr, result);
+    if (observer != NULL)
+    {
+        observer->Release();
+    }
+    result->Release();
 
-    for (int i = 0; i < (int)dstClientCount; ++i)
+    for (int i = 0; i < (int)followerIds.size(); ++i)
     {
-        RTP_MSG_USER user(RPC_CID, dstClients[i], RPC_IID);
-        dstUsers.push_back(user);
+        CompleteFollower(followerIds[i], NULL, rpcCode);
     }
+}
 
-    bool ret = false;
+void
+CRpcClient::FailCalls(RPC_ERROR_CODE rpcCode)
+{
+    IRpcClientObserver*            observer = NULL;
+    CRpcPacket*                    packet   = NULL;
+    uint64_t                       clientId = 0;
+    CProStlMap<uint64_t, RPC_HDR2> timerId2Hdr;
 
     {
         CProThreadMutexGuard mon(m_lock);
 
         if (m_observer == NULL || m_reactor == NULL || m_packet == NULL)
         {
-            return false;
+            return;
         }
 
-        if (m_msgClient == NULL || m_clientId == 0)
+        auto itr = m_timerId2Hdr.begin();
+        auto end = m_timerId2Hdr.end();
+
+        for (; itr != end; ++itr)
         {
-            return false;
+            m_reactor->CancelTimer(itr->first);
         }
 
-        ret = m_msgClient->SendMsg(
-            buf, size, charset, &dstUsers[0], (unsigned char)dstUsers.size());
+        m_requestId2TimerId.clear();
+        timerId2Hdr.swap(m_timerId2Hdr);
+        m_wireCalls = 0;
+        m_cacheKey2RequestId.clear();
+        m_leaderId2FollowerId.clear();
+        ClearBatch_i();
+
+        m_observer->AddRef();
+        m_packet->AddRef();
+        observer = m_observer;
+        packet   = m_packet;
+        clientId = m_clientId;
     }
 
-    return ret;
+    auto itr = timerId2Hdr.begin();
+    auto end = timerId2Hdr.end();
+
+    for (; itr != end; ++itr)
+    {
+        RPC_HDR2& hdr = itr->second;
+
+        CRpcPacket* result = NULL;
+        if (hdr.callback != NULL || hdr.future != NULL || hdr.queued)
+        {
+            result = MakeErrorResult_i(clientId, hdr, rpcCode);
+        }
+
+        if (result != NULL)
+        {
+            DispatchResult(observer, hdr, result);
+            result->Release();
+
+            continue;
+        }
+
+        assert(hdr.callback == NULL && hdr.future == NULL && !hdr.queued);
+
+        packet->SetClientId(clientId);
+        packet->SetRequestId(hdr.requestId);
+        packet->SetFunctionId(hdr.functionId);
+        packet->SetRpcCode(rpcCode);
+        packet->SetMagic1(hdr.magic1);
+        packet->SetMagic2(hdr.magic2);
+        packet->SetMagicStr(hdr.magicStr.c_str());
+
+        DispatchResult(hdr.dropped ? NULL : observer, hdr, packet);
+    }
+
+    observer->Release();
+    packet->Release();
 }
 
 bool
-CRpcClient::Reconnect()
+CRpcClient::RetryRpc_i(uint64_t       timerId,
+                       RPC_ERROR_CODE rpcCode)
 {
-    return CMsgClient::Reconnect();
-}
+    if (rpcCode != RPCE_NETWORK_BROKEN && rpcCode != RPCE_SERVER_BUSY &&
+        rpcCode != RPCE_NETWORK_TIMEOUT)
+    {
+        return false;
+    }
 
-void
-CRpcClient::SetMagic(int64_t magic)
-{
-    CProThreadMutexGuard mon(m_lock);
+    auto itr = m_timerId2Hdr.find(timerId);
+    if (itr == m_timerId2Hdr.end())
+    {
+        return false;
+    }
 
-    m_magic = magic;
-}
+    /*
+     * the retries of a broken connection don't spend the budget. they wait
+     * for the logon after the backoff.
+     */
+    bool broken = rpcCode == RPCE_NETWORK_BROKEN && m_clientId == 0;
 
-int64_t
-CRpcClient::GetMagic() const
-{
-    int64_t magic = 0;
+    RPC_HDR2 hdr = itr->second;
+    if (hdr.request == NULL || hdr.attempts >= m_configInfo.rpcc_retry_max ||
+        (!broken && m_retryTokens < 1))
+    {
+        return false;
+    }
 
+    /*
+     * exponential backoff with jitter, 50% ~ 150%
+     */
+    int64_t backoff = (int64_t)m_configInfo.rpcc_retry_backoff << hdr.attempts;
+    backoff = (int64_t)(backoff * (0.5 + ProRand_0_1()));
+    if (backoff < 1)
     {
-        CProThreadMutexGuard mon(m_lock);
+        backoff = 1;
+    }
 
-        magic = m_magic;
+    if (ProGetTickCount64() + backoff >= hdr.deadline)
+    {
+        return false;
     }
 
-    return magic;
+    if (!broken)
+    {
+        m_retryTokens -= 1;
+    }
+
+    hdr.rpcCode = rpcCode;
+    hdr.backoff = true;
+    ++hdr.attempts;
+
+    m_reactor->CancelTimer(timerId);
+    EraseHdr_i(timerId);
+
+    uint64_t timerId2 = m_reactor->SetupTimer(this, (uint64_t)backoff, 0);
+
+    AddHdr_i(timerId2, hdr);
+    m_requestId2TimerId[hdr.requestId] = timerId2;
+
+    return true;
 }
 
-void
-CRpcClient::SetMagic2(int64_t magic2)
+bool
+CRpcClient::ResendRpc_i(uint64_t timerId)
 {
-    CProThreadMutexGuard mon(m_lock);
+    auto itr = m_timerId2Hdr.find(timerId);
+    if (itr == m_timerId2Hdr.end())
+    {
+        return false;
+    }
 
-    m_magic2 = magic2;
+    RPC_HDR2 hdr = itr->second;
+    assert(hdr.request != NULL);
+    assert(hdr.backoff);
+
+    if (m_msgClient == NULL || m_clientId == 0)
+    {
+        return false;
+    }
+
+    int64_t timeout = hdr.deadline - ProGetTickCount64();
+    if (timeout <= 0)
+    {
+        return false;
+    }
+
+    /*
+     * the request has been encoded
+     */
+    if (!m_msgClient->SendMsg(
+        hdr.request->GetTotalBuffer(), hdr.request->GetTotalSize(), 0, &RPC_ROOT_ID, 1))
+    {
+        return false;
+    }
+
+    if (timeout > hdr.slice)
+    {
+        timeout = hdr.slice;
+    }
+
+    hdr.backoff  = false;
+    hdr.parked   = false;
+    hdr.sendTick = ProGetTickCount64();
+
+    m_reactor->CancelTimer(timerId);
+    EraseHdr_i(timerId);
+
+    uint64_t timerId2 = m_reactor->SetupTimer(this, (uint64_t)timeout, 0);
+
+    AddHdr_i(timerId2, hdr);
+    m_requestId2TimerId[hdr.requestId] = timerId2;
+
+    return true;
 }
 
-int64_t
-CRpcClient::GetMagic2() const
+bool
+CRpcClient::ParkRpc_i(uint64_t timerId)
 {
-    int64_t magic2 = 0;
+    auto itr = m_timerId2Hdr.find(timerId);
+    if (itr == m_timerId2Hdr.end())
+    {
+        return false;
+    }
 
+    RPC_HDR2 hdr = itr->second;
+    if (hdr.request == NULL)
     {
-        CProThreadMutexGuard mon(m_lock);
+        return false;
+    }
 
-        magic2 = m_magic2;
+    int64_t timeout = hdr.deadline - ProGetTickCount64();
+    if (timeout <= 0)
+    {
+        return false;
     }
 
-    return magic2;
+    hdr.rpcCode = RPCE_NETWORK_BROKEN;
+    hdr.backoff = true;
+    hdr.parked  = true;
+
+    /*
+     * the timer is the original deadline
+     */
+    m_reactor->CancelTimer(timerId);
+    EraseHdr_i(timerId);
+
+    uint64_t timerId2 = m_reactor->SetupTimer(this, (uint64_t)timeout, 0);
+
+    AddHdr_i(timerId2, hdr);
+    m_requestId2TimerId[hdr.requestId] = timerId2;
+
+    return true;
 }
 
-void
-CRpcClient::OnOkMsg(IRtpMsgClient*      msgClient,
-                    const RTP_MSG_USER* myUser,
-                    const char*         myPublicIp)
+/*
+ * an attempt timed out, and no retry was taken (e.g., out of the budget). the
+ * attempt in flight may still be answered, so the call waits for it until the
+ * original deadline.
+ */
+bool
+CRpcClient::WaitRpc_i(uint64_t timerId)
 {
-    assert(msgClient != NULL);
-    assert(myUser != NULL);
-    assert(myPublicIp != NULL);
-    assert(myPublicIp[0] != '\0');
-    if (msgClient == NULL || myUser == NULL || myPublicIp == NULL || myPublicIp[0] == '\0')
+    auto itr = m_timerId2Hdr.find(timerId);
+    if (itr == m_timerId2Hdr.end())
     {
-        return;
+        return false;
     }
 
-    uint64_t clientId = myUser->UserId();
-
-    IRpcClientObserver* observer = NULL;
+    RPC_HDR2 hdr = itr->second;
+    if (hdr.request == NULL || hdr.parked)
+    {
+        return false;
+    }
 
+    int64_t timeout = hdr.deadline - ProGetTickCount64();
+    if (timeout <= 0)
     {
-        CProThreadMutexGuard mon(m_lock);
+        return false;
+    }
 
-        if (m_observer == NULL || m_reactor == NULL || m_packet == NULL || m_msgClient == NULL)
-        {
-            return;
-        }
+    hdr.backoff = false;
 
-        if (msgClient != m_msgClient)
-        {
-            return;
-        }
+    m_reactor->CancelTimer(timerId);
+    EraseHdr_i(timerId);
 
-        m_clientId = clientId;
+    uint64_t timerId2 = m_reactor->SetupTimer(this, (uint64_t)timeout, 0);
 
-        m_observer->AddRef();
-        observer = m_observer;
-    }
+    AddHdr_i(timerId2, hdr);
+    m_requestId2TimerId[hdr.requestId] = timerId2;
 
-    if (0)
-    {{{
-        char suiteName[64] = "";
-        msgClient->GetSslSuite(suiteName);
+    return true;
+}
 
-        CProStlString timeString;
-        ProGetLocalTimeString(timeString);
+CRpcPacket*
+CRpcClient::MakeErrorResult_i(uint64_t        clientId,
+                              const RPC_HDR2& hdr,
+                              RPC_ERROR_CODE  rpcCode) const
+{
+    /*
+     * made when the call fails, so the sends don't pay for it
+     */
+    CRpcPacket* result = CreateErrorResult_i(clientId, hdr, rpcCode);
+    if (result == NULL && m_errorPacket != NULL)
+    {
+        m_errorPacket->AddRef();
+        result = m_errorPacket;
+    }
 
-        printf(
-            "\n"
-            "%s \n"
-            " CRpcClient::OnOkMsg(id : %llu, publicIp : %s,"
-            " sslSuite : %s, server : %s:%u, mmType : %u) \n"
-            ,
-            timeString.c_str(),
-            (unsigned long long)clientId,
-            myPublicIp,
-            suiteName,
-            m_msgConfigInfo.msgc_server_ip.c_str(),
-            (unsigned int)m_msgConfigInfo.msgc_server_port,
-            (unsigned int)m_msgConfigInfo.msgc_mm_type
-            );
-    }}}
+    return result;
+}
 
-    observer->OnLogon(this, clientId, myPublicIp);
-    observer->Release();
+void
+CRpcClient::AddHdr_i(uint64_t        timerId,
+                     const RPC_HDR2& hdr)
+{
+    m_timerId2Hdr[timerId] = hdr;
+
+    if (IsOnWire_i(hdr))
+    {
+        ++m_wireCalls;
+    }
 }
 
 void
-CRpcClient::OnRecvMsg(IRtpMsgClient*      msgClient,
-                      const void*         buf,
-                      size_t              size,
-                      uint16_t            charset,
-                      const RTP_MSG_USER* srcUser)
+CRpcClient::EraseHdr_i(uint64_t timerId)
 {
-    assert(msgClient != NULL);
-    assert(buf != NULL);
-    assert(size > 0);
-    assert(srcUser != NULL);
-    if (msgClient == NULL || buf == NULL || size == 0 || srcUser == NULL)
+    auto itr = m_timerId2Hdr.find(timerId);
+    if (itr == m_timerId2Hdr.end())
     {
         return;
     }
 
-    if (srcUser->classId != RPC_ROOT_ID.classId || srcUser->UserId() != RPC_ROOT_ID.UserId())
+    if (IsOnWire_i(itr->second))
     {
-        RecvMsg(msgClient, buf, size, charset, srcUser->UserId());
+        assert(m_wireCalls > 0);
+        --m_wireCalls;
+    }
 
-        return;
+    m_timerId2Hdr.erase(itr);
+}
+
+void
+CRpcClient::ClearBatch_i()
+{
+    if (m_batchTimerId > 0)
+    {
+        m_reactor->CancelTimer(m_batchTimerId);
+        m_batchTimerId = 0;
     }
 
-    RPC_HDR                     hdr;
-    CProStlVector<RPC_ARGUMENT> args;
+    int i = 0;
+    int c = (int)m_batchRequests.size();
 
-    if (CRpcPacket::ParseRpcPacket(buf, size, hdr, args))
+    for (; i < c; ++i)
     {
-        RecvRpc(msgClient, hdr, args);
+        m_batchRequests[i]->Release();
     }
-    else
+
+    m_batchRequests.clear();
+    m_batchBytes = 0;
+}
+
+CRpcPacket*
+CRpcClient::FindCache_i(uint64_t cacheKey)
+{
+    auto itr = m_cacheKey2Entry.find(cacheKey);
+    if (itr == m_cacheKey2Entry.end())
     {
-        RecvMsg(msgClient, buf, size, charset, 0);
+        return NULL;
+    }
+
+    RPC_CACHE_ENTRY& entry = itr->second;
+    if (ProGetTickCount64() >= entry.expireTick)
+    {
+        entry.result->Release();
+        m_cacheKey2Entry.erase(itr);
+
+        return NULL;
     }
+
+    return entry.result;
 }
 
 void
-CRpcClient::RecvRpc(IRtpMsgClient*                     msgClient,
-                    RPC_HDR                            hdr,
-                    const CProStlVector<RPC_ARGUMENT>& args)
+CRpcClient::AddCache_i(uint64_t    cacheKey,
+                       uint32_t    functionId,
+                       CRpcPacket* result)
 {
-    assert(msgClient != NULL);
+    assert(cacheKey != 0);
+    assert(result != NULL);
 
-    if (hdr.requestId == 0 || hdr.functionId == 0)
+    int64_t tick = ProGetTickCount64();
+
+    auto itr = m_cacheKey2Entry.find(cacheKey);
+    if (itr != m_cacheKey2Entry.end())
     {
-        return;
+        itr->second.result->Release();
+    }
+    else
+    {
+        m_cacheKeys.push_back(cacheKey);
     }
 
-    IRpcClientObserver* observer = NULL;
-    CRpcPacket*         result   = NULL;
+    result->AddRef();
 
-    {
-        CProThreadMutexGuard mon(m_lock);
+    RPC_CACHE_ENTRY& entry = m_cacheKey2Entry[cacheKey];
+    entry.result     = result;
+    entry.functionId = functionId;
+    entry.expireTick = tick + (int64_t)m_configInfo.rpcc_cache_ttl * 1000;
 
-        if (m_observer == NULL || m_reactor == NULL || m_packet == NULL || m_msgClient == NULL)
+    /*
+     * the entries expire in the order of the insertion. evict the expired
+     * and the oldest ones beyond the size.
+     */
+    while (!m_cacheKeys.empty())
+    {
+        auto itr2 = m_cacheKey2Entry.find(m_cacheKeys.front());
+        if (itr2 == m_cacheKey2Entry.end())
         {
-            return;
+            m_cacheKeys.pop_front();
+            continue;
         }
 
-        if (msgClient != m_msgClient)
+        if (m_cacheKey2Entry.size() <= m_configInfo.rpcc_cache_size &&
+            itr2->second.expireTick > tick)
         {
-            return;
+            break;
         }
 
+        itr2->second.result->Release();
+        m_cacheKey2Entry.erase(itr2);
+        m_cacheKeys.pop_front();
+    }
+}
+
+void
+CRpcClient::InvalidateCache_i(uint32_t functionId, /* = 0 */
+                              uint64_t cacheKey)   /* = 0 */
+{
+    auto itr = m_cacheKey2Entry.begin();
+    auto end = m_cacheKey2Entry.end();
+
+    /*
+     * a key names one entry, whatever the function. the key is also removed
+     * from the insertion order, so that a re-inserted entry isn't evicted by
+     * its stale position.
+     */
+    if (cacheKey != 0)
+    {
+        itr = m_cacheKey2Entry.find(cacheKey);
+        if (itr != end)
         {
-            auto itr = m_funtionId2Info.find(hdr.functionId);
-            if (itr == m_funtionId2Info.end())
-            {
-                return;
-            }
+            itr->second.result->Release();
+            m_cacheKey2Entry.erase(itr);
 
-            const RPC_FUNCTION_INFO& info = itr->second;
-            if (!CmpRpcArgsTypes(args, info.retnArgTypes))
+            auto itr2 = std::find(m_cacheKeys.begin(), m_cacheKeys.end(), cacheKey);
+            if (itr2 != m_cacheKeys.end())
             {
-                return;
+                m_cacheKeys.erase(itr2);
             }
         }
 
-        auto itr = m_requestId2TimerId.find(hdr.requestId);
-        if (itr == m_requestId2TimerId.end())
-        {
-            return;
-        }
-
-        RPC_HDR2 hdr2 = m_timerId2Hdr[itr->second];
-
-        m_reactor->CancelTimer(itr->second);
-        m_timerId2Hdr.erase(itr->second);
-        m_requestId2TimerId.erase(itr);
+        return;
+    }
 
-        if (hdr.rpcCode == RPCE_OK)
+    while (itr != end)
+    {
+        if (functionId == 0 || itr->second.functionId == functionId)
         {
-            result = CRpcPacket::CreateInstance(
-                hdr.requestId,
-                hdr.functionId,
-                true /* this is a rebuilt packet */
-                );
-            if (result == NULL)
-            {
-                hdr.rpcCode = RPCE_NOT_ENOUGH_MEMORY;
-            }
+            itr->second.result->Release();
+            m_cacheKey2Entry.erase(itr++);
         }
-
-        if (result != NULL)
+        else
         {
-            assert(hdr.rpcCode == RPCE_OK);
-
-            result->SetClientId(m_clientId);
-            result->SetRpcCode(hdr.rpcCode);
-            result->SetMagic1(hdr2.magic1);
-            result->SetMagic2(hdr2.magic2);
-            result->SetMagicStr(hdr2.magicStr.c_str());
-
-            if (args.size() > 0)
-            {
-                result->CleanAndBeginPushArgument();
-                if (!result->PushArguments(&args[0], args.size()) || !result->EndPushArgument())
-                {
-                    hdr.rpcCode = RPCE_NOT_ENOUGH_MEMORY;
-                    result->Release();
-                    result = NULL;
-                }
-            }
-            else
-            {
-                result->CleanAndBeginPushArgument();
-                if (!result->EndPushArgument())
-                {
-                    hdr.rpcCode = RPCE_NOT_ENOUGH_MEMORY;
-                    result->Release();
-                    result = NULL;
-                }
-            }
+            ++itr;
         }
+    }
 
-        if (result == NULL)
-        {
-            assert(hdr.rpcCode != RPCE_OK);
+    CProStlDeque<uint64_t> cacheKeys;
 
-            m_packet->AddRef();
-            result = m_packet;
+    int i = 0;
+    int c = (int)m_cacheKeys.size();
 
-            result->SetClientId(m_clientId);
-            result->SetRequestId(hdr.requestId);
-            result->SetFunctionId(hdr.functionId);
-            result->SetRpcCode(hdr.rpcCode);
-            result->SetMagic1(hdr2.magic1);
-            result->SetMagic2(hdr2.magic2);
-            result->SetMagicStr(hdr2.magicStr.c_str());
+    for (; i < c; ++i)
+    {
+        if (m_cacheKey2Entry.find(m_cacheKeys[i]) != m_cacheKey2Entry.end())
+        {
+            cacheKeys.push_back(m_cacheKeys[i]);
         }
-
-        m_observer->AddRef();
-        observer = m_observer;
     }
 
-    observer->OnRpcResult(this, result);
-    observer->Release();
-    result->Release();
+    m_cacheKeys.swap(cacheKeys);
 }
 
 void
-CRpcClient::RecvMsg(IRtpMsgClient* msgClient,
-                    const void*    buf,
-                    size_t         size,
-                    uint16_t       charset,
-                    uint64_t       srcClientId)
+CRpcClient::TakeFollowers_i(const RPC_HDR2&          hdr,
+                            CProStlVector<uint64_t>& followerIds)
 {
-    assert(msgClient != NULL);
-    assert(buf != NULL);
-    assert(size > 0);
-
-    IRpcClientObserver* observer = NULL;
-
+    if (hdr.cacheKey != 0)
     {
-        CProThreadMutexGuard mon(m_lock);
-
-        if (m_observer == NULL || m_reactor == NULL || m_packet == NULL || m_msgClient == NULL)
-        {
-            return;
-        }
-
-        if (msgClient != m_msgClient)
+        auto itr = m_cacheKey2RequestId.find(hdr.cacheKey);
+        if (itr != m_cacheKey2RequestId.end() && itr->second == hdr.requestId)
         {
-            return;
+            m_cacheKey2RequestId.erase(itr);
         }
-
-        m_observer->AddRef();
-        observer = m_observer;
     }
 
-    if (srcClientId == 0)
-    {
-        observer->OnRecvMsgFromServer(this, buf, size, charset);
-    }
-    else
+    auto itr = m_leaderId2FollowerId.lower_bound(hdr.requestId);
+    auto end = m_leaderId2FollowerId.upper_bound(hdr.requestId);
+
+    for (; itr != end; ++itr)
     {
-        observer->OnRecvMsgFromClient(this, buf, size, charset, srcClientId);
+        followerIds.push_back(itr->second);
     }
 
-    observer->Release();
+    m_leaderId2FollowerId.erase(hdr.requestId);
 }
 
 void
-CRpcClient::OnCloseMsg(IRtpMsgClient* msgClient,
-                       int            errorCode,
-                       int            sslCode,
-                       bool           tcpConnected)
+CRpcClient::CompleteFollower(uint64_t          followerId,
+                             const CRpcPacket* result, /* NULL for an error */
+                             RPC_ERROR_CODE    rpcCode)
 {
-    assert(msgClient != NULL);
-    if (msgClient == NULL)
-    {
-        return;
-    }
-
-    IRpcClientObserver*            observer = NULL;
-    CRpcPacket*                    result   = NULL;
-    uint64_t                       clientId = 0;
-    CProStlMap<uint64_t, RPC_HDR2> timerId2Hdr;
+    IRpcClientObserver* observer = NULL;
+    CRpcPacket*         result2  = NULL;
+    RPC_HDR2            hdr;
 
     {
         CProThreadMutexGuard mon(m_lock);
 
-        if (m_observer == NULL || m_reactor == NULL || m_packet == NULL || m_msgClient == NULL)
+        if (m_observer == NULL || m_reactor == NULL || m_packet == NULL)
         {
             return;
         }
 
-        if (msgClient != m_msgClient)
+        auto itr = m_requestId2TimerId.find(followerId);
+        if (itr == m_requestId2TimerId.end())
         {
             return;
         }
 
-        m_requestId2TimerId.clear();
-        timerId2Hdr = m_timerId2Hdr;
-        m_timerId2Hdr.clear();
-        clientId = m_clientId;
-        m_clientId = 0;
+        hdr = m_timerId2Hdr[itr->second];
 
-        m_observer->AddRef();
-        m_packet->AddRef();
-        observer = m_observer;
-        result   = m_packet;
-    }
+        if (result != NULL)
+        {
+            result2 = CloneResult_i(m_clientId, hdr, result);
+        }
+        else
+        {
+            result2 = MakeErrorResult_i(m_clientId, hdr, rpcCode);
+        }
 
-    if (0)
-    {{{
-        CProStlString timeString;
-        ProGetLocalTimeString(timeString);
+        /*
+         * on failure, the follower is left to its own timer
+         */
+        if (result2 == NULL)
+        {
+            return;
+        }
 
-        printf(
-            "\n"
-            "%s \n"
-            " CRpcClient::OnCloseMsg(id : %llu,"
-            " errorCode : [%d, %d], tcpConnected : %d, server : %s:%u, mmType : %u) \n"
-            ,
-            timeString.c_str(),
-            (unsigned long long)clientId,
-            errorCode,
-            sslCode,
-            (int)tcpConnected,
-            m_msgConfigInfo.msgc_server_ip.c_str(),
-            (unsigned int)m_msgConfigInfo.msgc_server_port,
-            (unsigned int)m_msgConfigInfo.msgc_mm_type
-            );
-    }}}
+        m_reactor->CancelTimer(itr->second);
+        EraseHdr_i(itr->second);
+        m_requestId2TimerId.erase(itr);
 
-    auto itr = timerId2Hdr.begin();
-    auto end = timerId2Hdr.end();
+        if (hdr.callback == NULL && hdr.future == NULL && !hdr.queued)
+        {
+            m_observer->AddRef();
+            observer = m_observer;
+        }
+    }
 
-    for (; itr != end; ++itr)
+    DispatchResult(observer, hdr, result2);
+    if (observer != NULL)
     {
-        const RPC_HDR2& hdr = itr->second;
+        observer->Release();
+    }
+    result2->Release();
+}
 
-        result->SetClientId(clientId);
-        result->SetRequestId(hdr.requestId);
-        result->SetFunctionId(hdr.functionId);
-        result->SetRpcCode(RPCE_NETWORK_BROKEN);
-        result->SetMagic1(hdr.magic1);
-        result->SetMagic2(hdr.magic2);
-        result->SetMagicStr(hdr.magicStr.c_str());
+size_t
+CRpcClient::GetCallLimit_i() const
+{
+    if (!m_configInfo.rpcc_adaptive_limit)
+    {
+        return ApplyCredits_i(m_configInfo.rpcc_pending_calls);
+    }
 
-        observer->OnRpcResult(this, result);
+    size_t limit = (size_t)m_callLimit;
+    if (limit > m_configInfo.rpcc_pending_calls)
+    {
+        limit = m_configInfo.rpcc_pending_calls;
     }
 
-    observer->OnLogoff(this, errorCode, sslCode, tcpConnected);
-    observer->Release();
-    result->Release();
+    return ApplyCredits_i(limit);
 }
 
 void
-CRpcClient::OnTimer(void*    factory,
-                    uint64_t timerId,
-                    int64_t  tick,
-                    int64_t  userData)
+CRpcClient::UpdateLimit_i(int64_t rtt,  /* in milliseconds */
+                          bool    drop) /* RPCE_SERVER_BUSY or RPCE_NETWORK_TIMEOUT */
 {
-    assert(factory != NULL);
-    assert(timerId > 0);
-    if (factory == NULL || timerId == 0)
+    if (!m_configInfo.rpcc_adaptive_limit)
     {
         return;
     }
 
-    IRpcClientObserver* observer = NULL;
-    CRpcPacket*         result   = NULL;
-    uint64_t            clientId = 0;
-    RPC_HDR2            hdr;
-
+    double minLimit = m_configInfo.rpcc_adaptive_min;
+    double maxLimit = m_configInfo.rpcc_pending_calls;
+    if (minLimit > maxLimit)
     {
-        CProThreadMutexGuard mon(m_lock);
+        minLimit = maxLimit;
+    }
 
-        if (m_observer == NULL || m_reactor == NULL || m_packet == NULL)
+    if (drop)
+    {
+        /*
+         * multiplicative decrease on the loss
+         */
+        m_callLimit *= ADAPTIVE_BACKOFF;
+    }
+    else
+    {
+        if (rtt < 1)
         {
-            return;
+            rtt = 1;
         }
 
-        auto itr = m_timerId2Hdr.find(timerId);
-        if (itr == m_timerId2Hdr.end())
+        if (m_longRtt == 0)
         {
-            return;
+            m_shortRtt = (double)rtt;
+            m_longRtt  = (double)rtt;
+        }
+        else
+        {
+            m_shortRtt += ADAPTIVE_SHORT_ALPHA * ((double)rtt - m_shortRtt);
+            m_longRtt  += ADAPTIVE_LONG_ALPHA  * ((double)rtt - m_longRtt);
         }
 
-        hdr = itr->second;
+        /*
+         * gradient. the limit shrinks while the recent rtt grows beyond the
+         * long-term one, and grows by a small queue otherwise.
+         */
+        double gradient = ADAPTIVE_TOLERANCE * m_longRtt / m_shortRtt;
+        if (gradient > 1.0)
+        {
+            gradient = 1.0;
+        }
+        else if (gradient < 0.5)
+        {
+            gradient = 0.5;
+        }
 
-        m_reactor->CancelTimer(timerId);
-        m_requestId2TimerId.erase(hdr.requestId);
-        m_timerId2Hdr.erase(itr);
+        double newLimit = m_callLimit * gradient + sqrt(m_callLimit);
+        m_callLimit = m_callLimit * (1 - ADAPTIVE_SMOOTHING) + newLimit * ADAPTIVE_SMOOTHING;
+    }
 
-        m_observer->AddRef();
-        m_packet->AddRef();
-        observer = m_observer;
-        result   = m_packet;
-        clientId = m_clientId;
+    if (m_callLimit < minLimit)
+    {
+        m_callLimit = minLimit;
     }
+    if (m_callLimit > maxLimit)
+    {
+        m_callLimit = maxLimit;
+    }
+}
 
-    result->SetClientId(clientId);
-    result->SetRequestId(hdr.requestId);
-    result->SetFunctionId(hdr.functionId);
-    result->SetRpcCode(RPCE_NETWORK_TIMEOUT);
-    result->SetMagic1(hdr.magic1);
-    result->SetMagic2(hdr.magic2);
-    result->SetMagicStr(hdr.magicStr.c_str());
+size_t
+CRpcClient::ApplyCredits_i(size_t limit) const
+{
+    /*
+     * one call is always allowed, and its result brings new credits
+     */
+    if (m_credits >= 0 && limit > (size_t)m_credits)
+    {
+        limit = m_credits > 0 ? (size_t)m_credits : 1;
+    }
 
-    observer->OnRpcResult(this, result);
-    observer->Release();
-    result->Release();
+    return limit;
 }
@@ -20,6 +20,7 @@
 #define RPC_CLIENT_H
 
 #include "pro_rpc.h"
+#include "rpc_future.h"
 #include "rpc_packet.h"
 #include "rpc_server.h"
 #include "promsg/msg_client.h"
@@ -38,12 +39,38 @@ struct RPC_CLIENT_CONFIG_INFO
 {
     RPC_CLIENT_CONFIG_INFO()
     {
-        rpcc_pending_calls = 10000;
-        rpcc_rpc_timeout   = 10;
+        rpcc_pending_calls       = 10000;
+        rpcc_rpc_timeout         = 10;
+        rpcc_completion_queue    = false;
+        rpcc_retry_max           = 2;
+        rpcc_retry_budget        = 10;
+        rpcc_retry_backoff       = 50;
+        rpcc_replay_on_reconnect = false;
+        rpcc_cache_size          = 0;
+        rpcc_cache_ttl           = 60;
+        rpcc_coalesce            = true;
+        rpcc_adaptive_limit      = false;
+        rpcc_adaptive_min        = 10;
+        rpcc_credits             = false;
+        rpcc_batch_window_us     = 0;
+        rpcc_batch_max_bytes     = 65536;
     }
 
     unsigned int rpcc_pending_calls;
-    unsigned int rpcc_rpc_timeout; /* 1 ~ 3600 */
+    unsigned int rpcc_rpc_timeout;     /* 1 ~ 3600 */
+    bool         rpcc_completion_queue;
+    unsigned int rpcc_retry_max;       /* 0 ~ 10, 0 for no retry */
+    unsigned int rpcc_retry_budget;    /* 1 ~ 100, percentage of the calls */
+    unsigned int rpcc_retry_backoff;   /* 1 ~ 10000, in milliseconds */
+    bool         rpcc_replay_on_reconnect;
+    unsigned int rpcc_cache_size;      /* 0 ~ 1000000, 0 for no cache */
+    unsigned int rpcc_cache_ttl;       /* 1 ~ 86400, in seconds */
+    bool         rpcc_coalesce;
+    bool         rpcc_adaptive_limit;
+    unsigned int rpcc_adaptive_min;    /* 1 ~ 10000 */
+    bool         rpcc_credits;         /* the server has "rpcs_credits" */
+    unsigned int rpcc_batch_window_us; /* 0 ~ 1000000, 0 for no batching */
+    unsigned int rpcc_batch_max_bytes; /* 1 ~ 1048576 */
 
     DECLARE_SGI_POOL(0)
 };
@@ -56,11 +83,57 @@ struct RPC_HDR2 : public RPC_HDR
 
         magic1 = 0;
         magic2 = 0;
+        callback = NULL;
+        context  = NULL;
+        future   = NULL;
+        queued   = false;
+        request  = NULL;
+        deadline = 0;
+        slice    = 0;
+        attempts = 0;
+        backoff  = false;
+        parked   = false;
+        cacheKey = 0;
+        hit      = NULL;
+        leaderId = 0;
+        dropped  = false;
+        sendTick = 0;
     }
 
-    int64_t       magic1;
-    int64_t       magic2;
-    CProStlString magicStr;
+    int64_t             magic1;
+    int64_t             magic2;
+    CProStlString       magicStr;
+    RPC_RESULT_CALLBACK callback; /* NULL for the observer */
+    void*               context;
+    CRpcFuture*         future;   /* NULL for the observer */
+    bool                queued;   /* to the completion queue */
+    IRpcPacket*         request;  /* kept for the retries, NULL if not retryable */
+    int64_t             deadline; /* tick of the original deadline */
+    int64_t             slice;    /* timeout of each attempt, in milliseconds */
+    unsigned int        attempts; /* number of the retries made */
+    bool                backoff;  /* waiting to be resent */
+    bool                parked;   /* waiting for the reconnection */
+    uint64_t            cacheKey; /* 0 if not cacheable */
+    CRpcPacket*         hit;      /* the cached result to be delivered */
+    uint64_t            leaderId; /* the call in flight to share, 0 for none */
+    bool                dropped;  /* the caller is gone, the followers are not */
+    int64_t             sendTick; /* of the last attempt */
+
+    DECLARE_SGI_POOL(0)
+};
+
+struct RPC_CACHE_ENTRY
+{
+    RPC_CACHE_ENTRY()
+    {
+        result     = NULL;
+        functionId = 0;
+        expireTick = 0;
+    }
+
+    CRpcPacket* result;
+    uint32_t    functionId;
+    int64_t     expireTick;
 
     DECLARE_SGI_POOL(0)
 };
@@ -120,6 +193,15 @@ public:
         size_t               retnArgCount  /* = 0 */
         );
 
+    virtual RPC_ERROR_CODE RegisterFunction2(
+        uint32_t             functionId,
+        const RPC_DATA_TYPE* callArgTypes,  /* = NULL */
+        size_t               callArgCount,  /* = 0 */
+        const RPC_DATA_TYPE* retnArgTypes,  /* = NULL */
+        size_t               retnArgCount,  /* = 0 */
+        uint32_t             functionFlags  /* = 0 */
+        );
+
     virtual void UnregisterFunction(uint32_t functionId);
 
     virtual RPC_ERROR_CODE SendRpcRequest(
@@ -128,6 +210,49 @@ public:
         unsigned int rpcTimeoutInSeconds /* = 0 */
         );
 
+    virtual RPC_ERROR_CODE SendRpcRequest(
+        IRpcPacket*         request,
+        RPC_RESULT_CALLBACK callback,
+        void*               context,
+        unsigned int        rpcTimeoutInSeconds /* = 0 */
+        );
+
+    virtual RPC_ERROR_CODE SendRpcRequests(
+        IRpcPacket** requests,
+        size_t       count,
+        bool         noreply,            /* = false */
+        unsigned int rpcTimeoutInSeconds /* = 0 */
+        );
+
+    virtual RPC_ERROR_CODE SendRpcPipeline(
+        IRpcPacket**            requests,
+        size_t                  count,
+        const RPC_PIPELINE_REF* refs,               /* = NULL */
+        size_t                  refCount,           /* = 0 */
+        unsigned int            rpcTimeoutInSeconds /* = 0 */
+        );
+
+    virtual size_t PollResults(
+        IRpcPacket** results,
+        size_t       maxCount,
+        unsigned int timeoutInMilliseconds
+        );
+
+    virtual IRpcFuture* CallAsync(
+        IRpcPacket*  request,
+        unsigned int rpcTimeoutInSeconds /* = 0 */
+        );
+
+    virtual RPC_ERROR_CODE CallSync(
+        IRpcPacket*  request,
+        IRpcPacket** result,
+        unsigned int rpcTimeoutInSeconds /* = 0 */
+        );
+
+    virtual bool CancelRpc(uint64_t requestId);
+
+    virtual void Flush();
+
     virtual bool SendMsgToServer(
         const void* buf,
         size_t      size,
@@ -152,6 +277,21 @@ public:
 
     virtual int64_t GetMagic2() const;
 
+    /*
+     * the calls sent and waiting for the results, without the cache hits, the
+     * followers and the calls waiting to be resent
+     */
+    size_t GetPendingCalls() const;
+
+    size_t GetCallLimit() const;
+
+    uint32_t GetFunctionFlags(uint32_t functionId) const;
+
+    /*
+     * completes all the pending calls with "rpcCode", without retrying them
+     */
+    void FailCalls(RPC_ERROR_CODE rpcCode);
+
 private:
 
     CRpcClient(
@@ -189,12 +329,117 @@ private:
         int64_t  userData
         );
 
+    RPC_ERROR_CODE SendRpcRequest_i(
+        IRpcPacket*         request,
+        bool                noreply,
+        unsigned int        rpcTimeoutInSeconds,
+        RPC_RESULT_CALLBACK callback,
+        void*               context,
+        CRpcFuture*         future
+        );
+
+    void AddPendingCall(
+        IRpcPacket*         request,
+        unsigned int        rpcTimeoutInSeconds,
+        RPC_RESULT_CALLBACK callback,
+        void*               context,
+        CRpcFuture*         future,
+        uint64_t            cacheKey,  /* = 0 */
+        CRpcPacket*         hit,       /* = NULL */
+        uint64_t            leaderId,  /* = 0 */
+        bool                resendable /* = true */
+        );
+
+    void FailRpc(
+        uint64_t       timerId,
+        RPC_ERROR_CODE rpcCode
+        );
+
+    bool RetryRpc_i(
+        uint64_t       timerId,
+        RPC_ERROR_CODE rpcCode
+        );
+
+    bool ResendRpc_i(uint64_t timerId);
+
+    bool ParkRpc_i(uint64_t timerId);
+
+    bool WaitRpc_i(uint64_t timerId);
+
+    void ClearBatch_i();
+
+    /*
+     * they keep "m_wireCalls", the calls sent and waiting for the results
+     */
+    void AddHdr_i(
+        uint64_t        timerId,
+        const RPC_HDR2& hdr
+        );
+
+    void EraseHdr_i(uint64_t timerId);
+
+    /*
+     * the error result of a call, or the shared one of RPCE_NOT_ENOUGH_MEMORY
+     * if it can't be made
+     */
+    CRpcPacket* MakeErrorResult_i(
+        uint64_t        clientId,
+        const RPC_HDR2& hdr,
+        RPC_ERROR_CODE  rpcCode
+        ) const;
+
+    size_t GetCallLimit_i() const;
+
+    size_t ApplyCredits_i(size_t limit) const;
+
+    void UpdateLimit_i(
+        int64_t rtt,  /* in milliseconds */
+        bool    drop  /* RPCE_SERVER_BUSY or RPCE_NETWORK_TIMEOUT */
+        );
+
+    CRpcPacket* FindCache_i(uint64_t cacheKey);
+
+    void AddCache_i(
+        uint64_t    cacheKey,
+        uint32_t    functionId,
+        CRpcPacket* result
+        );
+
+    void InvalidateCache_i(
+        uint32_t functionId, /* = 0 */
+        uint64_t cacheKey    /* = 0 */
+        );
+
+    void TakeFollowers_i(
+        const RPC_HDR2&          hdr,
+        CProStlVector<uint64_t>& followerIds
+        );
+
+    void CompleteFollower(
+        uint64_t          followerId,
+        const CRpcPacket* result, /* NULL for an error */
+        RPC_ERROR_CODE    rpcCode
+        );
+
+    void PushResult(CRpcPacket* result);
+
+    void DispatchResult(
+        IRpcClientObserver* observer, /* = NULL */
+        const RPC_HDR2&     hdr,
+        CRpcPacket*         result
+        );
+
     void RecvRpc(
         IRtpMsgClient*                     msgClient,
         RPC_HDR                            hdr,
         const CProStlVector<RPC_ARGUMENT>& args
         );
 
+    void RecvCtrl(
+        IRtpMsgClient*      msgClient,
+        const RPC_CTRL_HDR& ctrl
+        );
+
     void RecvMsg(
         IRtpMsgClient* msgClient,
         const void*   buf,
@@ -208,13 +453,37 @@ private:
     IRpcClientObserver*                     m_observer;
     RPC_CLIENT_CONFIG_INFO                  m_configInfo;
     CRpcPacket*                             m_packet;
+    CRpcPacket*                             m_errorPacket; /* never modified */
     uint64_t                                m_clientId;
     int64_t                                 m_magic;
     int64_t                                 m_magic2;
+    double                                  m_retryTokens;
+    double                                  m_callLimit;
+    double                                  m_shortRtt;
+    double                                  m_longRtt;
+    int                                     m_credits; /* -1 for unknown */
+    size_t                                  m_wireCalls;
+
+    /*
+     * the requests held for the next batch, by "rpcc_batch_window_us"
+     */
+    CProStlVector<IRpcPacket*>              m_batchRequests;
+    size_t                                  m_batchBytes;
+    uint64_t                                m_batchTimerId;
+    uint64_t                                m_batchGeneration; /* of the connection */
 
     CProStlMap<uint32_t, RPC_FUNCTION_INFO> m_funtionId2Info;
     CProStlMap<uint64_t, RPC_HDR2>          m_timerId2Hdr;
     CProStlMap<uint64_t, uint64_t>          m_requestId2TimerId;
+    CProStlMap<uint64_t, RPC_CACHE_ENTRY>   m_cacheKey2Entry;
+    CProStlDeque<uint64_t>                  m_cacheKeys; /* in the order of the insertion */
+    CProStlMap<uint64_t, uint64_t>          m_cacheKey2RequestId; /* the calls in flight */
+    CProStlMultimap<uint64_t, uint64_t>     m_leaderId2FollowerId;
+
+    CProStlDeque<IRpcPacket*>               m_completionQueue;
+    bool                                    m_cqClosed; /* by Fini() */
+    CProThreadMutexCondition                m_cqCond;
+    CProThreadMutex                         m_cqLock;
 
     DECLARE_SGI_POOL(0)
 };
@@ -0,0 +1,2288 @@
+/*
+ * Copyright (C) 2018-2019 Eric Tung <libpronet@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"),
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * This file is part of LibProRpc (https://github.com/libpronet/libprorpc)
+ */
+
+#include "rpc_client_pool.h"
+#include "pro_rpc.h"
+#include "rpc_client.h"
+#include "rpc_future.h"
+#include "rpc_packet.h"
+#include "rpc_scatter.h"
+#include "rpc_server.h"
+#include "pronet/pro_config_file.h"
+#include "pronet/pro_memory_pool.h"
+#include "pronet/pro_ref_count.h"
+#include "pronet/pro_stl.h"
+#include "pronet/pro_thread_mutex.h"
+#include "pronet/pro_time_util.h"
+#include "pronet/pro_timer_factory.h"
+#include "pronet/pro_z.h"
+#include "pronet/rtp_base.h"
+#include "pronet/rtp_msg.h"
+#include <algorithm>
+
+/////////////////////////////////////////////////////////////////////////////
+////
+
+#define EWMA_ALPHA           0.2
+#define HEDGE_DEFAULT_DELAY  100  /* ms */
+#define HEDGE_MAX_TOKENS     10.0
+#define HEDGE_LATENCY_WINDOW 1000 /* samples */
+
+/////////////////////////////////////////////////////////////////////////////
+////
+
+static
+void
+ReadConfig_i(const CProStlVector<PRO_CONFIG_ITEM>& configs,
+             RPC_CLIENT_POOL_CONFIG_INFO&          configInfo)
+{
+    int i = 0;
+    int c = (int)configs.size();
+
+    for (; i < c; ++i)
+    {
+        const CProStlString& configName  = configs[i].configName;
+        const CProStlString& configValue = configs[i].configValue;
+
+        if (stricmp(configName.c_str(), "rpcc_pool_connections") == 0)
+        {
+            int value = atoi(configValue.c_str());
+            if (value > 0 && value <= 100)
+            {
+                configInfo.rpcc_pool_connections = value;
+            }
+        }
+        else if (stricmp(configName.c_str(), "rpcc_pool_policy") == 0)
+        {
+            if (stricmp(configValue.c_str(), "rr") == 0)
+            {
+                configInfo.rpcc_pool_policy = RPC_PP_RR;
+            }
+            else if (stricmp(configValue.c_str(), "least") == 0)
+            {
+                configInfo.rpcc_pool_policy = RPC_PP_LEAST;
+            }
+            else if (stricmp(configValue.c_str(), "size") == 0)
+            {
+                configInfo.rpcc_pool_policy = RPC_PP_SIZE;
+            }
+            else if (stricmp(configValue.c_str(), "p2c") == 0)
+            {
+                configInfo.rpcc_pool_policy = RPC_PP_P2C;
+            }
+            else if (stricmp(configValue.c_str(), "p2c_ewma") == 0)
+            {
+                configInfo.rpcc_pool_policy = RPC_PP_P2C_EWMA;
+            }
+            else if (stricmp(configValue.c_str(), "hash") == 0)
+            {
+                configInfo.rpcc_pool_policy = RPC_PP_HASH;
+            }
+            else
+            {
+            }
+        }
+        else if (stricmp(configName.c_str(), "rpcc_pool_big_bytes") == 0)
+        {
+            int value = atoi(configValue.c_str());
+            if (value > 0)
+            {
+                configInfo.rpcc_pool_big_bytes = value;
+            }
+        }
+        else if (stricmp(configName.c_str(), "rpcc_pool_eject_failures") == 0)
+        {
+            int value = atoi(configValue.c_str());
+            if (value >= 0)
+            {
+                configInfo.rpcc_pool_eject_failures = value;
+            }
+        }
+        else if (stricmp(configName.c_str(), "rpcc_pool_eject_time") == 0)
+        {
+            int value = atoi(configValue.c_str());
+            if (value > 0 && value <= 3600)
+            {
+                configInfo.rpcc_pool_eject_time = value;
+            }
+        }
+        else if (stricmp(configName.c_str(), "rpcc_pool_hash_vnodes") == 0)
+        {
+            int value = atoi(configValue.c_str());
+            if (value > 0 && value <= 1000)
+            {
+                configInfo.rpcc_pool_hash_vnodes = value;
+            }
+        }
+        else if (stricmp(configName.c_str(), "rpcc_pool_hedge") == 0)
+        {
+            configInfo.rpcc_pool_hedge = atoi(configValue.c_str()) != 0;
+        }
+        else if (stricmp(configName.c_str(), "rpcc_pool_hedge_percentile") == 0)
+        {
+            int value = atoi(configValue.c_str());
+            if (value >= 50 && value <= 99)
+            {
+                configInfo.rpcc_pool_hedge_percentile = value;
+            }
+        }
+        else if (stricmp(configName.c_str(), "rpcc_pool_hedge_budget") == 0)
+        {
+            int value = atoi(configValue.c_str());
+            if (value > 0 && value <= 100)
+            {
+                configInfo.rpcc_pool_hedge_budget = value;
+            }
+        }
+        else
+        {
+        }
+    } /* end of for () */
+}
+
+static
+CRpcPacket*
+CreateErrorResult_i(const IRpcPacket* request,
+                    RPC_ERROR_CODE    rpcCode)
+{
+    CRpcPacket* result = CRpcPacket::CreateInstance(
+        request->GetRequestId(), request->GetFunctionId(), false);
+    if (result == NULL)
+    {
+        return NULL;
+    }
+
+    result->SetRpcCode(rpcCode);
+
+    result->CleanAndBeginPushArgument();
+    if (!result->EndPushArgument())
+    {
+        result->Release();
+        result = NULL;
+    }
+
+    return result;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+////
+
+CRpcClientPool*
+CRpcClientPool::CreateInstance()
+{
+    return new CRpcClientPool;
+}
+
+CRpcClientPool::CRpcClientPool()
+{
+    m_observer   = NULL;
+    m_reactor    = NULL;
+    m_mmType     = 0;
+    m_hasUser    = false;
+    m_logonCount = 0;
+    m_nextIndex  = 0;
+    m_nextInstId = 0;
+
+    m_latencySamples = 0;
+    m_hedgeDelay     = HEDGE_DEFAULT_DELAY;
+    m_hedgeTokens    = 0;
+}
+
+CRpcClientPool::~CRpcClientPool()
+{
+    Fini();
+}
+
+bool
+CRpcClientPool::Init(IRpcClientPoolObserver* observer,
+                     IProReactor*            reactor,
+                     const char*             argv0,      /* = NULL */
+                     const char*             configFileName,
+                     RTP_MM_TYPE             mmType,     /* = 0 */
+                     const char**            serverIps,
+                     const unsigned short*   serverPorts,
+                     size_t                  serverCount,
+                     const RTP_MSG_USER*     user,       /* = NULL */
+                     const char*             password,   /* = NULL */
+                     const char*             localIp)    /* = NULL */
+{
+    assert(observer != NULL);
+    assert(reactor != NULL);
+    assert(configFileName != NULL);
+    assert(configFileName[0] != '\0');
+    assert(serverIps != NULL);
+    assert(serverPorts != NULL);
+    assert(serverCount > 0);
+    if (observer == NULL || reactor == NULL || configFileName == NULL || configFileName[0] == '\0' ||
+        serverIps == NULL || serverPorts == NULL || serverCount == 0)
+    {
+        return false;
+    }
+
+    char exeRoot[1024] = "";
+    ProGetExeDir_(exeRoot, argv0);
+
+    CProStlString configFileName2 = configFileName;
+    if (configFileName2[0] == '.' ||
+        configFileName2.find_first_of("\\/") == CProStlString::npos)
+    {
+        CProStlString fileName = exeRoot;
+        fileName += configFileName2;
+        configFileName2 = fileName;
+    }
+
+    CProConfigFile configFile;
+    configFile.Init(configFileName2.c_str());
+
+    CProStlVector<PRO_CONFIG_ITEM> configs;
+    if (!configFile.Read(configs))
+    {
+        return false;
+    }
+
+    RPC_CLIENT_POOL_CONFIG_INFO configInfo;
+    ReadConfig_i(configs, configInfo);
+
+    {
+        CProThreadMutexGuard mon(m_lock);
+
+        assert(m_observer == NULL);
+        assert(m_reactor == NULL);
+        if (m_observer != NULL || m_reactor != NULL)
+        {
+            return false;
+        }
+
+        m_reactor        = reactor;
+        m_argv0          = argv0 != NULL ? argv0 : "";
+        m_configFileName = configFileName;
+        m_mmType         = mmType;
+        m_hasUser        = user != NULL;
+        m_user           = user != NULL ? *user : RTP_MSG_USER();
+        m_password       = password != NULL ? password : "";
+        m_localIp        = localIp != NULL ? localIp : "";
+        m_configInfo     = configInfo;
+
+        for (int i = 0; i < (int)serverCount; ++i)
+        {
+            if (!AddServer_i(serverIps[i], serverPorts[i]))
+            {
+                goto EXIT;
+            }
+        }
+
+        RebuildRing_i();
+
+        observer->AddRef();
+        m_observer = observer;
+    }
+
+    return true;
+
+EXIT:
+
+    for (int i = 0; i < (int)m_members.size(); ++i)
+    {
+        m_members[i].client->Fini();
+        m_members[i].client->Release();
+    }
+
+    m_members.clear();
+    m_endpoints.clear();
+    m_reactor = NULL;
+
+    return false;
+}
+
+bool
+CRpcClientPool::AddServer_i(const char*    serverIp,
+                            unsigned short serverPort)
+{
+    RPC_POOL_ENDPOINT endpoint;
+    endpoint.serverIp   = serverIp != NULL ? serverIp : "";
+    endpoint.serverPort = serverPort;
+
+    CProStlVector<RPC_POOL_MEMBER> members;
+
+    for (int i = 0; i < (int)m_configInfo.rpcc_pool_connections; ++i)
+    {
+        /*
+         * the connections of a static user need different instance ids
+         */
+        RTP_MSG_USER user = m_user;
+        if (m_hasUser && user.UserId() != 0)
+        {
+            user.instId = (uint16_t)(user.instId + m_nextInstId);
+        }
+
+        RPC_POOL_MEMBER member;
+        member.endpointIndex = m_endpoints.size();
+        member.lane          = i;
+        member.client        = CRpcClient::CreateInstance(0, 0);
+        if (member.client == NULL)
+        {
+            goto EXIT;
+        }
+
+        if (!member.client->Init(this, m_reactor,
+            m_argv0.empty() ? NULL : m_argv0.c_str(),
+            m_configFileName.c_str(), m_mmType, serverIp, serverPort,
+            m_hasUser ? &user : NULL,
+            m_password.empty() ? NULL : m_password.c_str(),
+            m_localIp.empty() ? NULL : m_localIp.c_str()))
+        {
+            member.client->Release();
+
+            goto EXIT;
+        }
+
+        members.push_back(member);
+        ++m_nextInstId;
+
+        auto itr = m_funtionId2Info.begin();
+        auto end = m_funtionId2Info.end();
+
+        for (; itr != end; ++itr)
+        {
+            const RPC_FUNCTION_INFO& info = itr->second;
+
+            member.client->RegisterFunction2(itr->first,
+                info.callArgTypes.size() > 0 ? &info.callArgTypes[0] : NULL,
+                info.callArgTypes.size(),
+                info.retnArgTypes.size() > 0 ? &info.retnArgTypes[0] : NULL,
+                info.retnArgTypes.size(),
+                info.flags);
+        }
+    }
+
+    m_endpoints.push_back(endpoint);
+    m_members.insert(m_members.end(), members.begin(), members.end());
+
+    return true;
+
+EXIT:
+
+    for (int i = 0; i < (int)members.size(); ++i)
+    {
+        members[i].client->Fini();
+        members[i].client->Release();
+    }
+
+    return false;
+}
+
+void
+CRpcClientPool::RebuildRing_i()
+{
+    m_hashRing.clear();
+
+    for (int i = 0; i < (int)m_endpoints.size(); ++i)
+    {
+        const RPC_POOL_ENDPOINT& endpoint = m_endpoints[i];
+
+        for (int j = 0; j < (int)m_configInfo.rpcc_pool_hash_vnodes; ++j)
+        {
+            char point[128] = "";
+            snprintf_pro(point, sizeof(point), "%s:%u#%d",
+                endpoint.serverIp.c_str(), (unsigned int)endpoint.serverPort, j);
+
+            m_hashRing[CalcRpcHash(point, strlen(point), RPC_HASH_SEED)] = i;
+        }
+    }
+}
+
+void
+CRpcClientPool::Fini()
+{
+    IRpcClientPoolObserver*        observer = NULL;
+    CProStlVector<RPC_POOL_MEMBER> members;
+
+    {
+        CProThreadMutexGuard mon(m_lock);
+
+        if (m_observer == NULL)
+        {
+            return;
+        }
+
+        auto itr = m_timerId2RequestId.begin();
+        auto end = m_timerId2RequestId.end();
+
+        for (; itr != end; ++itr)
+        {
+            m_reactor->CancelTimer(itr->first);
+        }
+
+        members = m_members;
+        m_members.clear();
+        m_endpoints.clear();
+        m_hashRing.clear();
+        m_hashArgs.clear();
+        m_bulkFunctionIds.clear();
+        m_requestId2Call.clear();
+        m_requestId2Hedge.clear();
+        m_timerId2RequestId.clear();
+        m_funtionId2Info.clear();
+        m_latencies.clear();
+        m_logonCount = 0;
+        m_reactor = NULL;
+        observer = m_observer;
+        m_observer = NULL;
+    }
+
+    for (int i = 0; i < (int)members.size(); ++i)
+    {
+        members[i].client->Fini();
+        members[i].client->Release();
+    }
+
+    observer->Release();
+}
+
+unsigned long
+CRpcClientPool::AddRef()
+{
+    return CProRefCount::AddRef();
+}
+
+unsigned long
+CRpcClientPool::Release()
+{
+    return CProRefCount::Release();
+}
+
+RTP_MM_TYPE
+CRpcClientPool::GetMmType() const
+{
+    RTP_MM_TYPE mmType = 0;
+
+    {
+        CProThreadMutexGuard mon(m_lock);
+
+        if (m_members.size() > 0)
+        {
+            mmType = m_members[0].client->GetMmType();
+        }
+    }
+
+    return mmType;
+}
+
+size_t
+CRpcClientPool::GetClientCount() const
+{
+    size_t count = 0;
+
+    {
+        CProThreadMutexGuard mon(m_lock);
+
+        count = m_members.size();
+    }
+
+    return count;
+}
+
+IRpcClient*
+CRpcClientPool::GetClient(size_t index) const
+{
+    IRpcClient* client = NULL;
+
+    {
+        CProThreadMutexGuard mon(m_lock);
+
+        if (index < m_members.size())
+        {
+            client = m_members[index].client;
+        }
+    }
+
+    return client;
+}
+
+size_t
+CRpcClientPool::GetLogonCount() const
+{
+    size_t count = 0;
+
+    {
+        CProThreadMutexGuard mon(m_lock);
+
+        count = m_logonCount;
+    }
+
+    return count;
+}
+
+size_t
+CRpcClientPool::GetServerCount() const
+{
+    size_t count = 0;
+
+    {
+        CProThreadMutexGuard mon(m_lock);
+
+        count = m_endpoints.size();
+    }
+
+    return count;
+}
+
+const char*
+CRpcClientPool::GetServerIp(size_t index,
+                            char   serverIp[64]) const
+{
+    strcpy(serverIp, "0.0.0.0");
+
+    {
+        CProThreadMutexGuard mon(m_lock);
+
+        if (index < m_endpoints.size() && !m_endpoints[index].serverIp.empty())
+        {
+            strncpy_pro(serverIp, 64, m_endpoints[index].serverIp.c_str());
+        }
+    }
+
+    return serverIp;
+}
+
+unsigned short
+CRpcClientPool::GetServerPort(size_t index) const
+{
+    unsigned short serverPort = 0;
+
+    {
+        CProThreadMutexGuard mon(m_lock);
+
+        if (index < m_endpoints.size())
+        {
+            serverPort = m_endpoints[index].serverPort;
+        }
+    }
+
+    return serverPort;
+}
+
+RPC_ERROR_CODE
+CRpcClientPool::RegisterFunction(uint32_t             functionId,
+                                 const RPC_DATA_TYPE* callArgTypes, /* = NULL */
+                                 size_t               callArgCount, /* = 0 */
+                                 const RPC_DATA_TYPE* retnArgTypes, /* = NULL */
+                                 size_t               retnArgCount) /* = 0 */
+{
+    return RegisterFunction2(
+        functionId, callArgTypes, callArgCount, retnArgTypes, retnArgCount, 0);
+}
+
+RPC_ERROR_CODE
+CRpcClientPool::RegisterFunction2(uint32_t             functionId,
+                                  const RPC_DATA_TYPE* callArgTypes,  /* = NULL */
+                                  size_t               callArgCount,  /* = 0 */
+                                  const RPC_DATA_TYPE* retnArgTypes,  /* = NULL */
+                                  size_t               retnArgCount,  /* = 0 */
+                                  uint32_t             functionFlags) /* = 0 */
+{
+    CProThreadMutexGuard mon(m_lock);
+
+    if (m_observer == NULL)
+    {
+        return RPCE_ERROR;
+    }
+
+    for (int i = 0; i < (int)m_members.size(); ++i)
+    {
+        RPC_ERROR_CODE rpcCode = m_members[i].client->RegisterFunction2(functionId,
+            callArgTypes, callArgCount, retnArgTypes, retnArgCount, functionFlags);
+        if (rpcCode != RPCE_OK)
+        {
+            for (int j = 0; j < i; ++j)
+            {
+                m_members[j].client->UnregisterFunction(functionId);
+            }
+
+            return rpcCode;
+        }
+    }
+
+    /*
+     * for the servers added later
+     */
+    RPC_FUNCTION_INFO& info = m_funtionId2Info[functionId]; /* insert */
+    info.callArgTypes.assign(callArgTypes, callArgTypes + callArgCount);
+    info.retnArgTypes.assign(retnArgTypes, retnArgTypes + retnArgCount);
+    info.flags = functionFlags;
+
+    return RPCE_OK;
+}
+
+void
+CRpcClientPool::UnregisterFunction(uint32_t functionId)
+{
+    CProThreadMutexGuard mon(m_lock);
+
+    if (m_observer == NULL)
+    {
+        return;
+    }
+
+    for (int i = 0; i < (int)m_members.size(); ++i)
+    {
+        m_members[i].client->UnregisterFunction(functionId);
+    }
+
+    m_funtionId2Info.erase(functionId);
+    m_bulkFunctionIds.erase(functionId);
+}
+
+void
+CRpcClientPool::SetBulkFunction(uint32_t functionId,
+                                bool     bulk)
+{
+    CProThreadMutexGuard mon(m_lock);
+
+    if (m_observer == NULL)
+    {
+        return;
+    }
+
+    if (bulk)
+    {
+        m_bulkFunctionIds.insert(functionId);
+    }
+    else
+    {
+        m_bulkFunctionIds.erase(functionId);
+    }
+}
+
+void
+CRpcClientPool::SetHashArgument(uint32_t functionId,
+                                int      argIndex)
+{
+    CProThreadMutexGuard mon(m_lock);
+
+    if (m_observer == NULL)
+    {
+        return;
+    }
+
+    if (argIndex >= 0)
+    {
+        m_hashArgs[functionId] = argIndex;
+    }
+    else
+    {
+        m_hashArgs.erase(functionId);
+    }
+}
+
+bool
+CRpcClientPool::AddServer(const char*    serverIp,
+                          unsigned short serverPort)
+{
+    assert(serverIp != NULL);
+    assert(serverIp[0] != '\0');
+    assert(serverPort > 0);
+    if (serverIp == NULL || serverIp[0] == '\0' || serverPort == 0)
+    {
+        return false;
+    }
+
+    CProThreadMutexGuard mon(m_lock);
+
+    if (m_observer == NULL)
+    {
+        return false;
+    }
+
+    if (FindServer_i(serverIp, serverPort) >= 0)
+    {
+        return false;
+    }
+
+    if (!AddServer_i(serverIp, serverPort))
+    {
+        return false;
+    }
+
+    RebuildRing_i();
+
+    return true;
+}
+
+void
+CRpcClientPool::RemoveServer(const char*    serverIp,
+                             unsigned short serverPort)
+{
+    assert(serverIp != NULL);
+    if (serverIp == NULL)
+    {
+        return;
+    }
+
+    IRpcClientPoolObserver*        observer = NULL;
+    CProStlVector<RPC_POOL_MEMBER> members;
+
+    {
+        CProThreadMutexGuard mon(m_lock);
+
+        if (m_observer == NULL)
+        {
+            return;
+        }
+
+        int index = FindServer_i(serverIp, serverPort);
+        if (index < 0 || m_endpoints.size() == 1)
+        {
+            return;
+        }
+
+        size_t logonCount = m_logonCount;
+
+        CProStlVector<RPC_POOL_MEMBER> members2;
+
+        for (int i = 0; i < (int)m_members.size(); ++i)
+        {
+            RPC_POOL_MEMBER member = m_members[i];
+            if (member.endpointIndex == (size_t)index)
+            {
+                if (member.logon)
+                {
+                    --m_logonCount;
+                }
+
+                members.push_back(member);
+                continue;
+            }
+
+            if (member.endpointIndex > (size_t)index)
+            {
+                --member.endpointIndex;
+            }
+
+            members2.push_back(member);
+        }
+
+        m_members = members2;
+        m_endpoints.erase(m_endpoints.begin() + index);
+        m_nextIndex = 0;
+
+        auto itr = m_requestId2Call.begin();
+
+        while (itr != m_requestId2Call.end())
+        {
+            int i = 0;
+            int c = (int)members.size();
+
+            for (; i < c; ++i)
+            {
+                if (members[i].client == itr->second.client)
+                {
+                    break;
+                }
+            }
+
+            if (i < c)
+            {
+                m_requestId2Call.erase(itr++);
+            }
+            else
+            {
+                ++itr;
+            }
+        }
+
+        RebuildRing_i();
+
+        if (logonCount > 0 && m_logonCount == 0)
+        {
+            m_observer->AddRef();
+            observer = m_observer;
+        }
+    }
+
+    /*
+     * the pending calls are completed with RPCE_NETWORK_BROKEN, through the
+     * observer, the completion queue, the callbacks or the futures. Fini()
+     * alone would drop those of the observer and of the queue.
+     */
+    for (int i = 0; i < (int)members.size(); ++i)
+    {
+        members[i].client->FailCalls(RPCE_NETWORK_BROKEN);
+        members[i].client->Fini();
+        members[i].client->Release();
+    }
+
+    if (observer != NULL)
+    {
+        observer->OnLogoff(this, 0, 0, false);
+        observer->Release();
+    }
+}
+
+int
+CRpcClientPool::FindServer_i(const char*    serverIp,
+                             unsigned short serverPort) const
+{
+    for (int i = 0; i < (int)m_endpoints.size(); ++i)
+    {
+        const RPC_POOL_ENDPOINT& endpoint = m_endpoints[i];
+        if (endpoint.serverPort == serverPort &&
+            stricmp(endpoint.serverIp.c_str(), serverIp) == 0)
+        {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+RPC_ERROR_CODE
+CRpcClientPool::SendRpcRequest(IRpcPacket*  request,
+                               bool         noreply,             /* = false */
+                               unsigned int rpcTimeoutInSeconds) /* = 0 */
+{
+    assert(request != NULL);
+    if (request == NULL)
+    {
+        return RPCE_INVALID_ARGUMENT;
+    }
+
+    if (!noreply && IsHedged(request))
+    {
+        return SendHedged(request, rpcTimeoutInSeconds, NULL, NULL, NULL);
+    }
+
+    CRpcClient* client = PickClient(request);
+    if (client == NULL)
+    {
+        return RPCE_ERROR;
+    }
+
+    if (!noreply)
+    {
+        BeginCall(client, request->GetRequestId());
+    }
+
+    RPC_ERROR_CODE rpcCode = client->SendRpcRequest(request, noreply, rpcTimeoutInSeconds);
+    if (rpcCode != RPCE_OK && !noreply)
+    {
+        EndCall(client, request->GetRequestId(), NULL);
+    }
+
+    client->Release();
+
+    return rpcCode;
+}
+
+RPC_ERROR_CODE
+CRpcClientPool::SendRpcRequest(IRpcPacket*         request,
+                               RPC_RESULT_CALLBACK callback,
+                               void*               context,
+                               unsigned int        rpcTimeoutInSeconds) /* = 0 */
+{
+    assert(request != NULL);
+    assert(callback != NULL);
+    if (request == NULL || callback == NULL)
+    {
+        return RPCE_INVALID_ARGUMENT;
+    }
+
+    if (IsHedged(request))
+    {
+        return SendHedged(request, rpcTimeoutInSeconds, callback, context, NULL);
+    }
+
+    CRpcClient* client = PickClient(request);
+    if (client == NULL)
+    {
+        return RPCE_ERROR;
+    }
+
+    RPC_POOL_CALL_CONTEXT* context2 = new RPC_POOL_CALL_CONTEXT;
+    context2->pool     = this;
+    context2->client   = client;
+    context2->callback = callback;
+    context2->context  = context;
+
+    AddRef();
+    BeginCall(client, request->GetRequestId());
+
+    RPC_ERROR_CODE rpcCode = client->SendRpcRequest(
+        request, &CRpcClientPool::OnCallResult_s, context2, rpcTimeoutInSeconds);
+    if (rpcCode != RPCE_OK)
+    {
+        EndCall(client, request->GetRequestId(), NULL);
+        Release();
+        delete context2;
+    }
+
+    client->Release();
+
+    return rpcCode;
+}
+
+IRpcFuture*
+CRpcClientPool::CallAsync(IRpcPacket*  request,
+                          unsigned int rpcTimeoutInSeconds) /* = 0 */
+{
+    assert(request != NULL);
+    if (request == NULL)
+    {
+        return NULL;
+    }
+
+    if (IsHedged(request))
+    {
+        CRpcFuture* future = CRpcFuture::CreateInstance(request->GetRequestId());
+        if (future == NULL)
+        {
+            return NULL;
+        }
+
+        if (SendHedged(request, rpcTimeoutInSeconds, NULL, NULL, future) == RPCE_OK)
+        {
+            return future;
+        }
+
+        /*
+         * the plain path reports the error through a completed future
+         */
+        future->Release();
+    }
+
+    CRpcClient* client = PickClient(request);
+    if (client == NULL)
+    {
+        return NULL;
+    }
+
+    BeginCall(client, request->GetRequestId());
+
+    IRpcFuture* future = client->CallAsync(request, rpcTimeoutInSeconds);
+    if (future != NULL)
+    {
+        RPC_POOL_CALL_CONTEXT* context = new RPC_POOL_CALL_CONTEXT;
+        context->pool     = this;
+        context->client   = client;
+        context->callback = NULL;
+        context->context  = NULL;
+
+        AddRef();
+        future->Then(&CRpcClientPool::OnFutureResult_s, context);
+    }
+    else
+    {
+        EndCall(client, request->GetRequestId(), NULL);
+    }
+
+    client->Release();
+
+    return future;
+}
+
+RPC_ERROR_CODE
+CRpcClientPool::CallSync(IRpcPacket*  request,
+                         IRpcPacket** result,
+                         unsigned int rpcTimeoutInSeconds) /* = 0 */
+{
+    assert(request != NULL);
+    assert(result != NULL);
+    if (request == NULL || result == NULL)
+    {
+        return RPCE_INVALID_ARGUMENT;
+    }
+
+    *result = NULL;
+
+    IRpcFuture* future = CallAsync(request, rpcTimeoutInSeconds);
+    if (future == NULL)
+    {
+        return RPCE_ERROR;
+    }
+
+    future->WaitFor((unsigned int)-1);
+
+    IRpcPacket* result2 = future->GetResult();
+    result2->AddRef();
+    future->Release();
+
+    *result = result2;
+
+    return result2->GetRpcCode();
+}
+
+IRpcScatter*
+CRpcClientPool::CallScatter(IRpcPacket** requests,
+                            size_t       count,
+                            size_t       quorum,              /* = 0 */
+                            unsigned int rpcTimeoutInSeconds) /* = 0 */
+{
+    assert(requests != NULL);
+    assert(count > 0);
+    if (requests == NULL || count == 0)
+    {
+        return NULL;
+    }
+
+    for (int i = 0; i < (int)count; ++i)
+    {
+        assert(requests[i] != NULL);
+        if (requests[i] == NULL)
+        {
+            return NULL;
+        }
+    }
+
+    CRpcScatter*      scatter = NULL;
+    RPC_POOL_SCATTER* gather  = NULL;
+
+    {
+        CProThreadMutexGuard mon(m_lock);
+
+        if (m_observer == NULL || m_members.size() == 0)
+        {
+            return NULL;
+        }
+
+        size_t servers = m_endpoints.size();
+        if ((count != 1 && count != servers) || quorum > servers)
+        {
+            return NULL;
+        }
+
+        scatter = CRpcScatter::CreateInstance(servers, quorum);
+        if (scatter == NULL)
+        {
+            return NULL;
+        }
+
+        gather = new RPC_POOL_SCATTER;
+        gather->pool     = this;
+        gather->scatter  = scatter;
+        gather->refCount = servers + 1;
+        gather->calls.resize(servers);
+
+        for (int i = 0; i < (int)servers; ++i)
+        {
+            RPC_POOL_SCATTER_CALL& call = gather->calls[i];
+            call.gather    = gather;
+            call.index     = i;
+            call.client    = m_members[PickScatter_i(i)].client;
+            call.requestId = requests[count == 1 ? 0 : i]->GetRequestId();
+            call.pending   = true;
+            call.client->AddRef();
+
+            scatter->SetServer(i, m_endpoints[i].serverIp.c_str(), m_endpoints[i].serverPort);
+        }
+    }
+
+    AddRef();
+    scatter->AddRef(); /* the caller's */
+
+    for (int i = 0; i < (int)gather->calls.size(); ++i)
+    {
+        RPC_POOL_SCATTER_CALL& call    = gather->calls[i];
+        IRpcPacket*            request = requests[count == 1 ? 0 : i];
+
+        /*
+         * the scatter may be ready before all the calls are sent
+         */
+        if (scatter->IsReady())
+        {
+            {
+                CProThreadMutexGuard mon(m_lock);
+
+                call.pending = false;
+            }
+
+            ReleaseScatter(gather);
+            continue;
+        }
+
+        BeginCall(call.client, call.requestId);
+
+        RPC_ERROR_CODE rpcCode = call.client->SendRpcRequest(
+            request, &CRpcClientPool::OnScatterResult_s, &call, rpcTimeoutInSeconds);
+        if (rpcCode == RPCE_OK)
+        {
+            continue;
+        }
+
+        EndCall(call.client, call.requestId, NULL);
+
+        /*
+         * a call that can't be sent is reported like a failed one
+         */
+        CRpcPacket* result = CreateErrorResult_i(request, rpcCode);
+        if (result != NULL)
+        {
+            OnScatterResult(call.client, result, &call);
+            result->Release();
+        }
+        else
+        {
+            {
+                CProThreadMutexGuard mon(m_lock);
+
+                call.pending = false;
+            }
+
+            ReleaseScatter(gather);
+        }
+    }
+
+    ReleaseScatter(gather); /* the creator */
+
+    return scatter;
+}
+
+bool
+CRpcClientPool::CancelRpc(uint64_t requestId)
+{
+    CProStlVector<CRpcClient*> clients;
+
+    {
+        CProThreadMutexGuard mon(m_lock);
+
+        if (m_observer == NULL)
+        {
+            return false;
+        }
+
+        auto itr = m_requestId2Call.lower_bound(requestId);
+        auto end = m_requestId2Call.upper_bound(requestId);
+
+        for (; itr != end; ++itr)
+        {
+            itr->second.client->AddRef();
+            clients.push_back(itr->second.client);
+        }
+    }
+
+    bool ret = false;
+
+    int i = 0;
+    int c = (int)clients.size();
+
+    for (; i < c; ++i)
+    {
+        if (clients[i]->CancelRpc(requestId))
+        {
+            ret = true;
+        }
+
+        clients[i]->Release();
+    }
+
+    return ret;
+}
+
+void
+CRpcClientPool::Flush()
+{
+    CProStlVector<CRpcClient*> clients;
+
+    {
+        CProThreadMutexGuard mon(m_lock);
+
+        if (m_observer == NULL)
+        {
+            return;
+        }
+
+        for (int i = 0; i < (int)m_members.size(); ++i)
+        {
+            m_members[i].client->AddRef();
+            clients.push_back(m_members[i].client);
+        }
+    }
+
+    int i = 0;
+    int c = (int)clients.size();
+
+    for (; i < c; ++i)
+    {
+        clients[i]->Flush();
+        clients[i]->Release();
+    }
+}
+
+CRpcClient*
+CRpcClientPool::PickClient(IRpcPacket* request)
+{
+    assert(request != NULL);
+
+    CRpcClient* client = NULL;
+    int64_t     tick   = ProGetTickCount64();
+
+    {
+        CProThreadMutexGuard mon(m_lock);
+
+        if (m_observer == NULL || m_members.size() == 0)
+        {
+            return NULL;
+        }
+
+        int index = PickIndex_i(request, tick);
+        if (index < 0)
+        {
+            /*
+             * the client will report RPCE_NETWORK_NOT_CONNECTED
+             */
+            index = 0;
+        }
+
+        client = m_members[index].client;
+        client->AddRef();
+    }
+
+    return client;
+}
+
+int
+CRpcClientPool::PickIndex_i(IRpcPacket* request,
+                            int64_t     tick)
+{
+    assert(request != NULL);
+
+    /*
+     * the ejected endpoints are skipped unless all of them are ejected
+     */
+    CProStlVector<int> indexes;
+
+    for (int k = 0; k < 2 && indexes.size() == 0; ++k)
+    {
+        for (int i = 0; i < (int)m_members.size(); ++i)
+        {
+            const RPC_POOL_MEMBER& member = m_members[i];
+            if (!member.logon)
+            {
+                continue;
+            }
+
+            if (k == 0 && m_endpoints[member.endpointIndex].ejectTick > tick)
+            {
+                continue;
+            }
+
+            indexes.push_back(i);
+        }
+    }
+
+    if (indexes.size() == 0)
+    {
+        return -1;
+    }
+
+    switch (m_configInfo.rpcc_pool_policy)
+    {
+    case RPC_PP_LEAST:
+        return PickLeast_i(indexes);
+    case RPC_PP_P2C:
+    case RPC_PP_P2C_EWMA:
+        return PickTwo_i(indexes);
+    case RPC_PP_HASH:
+        return PickHash_i(request, indexes);
+    default:
+        break;
+    }
+
+    if (m_configInfo.rpcc_pool_policy == RPC_PP_SIZE && m_configInfo.rpcc_pool_connections > 1)
+    {
+        /*
+         * the first connection of each endpoint is the lane of the big payloads
+         */
+        bool bulk =
+            request->GetTotalSize() >= m_configInfo.rpcc_pool_big_bytes ||
+            m_bulkFunctionIds.find(request->GetFunctionId()) != m_bulkFunctionIds.end();
+
+        CProStlVector<int> indexes2;
+
+        for (int i = 0; i < (int)indexes.size(); ++i)
+        {
+            if ((m_members[indexes[i]].lane == 0) == bulk)
+            {
+                indexes2.push_back(indexes[i]);
+            }
+        }
+
+        return PickLeast_i(indexes2.size() > 0 ? indexes2 : indexes);
+    }
+
+    /*
+     * round-robin
+     */
+    int index = indexes[0];
+
+    for (int i = 0; i < (int)indexes.size(); ++i)
+    {
+        if (indexes[i] >= (int)m_nextIndex)
+        {
+            index = indexes[i];
+            break;
+        }
+    }
+
+    m_nextIndex = index + 1;
+
+    return index;
+}
+
+int
+CRpcClientPool::PickHash_i(IRpcPacket*               request,
+                           const CProStlVector<int>& indexes) const
+{
+    assert(request != NULL);
+
+    /*
+     * the key is the given argument, or the first RPC_DT_UINT64 one
+     */
+    int    argIndex = -1;
+    size_t argCount = request->GetArgumentCount();
+
+    auto itr = m_hashArgs.find(request->GetFunctionId());
+    if (itr != m_hashArgs.end())
+    {
+        argIndex = itr->second;
+    }
+    else
+    {
+        for (int i = 0; i < (int)argCount; ++i)
+        {
+            RPC_ARGUMENT arg;
+            request->GetArgument(i, &arg);
+            if (arg.type == RPC_DT_UINT64)
+            {
+                argIndex = i;
+                break;
+            }
+        }
+    }
+
+    if (argIndex < 0 || argIndex >= (int)argCount || m_hashRing.size() == 0)
+    {
+        return PickLeast_i(indexes);
+    }
+
+    RPC_ARGUMENT arg;
+    request->GetArgument(argIndex, &arg);
+    uint64_t key = CalcRpcArgumentHash(arg, RPC_HASH_SEED);
+
+    /*
+     * the owner of the key is the first available server clockwise
+     */
+    auto itr2 = m_hashRing.lower_bound(key);
+
+    for (size_t n = 0; n < m_hashRing.size(); ++n, ++itr2)
+    {
+        if (itr2 == m_hashRing.end())
+        {
+            itr2 = m_hashRing.begin();
+        }
+
+        CProStlVector<int> indexes2;
+
+        for (int i = 0; i < (int)indexes.size(); ++i)
+        {
+            if (m_members[indexes[i]].endpointIndex == itr2->second)
+            {
+                indexes2.push_back(indexes[i]);
+            }
+        }
+
+        if (indexes2.size() > 0)
+        {
+            return PickLeast_i(indexes2);
+        }
+    }
+
+    return PickLeast_i(indexes);
+}
+
+int
+CRpcClientPool::PickLeast_i(const CProStlVector<int>& indexes) const
+{
+    int    index   = -1;
+    size_t minimum = 0;
+
+    for (int i = 0; i < (int)indexes.size(); ++i)
+    {
+        size_t pending = m_members[indexes[i]].client->GetPendingCalls();
+        if (index < 0 || pending < minimum)
+        {
+            index   = indexes[i];
+            minimum = pending;
+        }
+    }
+
+    return index;
+}
+
+int
+CRpcClientPool::PickTwo_i(const CProStlVector<int>& indexes) const
+{
+    int count = (int)indexes.size();
+    if (count == 1)
+    {
+        return indexes[0];
+    }
+
+    int i = (int)(ProRand_0_1() * count);
+    int j = (int)(ProRand_0_1() * (count - 1));
+    if (i >= count)
+    {
+        i = count - 1;
+    }
+    if (j >= count - 1)
+    {
+        j = count - 2;
+    }
+    if (j >= i)
+    {
+        ++j;
+    }
+
+    return GetCost_i(indexes[i]) <= GetCost_i(indexes[j]) ? indexes[i] : indexes[j];
+}
+
+double
+CRpcClientPool::GetCost_i(int index) const
+{
+    const RPC_POOL_MEMBER& member  = m_members[index];
+    double                 pending = (double)member.client->GetPendingCalls();
+
+    if (m_configInfo.rpcc_pool_policy != RPC_PP_P2C_EWMA)
+    {
+        return pending;
+    }
+
+    /*
+     * the expected waiting time
+     */
+    return m_endpoints[member.endpointIndex].latency * (pending + 1);
+}
+
+void
+CRpcClientPool::BeginCall(CRpcClient* client,
+                          uint64_t    requestId)
+{
+    assert(client != NULL);
+
+    RPC_POOL_CALL_INFO info;
+    info.client   = client;
+    info.sendTick = ProGetTickCount64();
+
+    {
+        CProThreadMutexGuard mon(m_lock);
+
+        if (m_observer == NULL)
+        {
+            return;
+        }
+
+        m_requestId2Call.insert(std::make_pair(requestId, info));
+    }
+}
+
+void
+CRpcClientPool::EndCall(CRpcClient*       client,
+                        uint64_t          requestId,
+                        const IRpcPacket* result) /* = NULL */
+{
+    assert(client != NULL);
+
+    int64_t tick = ProGetTickCount64();
+
+    {
+        CProThreadMutexGuard mon(m_lock);
+
+        if (m_observer == NULL)
+        {
+            return;
+        }
+
+        auto itr = m_requestId2Call.lower_bound(requestId);
+        auto end = m_requestId2Call.upper_bound(requestId);
+
+        for (; itr != end; ++itr)
+        {
+            if (itr->second.client == client)
+            {
+                break;
+            }
+        }
+
+        if (itr == end)
+        {
+            return;
+        }
+
+        int64_t sendTick = itr->second.sendTick;
+        m_requestId2Call.erase(itr);
+
+        int i = 0;
+        int c = (int)m_members.size();
+
+        for (; i < c; ++i)
+        {
+            if (m_members[i].client == client)
+            {
+                break;
+            }
+        }
+
+        if (i == c || result == NULL)
+        {
+            return;
+        }
+
+        RPC_POOL_ENDPOINT& endpoint = m_endpoints[m_members[i].endpointIndex];
+        RPC_ERROR_CODE     rpcCode  = result->GetRpcCode();
+
+        if (rpcCode == RPCE_SERVER_BUSY || rpcCode == RPCE_NETWORK_TIMEOUT)
+        {
+            ++endpoint.failures;
+            if (m_configInfo.rpcc_pool_eject_failures > 0 &&
+                endpoint.failures >= m_configInfo.rpcc_pool_eject_failures)
+            {
+                endpoint.failures  = 0;
+                endpoint.ejectTick = tick + m_configInfo.rpcc_pool_eject_time * 1000;
+            }
+        }
+        else if (rpcCode == RPCE_OK)
+        {
+            double latency = (double)(tick - sendTick);
+
+            endpoint.failures = 0;
+            endpoint.latency  = endpoint.latency == 0 ? latency
+                : endpoint.latency * (1 - EWMA_ALPHA) + latency * EWMA_ALPHA;
+
+            m_latencies.push_back(tick - sendTick);
+            if (m_latencies.size() > HEDGE_LATENCY_WINDOW)
+            {
+                m_latencies.pop_front();
+            }
+
+            /*
+             * the delay of the hedged calls is refreshed every 100 samples
+             */
+            if (++m_latencySamples >= 100)
+            {
+                CProStlVector<int64_t> latencies(m_latencies.begin(), m_latencies.end());
+                size_t                 n = latencies.size() *
+                    m_configInfo.rpcc_pool_hedge_percentile / 100;
+
+                std::nth_element(latencies.begin(), latencies.begin() + n, latencies.end());
+                m_hedgeDelay     = latencies[n] > 0 ? latencies[n] : 1;
+                m_latencySamples = 0;
+            }
+        }
+        else
+        {
+        }
+    }
+}
+
+void
+CRpcClientPool::OnCallResult_s(IRpcClient* client,
+                               IRpcPacket* result,
+                               void*       context)
+{
+    RPC_POOL_CALL_CONTEXT* context2 = (RPC_POOL_CALL_CONTEXT*)context;
+    context2->pool->EndCall(context2->client, result->GetRequestId(), result);
+    context2->callback(client, result, context2->context);
+    context2->pool->Release();
+
+    delete context2;
+}
+
+void
+CRpcClientPool::OnFutureResult_s(IRpcFuture* future,
+                                 IRpcPacket* result,
+                                 void*       context)
+{
+    RPC_POOL_CALL_CONTEXT* context2 = (RPC_POOL_CALL_CONTEXT*)context;
+    context2->pool->EndCall(context2->client, result->GetRequestId(), result);
+    context2->pool->Release();
+
+    delete context2;
+}
+
+bool
+CRpcClientPool::IsHedged(IRpcPacket* request) const
+{
+    assert(request != NULL);
+
+    bool hedged = false;
+
+    {
+        CProThreadMutexGuard mon(m_lock);
+
+        if (m_observer == NULL || !m_configInfo.rpcc_pool_hedge ||
+            m_configInfo.rpcc_pool_policy == RPC_PP_HASH || m_members.size() < 2)
+        {
+            return false;
+        }
+
+        auto itr = m_funtionId2Info.find(request->GetFunctionId());
+        if (itr != m_funtionId2Info.end())
+        {
+            hedged = (itr->second.flags & RPC_FF_IDEMPOTENT) != 0;
+        }
+    }
+
+    return hedged;
+}
+
+RPC_ERROR_CODE
+CRpcClientPool::SendHedged(IRpcPacket*         request,
+                           unsigned int        rpcTimeoutInSeconds,
+                           RPC_RESULT_CALLBACK callback,
+                           void*               context,
+                           CRpcFuture*         future)
+{
+    assert(request != NULL);
+
+    uint64_t requestId = request->GetRequestId();
+
+    CRpcClient* client = PickClient(request);
+    if (client == NULL)
+    {
+        return RPCE_ERROR;
+    }
+
+    RPC_POOL_HEDGE* hedge = new RPC_POOL_HEDGE;
+    hedge->pool                = this;
+    hedge->request             = request;
+    hedge->rpcTimeoutInSeconds = rpcTimeoutInSeconds;
+    hedge->callback            = callback;
+    hedge->context             = context;
+    hedge->future              = future;
+    hedge->clients[0]          = client; /* AddRef()ed by PickClient() */
+    hedge->clients[1]          = NULL;
+    hedge->timerId             = 0;
+    hedge->refCount            = 2;
+    hedge->done                = false;
+
+    AddRef();
+    request->AddRef();
+    if (future != NULL)
+    {
+        future->AddRef();
+    }
+
+    {
+        CProThreadMutexGuard mon(m_lock);
+
+        if (m_observer == NULL || m_requestId2Hedge.find(requestId) != m_requestId2Hedge.end())
+        {
+            hedge->refCount = 1;
+            hedge->done     = true;
+        }
+        else
+        {
+            m_requestId2Hedge[requestId] = hedge;
+
+            m_hedgeTokens += m_configInfo.rpcc_pool_hedge_budget / 100.0;
+            if (m_hedgeTokens > HEDGE_MAX_TOKENS)
+            {
+                m_hedgeTokens = HEDGE_MAX_TOKENS;
+            }
+        }
+    }
+
+    if (hedge->done)
+    {
+        ReleaseHedge(hedge);
+
+        return RPCE_ERROR;
+    }
+
+    BeginCall(client, requestId);
+
+    RPC_ERROR_CODE rpcCode = client->SendRpcRequest(
+        request, &CRpcClientPool::OnHedgeResult_s, hedge, rpcTimeoutInSeconds);
+    if (rpcCode != RPCE_OK)
+    {
+        EndCall(client, requestId, NULL);
+
+        {
+            CProThreadMutexGuard mon(m_lock);
+
+            hedge->done = true;
+            m_requestId2Hedge.erase(requestId);
+        }
+
+        ReleaseHedge(hedge); /* the copy */
+    }
+    else
+    {
+        CProThreadMutexGuard mon(m_lock);
+
+        if (m_reactor != NULL && !hedge->done)
+        {
+            hedge->timerId = m_reactor->SetupTimer(this, m_hedgeDelay, 0);
+            m_timerId2RequestId[hedge->timerId] = requestId;
+        }
+    }
+
+    ReleaseHedge(hedge); /* the creator */
+
+    return rpcCode;
+}
+
+int
+CRpcClientPool::PickHedge_i(const CRpcClient* primary) const
+{
+    int64_t tick = ProGetTickCount64();
+
+    /*
+     * another server is preferred
+     */
+    size_t primaryEndpoint = 0;
+
+    for (int i = 0; i < (int)m_members.size(); ++i)
+    {
+        if (m_members[i].client == primary)
+        {
+            primaryEndpoint = m_members[i].endpointIndex;
+            break;
+        }
+    }
+
+    CProStlVector<int> indexes;
+
+    for (int k = 0; k < 2 && indexes.size() == 0; ++k)
+    {
+        for (int i = 0; i < (int)m_members.size(); ++i)
+        {
+            const RPC_POOL_MEMBER& member = m_members[i];
+            if (!member.logon || member.client == primary ||
+                m_endpoints[member.endpointIndex].ejectTick > tick)
+            {
+                continue;
+            }
+
+            if (k == 0 && member.endpointIndex == primaryEndpoint && m_endpoints.size() > 1)
+            {
+                continue;
+            }
+
+            indexes.push_back(i);
+        }
+    }
+
+    return PickLeast_i(indexes);
+}
+
+void
+CRpcClientPool::OnTimer(void*    factory,
+                        uint64_t timerId,
+                        int64_t  tick,
+                        int64_t  userData)
+{
+    assert(factory != NULL);
+    assert(timerId > 0);
+    if (factory == NULL || timerId == 0)
+    {
+        return;
+    }
+
+    uint64_t        requestId = 0;
+    RPC_POOL_HEDGE* hedge     = NULL;
+    CRpcClient*     client    = NULL;
+
+    {
+        CProThreadMutexGuard mon(m_lock);
+
+        if (m_observer == NULL || m_reactor == NULL)
+        {
+            return;
+        }
+
+        auto itr = m_timerId2RequestId.find(timerId);
+        if (itr == m_timerId2RequestId.end())
+        {
+            return;
+        }
+
+        requestId = itr->second;
+        m_reactor->CancelTimer(timerId);
+        m_timerId2RequestId.erase(itr);
+
+        auto itr2 = m_requestId2Hedge.find(requestId);
+        if (itr2 == m_requestId2Hedge.end())
+        {
+            return;
+        }
+
+        hedge = itr2->second;
+        hedge->timerId = 0;
+
+        if (hedge->done || hedge->clients[1] != NULL || m_hedgeTokens < 1)
+        {
+            return;
+        }
+
+        int index = PickHedge_i(hedge->clients[0]);
+        if (index < 0)
+        {
+            return;
+        }
+
+        m_hedgeTokens -= 1;
+
+        client = m_members[index].client;
+        client->AddRef();
+        hedge->clients[1] = client;
+        ++hedge->refCount;
+    }
+
+    BeginCall(client, requestId);
+
+    RPC_ERROR_CODE rpcCode = client->SendRpcRequest(hedge->request,
+        &CRpcClientPool::OnHedgeResult_s, hedge, hedge->rpcTimeoutInSeconds);
+    if (rpcCode != RPCE_OK)
+    {
+        EndCall(client, requestId, NULL);
+        ReleaseHedge(hedge);
+    }
+}
+
+void
+CRpcClientPool::OnHedgeResult(IRpcClient*     client,
+                              IRpcPacket*     result,
+                              RPC_POOL_HEDGE* hedge)
+{
+    assert(client != NULL);
+    assert(result != NULL);
+    assert(hedge != NULL);
+
+    uint64_t requestId = result->GetRequestId();
+
+    EndCall((CRpcClient*)client, requestId, result);
+
+    IRpcClientPoolObserver* observer = NULL;
+    CRpcClient*             other    = NULL;
+    bool                    first    = false;
+
+    {
+        CProThreadMutexGuard mon(m_lock);
+
+        if (!hedge->done)
+        {
+            first       = true;
+            hedge->done = true;
+            m_requestId2Hedge.erase(requestId);
+
+            if (hedge->timerId != 0 && m_reactor != NULL)
+            {
+                m_reactor->CancelTimer(hedge->timerId);
+                m_timerId2RequestId.erase(hedge->timerId);
+                hedge->timerId = 0;
+            }
+
+            other = hedge->clients[0] == client ? hedge->clients[1] : hedge->clients[0];
+            if (other != NULL)
+            {
+                other->AddRef();
+            }
+
+            if (hedge->callback == NULL && hedge->future == NULL && m_observer != NULL)
+            {
+                m_observer->AddRef();
+                observer = m_observer;
+            }
+        }
+    }
+
+    if (first)
+    {
+        if (hedge->callback != NULL)
+        {
+            hedge->callback(client, result, hedge->context);
+        }
+        else if (hedge->future != NULL)
+        {
+            hedge->future->Complete(result);
+        }
+        else if (observer != NULL)
+        {
+            observer->OnRpcResult(this, result);
+            observer->Release();
+        }
+        else
+        {
+        }
+
+        /*
+         * the loser is completed with RPCE_CANCELED and ignored. the server
+         * drops it if it's still queued.
+         */
+        if (other != NULL)
+        {
+            other->CancelRpc(requestId);
+            other->Release();
+        }
+    }
+
+    ReleaseHedge(hedge);
+}
+
+void
+CRpcClientPool::ReleaseHedge(RPC_POOL_HEDGE* hedge)
+{
+    assert(hedge != NULL);
+
+    {
+        CProThreadMutexGuard mon(m_lock);
+
+        if (--hedge->refCount > 0)
+        {
+            return;
+        }
+    }
+
+    hedge->request->Release();
+    if (hedge->future != NULL)
+    {
+        hedge->future->Release();
+    }
+    for (int i = 0; i < 2; ++i)
+    {
+        if (hedge->clients[i] != NULL)
+        {
+            hedge->clients[i]->Release();
+        }
+    }
+
+    delete hedge;
+
+    Release();
+}
+
+void
+CRpcClientPool::OnHedgeResult_s(IRpcClient* client,
+                                IRpcPacket* result,
+                                void*       context)
+{
+    RPC_POOL_HEDGE* hedge = (RPC_POOL_HEDGE*)context;
+    hedge->pool->OnHedgeResult(client, result, hedge);
+}
+
+int
+CRpcClientPool::PickScatter_i(size_t endpointIndex) const
+{
+    int                first = -1;
+    CProStlVector<int> indexes;
+
+    for (int i = 0; i < (int)m_members.size(); ++i)
+    {
+        const RPC_POOL_MEMBER& member = m_members[i];
+        if (member.endpointIndex != endpointIndex)
+        {
+            continue;
+        }
+
+        if (first < 0)
+        {
+            first = i;
+        }
+
+        if (member.logon)
+        {
+            indexes.push_back(i);
+        }
+    }
+
+    /*
+     * each server holds a shard, so an ejected server is still called. if
+     * none of its connections is logged on, the client will report
+     * RPCE_NETWORK_NOT_CONNECTED.
+     */
+    int index = PickLeast_i(indexes);
+
+    return index >= 0 ? index : first;
+}
+
+void
+CRpcClientPool::OnScatterResult(IRpcClient*            client,
+                                IRpcPacket*            result,
+                                RPC_POOL_SCATTER_CALL* call)
+{
+    assert(client != NULL);
+    assert(result != NULL);
+    assert(call != NULL);
+
+    RPC_POOL_SCATTER* gather = call->gather;
+
+    EndCall((CRpcClient*)client, call->requestId, result);
+
+    {
+        CProThreadMutexGuard mon(m_lock);
+
+        call->pending = false;
+    }
+
+    CProStlVector<RPC_POOL_SCATTER_CALL> stragglers;
+
+    if (gather->scatter->Complete(call->index, result))
+    {
+        CProThreadMutexGuard mon(m_lock);
+
+        for (int i = 0; i < (int)gather->calls.size(); ++i)
+        {
+            if (gather->calls[i].pending)
+            {
+                gather->calls[i].client->AddRef();
+                stragglers.push_back(gather->calls[i]);
+            }
+        }
+    }
+
+    /*
+     * the stragglers are completed with RPCE_CANCELED and ignored. the
+     * servers drop them if they're still queued.
+     */
+    int i = 0;
+    int c = (int)stragglers.size();
+
+    for (; i < c; ++i)
+    {
+        stragglers[i].client->CancelRpc(stragglers[i].requestId);
+        stragglers[i].client->Release();
+    }
+
+    ReleaseScatter(gather);
+}
+
+void
+CRpcClientPool::ReleaseScatter(RPC_POOL_SCATTER* gather)
+{
+    assert(gather != NULL);
+
+    {
+        CProThreadMutexGuard mon(m_lock);
+
+        if (--gather->refCount > 0)
+        {
+            return;
+        }
+    }
+
+    for (int i = 0; i < (int)gather->calls.size(); ++i)
+    {
+        gather->calls[i].client->Release();
+    }
+
+    gather->scatter->Release();
+
+    delete gather;
+
+    Release();
+}
+
+void
+CRpcClientPool::OnScatterResult_s(IRpcClient* client,
+                                  IRpcPacket* result,
+                                  void*       context)
+{
+    RPC_POOL_SCATTER_CALL* call = (RPC_POOL_SCATTER_CALL*)context;
+    call->gather->pool->OnScatterResult(client, result, call);
+}
+
+void
+CRpcClientPool::OnLogon(IRpcClient* client,
+                        uint64_t    myClientId,
+                        const char* myPublicIp)
+{
+    assert(client != NULL);
+    if (client == NULL)
+    {
+        return;
+    }
+
+    IRpcClientPoolObserver* observer = NULL;
+
+    {
+        CProThreadMutexGuard mon(m_lock);
+
+        if (m_observer == NULL)
+        {
+            return;
+        }
+
+        for (int i = 0; i < (int)m_members.size(); ++i)
+        {
+            RPC_POOL_MEMBER& member = m_members[i];
+            if (member.client != client || member.logon)
+            {
+                continue;
+            }
+
+            member.logon = true;
+            ++m_logonCount;
+
+            if (m_logonCount == 1)
+            {
+                m_observer->AddRef();
+                observer = m_observer;
+            }
+            break;
+        }
+    }
+
+    if (observer != NULL)
+    {
+        observer->OnLogon(this);
+        observer->Release();
+    }
+}
+
+void
+CRpcClientPool::OnLogoff(IRpcClient* client,
+                         int         errorCode,
+                         int         sslCode,
+                         bool        tcpConnected)
+{
+    assert(client != NULL);
+    if (client == NULL)
+    {
+        return;
+    }
+
+    IRpcClientPoolObserver* observer = NULL;
+
+    {
+        CProThreadMutexGuard mon(m_lock);
+
+        if (m_observer == NULL)
+        {
+            return;
+        }
+
+        int i = 0;
+        int c = (int)m_members.size();
+
+        for (; i < c; ++i)
+        {
+            if (m_members[i].client == client)
+            {
+                break;
+            }
+        }
+
+        if (i == c)
+        {
+            return;
+        }
+
+        RPC_POOL_MEMBER& member = m_members[i];
+        if (member.logon)
+        {
+            member.logon = false;
+            --m_logonCount;
+
+            if (m_logonCount == 0)
+            {
+                m_observer->AddRef();
+                observer = m_observer;
+            }
+        }
+    }
+
+    client->Reconnect();
+
+    if (observer != NULL)
+    {
+        observer->OnLogoff(this, errorCode, sslCode, tcpConnected);
+        observer->Release();
+    }
+}
+
+void
+CRpcClientPool::OnRpcResult(IRpcClient* client,
+                            IRpcPacket* result)
+{
+    assert(client != NULL);
+    assert(result != NULL);
+    if (client == NULL || result == NULL)
+    {
+        return;
+    }
+
+    IRpcClientPoolObserver* observer = NULL;
+
+    {
+        CProThreadMutexGuard mon(m_lock);
+
+        if (m_observer == NULL)
+        {
+            return;
+        }
+
+        m_observer->AddRef();
+        observer = m_observer;
+    }
+
+    EndCall((CRpcClient*)client, result->GetRequestId(), result);
+
+    observer->OnRpcResult(this, result);
+    observer->Release();
+}
+
+void
+CRpcClientPool::OnRecvMsgFromServer(IRpcClient* client,
+                                    const void* buf,
+                                    size_t      size,
+                                    uint16_t    charset)
+{
+    assert(client != NULL);
+    assert(buf != NULL);
+    assert(size > 0);
+    if (client == NULL || buf == NULL || size == 0)
+    {
+        return;
+    }
+
+    IRpcClientPoolObserver* observer = NULL;
+
+    {
+        CProThreadMutexGuard mon(m_lock);
+
+        if (m_observer == NULL)
+        {
+            return;
+        }
+
+        m_observer->AddRef();
+        observer = m_observer;
+    }
+
+    observer->OnRecvMsgFromServer(this, buf, size, charset);
+    observer->Release();
+}
+
+void
+CRpcClientPool::OnRecvMsgFromClient(IRpcClient* client,
+                                    const void* buf,
+                                    size_t      size,
+                                    uint16_t    charset,
+                                    uint64_t    srcClientId)
+{
+}
@@ -0,0 +1,482 @@
+/*
+ * Copyright (C) 2018-2019 Eric Tung <libpronet@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"),
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * This file is part of LibProRpc (https://github.com/libpronet/libprorpc)
+ */
+
+#if !defined(RPC_CLIENT_POOL_H)
+#define RPC_CLIENT_POOL_H
+
+#include "pro_rpc.h"
+#include "rpc_server.h"
+#include "pronet/pro_memory_pool.h"
+#include "pronet/pro_ref_count.h"
+#include "pronet/pro_stl.h"
+#include "pronet/pro_thread_mutex.h"
+#include "pronet/pro_timer_factory.h"
+#include "pronet/pro_z.h"
+#include "pronet/rtp_base.h"
+#include "pronet/rtp_msg.h"
+
+/////////////////////////////////////////////////////////////////////////////
+////
+
+class CRpcClient;
+class CRpcFuture;
+class CRpcScatter;
+
+typedef unsigned char RPC_POOL_POLICY;
+
+static const RPC_POOL_POLICY RPC_PP_RR       = 0; /* round-robin */
+static const RPC_POOL_POLICY RPC_PP_LEAST    = 1; /* least in-flight */
+static const RPC_POOL_POLICY RPC_PP_SIZE     = 2; /* size-aware */
+static const RPC_POOL_POLICY RPC_PP_P2C      = 3; /* two choices, in-flight */
+static const RPC_POOL_POLICY RPC_PP_P2C_EWMA = 4; /* two choices, latency */
+static const RPC_POOL_POLICY RPC_PP_HASH     = 5; /* consistent hash */
+
+struct RPC_CLIENT_POOL_CONFIG_INFO
+{
+    RPC_CLIENT_POOL_CONFIG_INFO()
+    {
+        rpcc_pool_connections      = 4;
+        rpcc_pool_policy           = RPC_PP_RR;
+        rpcc_pool_big_bytes        = 1024 * 1024;
+        rpcc_pool_eject_failures   = 5;
+        rpcc_pool_eject_time       = 30;
+        rpcc_pool_hash_vnodes      = 160;
+        rpcc_pool_hedge            = false;
+        rpcc_pool_hedge_percentile = 95;
+        rpcc_pool_hedge_budget     = 5;
+    }
+
+    unsigned int    rpcc_pool_connections;      /* 1 ~ 100 */
+    RPC_POOL_POLICY rpcc_pool_policy;
+    unsigned int    rpcc_pool_big_bytes;
+    unsigned int    rpcc_pool_eject_failures;   /* 0 for disabled */
+    unsigned int    rpcc_pool_eject_time;       /* 1 ~ 3600 */
+    unsigned int    rpcc_pool_hash_vnodes;      /* 1 ~ 1000 */
+    bool            rpcc_pool_hedge;
+    unsigned int    rpcc_pool_hedge_percentile; /* 50 ~ 99 */
+    unsigned int    rpcc_pool_hedge_budget;     /* 1 ~ 100, in percent */
+
+    DECLARE_SGI_POOL(0)
+};
+
+struct RPC_POOL_ENDPOINT
+{
+    RPC_POOL_ENDPOINT()
+    {
+        serverPort = 0;
+        latency    = 0;
+        failures   = 0;
+        ejectTick  = 0;
+    }
+
+    CProStlString  serverIp;
+    unsigned short serverPort;
+    double         latency;   /* EWMA, in milliseconds */
+    unsigned int   failures;  /* consecutive busy/timeout results */
+    int64_t        ejectTick; /* ejected until */
+
+    DECLARE_SGI_POOL(0)
+};
+
+struct RPC_POOL_MEMBER
+{
+    RPC_POOL_MEMBER()
+    {
+        client        = NULL;
+        endpointIndex = 0;
+        lane          = 0;
+        logon         = false;
+    }
+
+    CRpcClient* client;
+    size_t      endpointIndex;
+    size_t      lane; /* 0 for the lane of the big payloads */
+    bool        logon;
+
+    DECLARE_SGI_POOL(0)
+};
+
+struct RPC_POOL_CALL_INFO
+{
+    CRpcClient* client;
+    int64_t     sendTick;
+
+    DECLARE_SGI_POOL(0)
+};
+
+class CRpcClientPool;
+
+/*
+ * a hedged call. the first result wins, and the other copy is dropped.
+ */
+struct RPC_POOL_HEDGE
+{
+    CRpcClientPool*     pool;
+    IRpcPacket*         request;
+    unsigned int        rpcTimeoutInSeconds;
+    RPC_RESULT_CALLBACK callback; /* NULL for the future or the observer */
+    void*               context;
+    CRpcFuture*         future;   /* NULL for the callback or the observer */
+    CRpcClient*         clients[2];
+    uint64_t            timerId;
+    unsigned long       refCount; /* the creator and each copy */
+    bool                done;
+
+    DECLARE_SGI_POOL(0)
+};
+
+struct RPC_POOL_SCATTER;
+
+struct RPC_POOL_SCATTER_CALL
+{
+    RPC_POOL_SCATTER* gather;
+    size_t            index;
+    CRpcClient*       client;
+    uint64_t          requestId;
+    bool              pending;
+
+    DECLARE_SGI_POOL(0)
+};
+
+/*
+ * a scatter-gather call. the calls still in flight are canceled when the
+ * scatter is ready.
+ */
+struct RPC_POOL_SCATTER
+{
+    CRpcClientPool*                      pool;
+    CRpcScatter*                         scatter;
+    CProStlVector<RPC_POOL_SCATTER_CALL> calls;
+    unsigned long                        refCount; /* the creator and each call */
+
+    DECLARE_SGI_POOL(0)
+};
+
+struct RPC_POOL_CALL_CONTEXT
+{
+    CRpcClientPool*     pool;
+    CRpcClient*         client;
+    RPC_RESULT_CALLBACK callback; /* NULL for the future */
+    void*               context;
+
+    DECLARE_SGI_POOL(0)
+};
+
+/////////////////////////////////////////////////////////////////////////////
+////
+
+class CRpcClientPool
+:
+public IRpcClientPool,
+public IRpcClientObserver,
+public IProOnTimer,
+public CProRefCount
+{
+public:
+
+    static CRpcClientPool* CreateInstance();
+
+    bool Init(
+        IRpcClientPoolObserver* observer,
+        IProReactor*            reactor,
+        const char*             argv0,      /* = NULL */
+        const char*             configFileName,
+        RTP_MM_TYPE             mmType,     /* = 0 */
+        const char**            serverIps,
+        const unsigned short*   serverPorts,
+        size_t                  serverCount,
+        const RTP_MSG_USER*     user,       /* = NULL */
+        const char*             password,   /* = NULL */
+        const char*             localIp     /* = NULL */
+        );
+
+    void Fini();
+
+    virtual unsigned long AddRef();
+
+    virtual unsigned long Release();
+
+    virtual RTP_MM_TYPE GetMmType() const;
+
+    virtual size_t GetClientCount() const;
+
+    virtual IRpcClient* GetClient(size_t index) const;
+
+    virtual size_t GetLogonCount() const;
+
+    virtual size_t GetServerCount() const;
+
+    virtual const char* GetServerIp(
+        size_t index,
+        char   serverIp[64]
+        ) const;
+
+    virtual unsigned short GetServerPort(size_t index) const;
+
+    virtual RPC_ERROR_CODE RegisterFunction(
+        uint32_t             functionId,
+        const RPC_DATA_TYPE* callArgTypes, /* = NULL */
+        size_t               callArgCount, /* = 0 */
+        const RPC_DATA_TYPE* retnArgTypes, /* = NULL */
+        size_t               retnArgCount  /* = 0 */
+        );
+
+    virtual RPC_ERROR_CODE RegisterFunction2(
+        uint32_t             functionId,
+        const RPC_DATA_TYPE* callArgTypes,  /* = NULL */
+        size_t               callArgCount,  /* = 0 */
+        const RPC_DATA_TYPE* retnArgTypes,  /* = NULL */
+        size_t               retnArgCount,  /* = 0 */
+        uint32_t             functionFlags  /* = 0 */
+        );
+
+    virtual void UnregisterFunction(uint32_t functionId);
+
+    virtual void SetBulkFunction(
+        uint32_t functionId,
+        bool     bulk
+        );
+
+    virtual void SetHashArgument(
+        uint32_t functionId,
+        int      argIndex
+        );
+
+    virtual bool AddServer(
+        const char*    serverIp,
+        unsigned short serverPort
+        );
+
+    virtual void RemoveServer(
+        const char*    serverIp,
+        unsigned short serverPort
+        );
+
+    virtual RPC_ERROR_CODE SendRpcRequest(
+        IRpcPacket*  request,
+        bool         noreply,            /* = false */
+        unsigned int rpcTimeoutInSeconds /* = 0 */
+        );
+
+    virtual RPC_ERROR_CODE SendRpcRequest(
+        IRpcPacket*         request,
+        RPC_RESULT_CALLBACK callback,
+        void*               context,
+        unsigned int        rpcTimeoutInSeconds /* = 0 */
+        );
+
+    virtual IRpcFuture* CallAsync(
+        IRpcPacket*  request,
+        unsigned int rpcTimeoutInSeconds /* = 0 */
+        );
+
+    virtual RPC_ERROR_CODE CallSync(
+        IRpcPacket*  request,
+        IRpcPacket** result,
+        unsigned int rpcTimeoutInSeconds /* = 0 */
+        );
+
+    virtual IRpcScatter* CallScatter(
+        IRpcPacket** requests,
+        size_t       count,
+        size_t       quorum,             /* = 0 */
+        unsigned int rpcTimeoutInSeconds /* = 0 */
+        );
+
+    virtual bool CancelRpc(uint64_t requestId);
+
+    virtual void Flush();
+
+private:
+
+    CRpcClientPool();
+
+    virtual ~CRpcClientPool();
+
+    virtual void OnLogon(
+        IRpcClient* client,
+        uint64_t    myClientId,
+        const char* myPublicIp
+        );
+
+    virtual void OnLogoff(
+        IRpcClient* client,
+        int         errorCode,
+        int         sslCode,
+        bool        tcpConnected
+        );
+
+    virtual void OnRpcResult(
+        IRpcClient* client,
+        IRpcPacket* result
+        );
+
+    virtual void OnRecvMsgFromServer(
+        IRpcClient* client,
+        const void* buf,
+        size_t      size,
+        uint16_t    charset
+        );
+
+    virtual void OnRecvMsgFromClient(
+        IRpcClient* client,
+        const void* buf,
+        size_t      size,
+        uint16_t    charset,
+        uint64_t    srcClientId
+        );
+
+    virtual void OnTimer(
+        void*    factory,
+        uint64_t timerId,
+        int64_t  tick,
+        int64_t  userData
+        );
+
+    bool AddServer_i(
+        const char*    serverIp,
+        unsigned short serverPort
+        );
+
+    int FindServer_i(
+        const char*    serverIp,
+        unsigned short serverPort
+        ) const;
+
+    void RebuildRing_i();
+
+    CRpcClient* PickClient(IRpcPacket* request);
+
+    int PickIndex_i(
+        IRpcPacket* request,
+        int64_t     tick
+        );
+
+    int PickHash_i(
+        IRpcPacket*               request,
+        const CProStlVector<int>& indexes
+        ) const;
+
+    int PickLeast_i(const CProStlVector<int>& indexes) const;
+
+    int PickTwo_i(const CProStlVector<int>& indexes) const;
+
+    double GetCost_i(int index) const;
+
+    void BeginCall(
+        CRpcClient* client,
+        uint64_t    requestId
+        );
+
+    void EndCall(
+        CRpcClient*       client,
+        uint64_t          requestId,
+        const IRpcPacket* result /* = NULL */
+        );
+
+    static void OnCallResult_s(
+        IRpcClient* client,
+        IRpcPacket* result,
+        void*       context
+        );
+
+    static void OnFutureResult_s(
+        IRpcFuture* future,
+        IRpcPacket* result,
+        void*       context
+        );
+
+    bool IsHedged(IRpcPacket* request) const;
+
+    RPC_ERROR_CODE SendHedged(
+        IRpcPacket*         request,
+        unsigned int        rpcTimeoutInSeconds,
+        RPC_RESULT_CALLBACK callback,
+        void*               context,
+        CRpcFuture*         future
+        );
+
+    int PickHedge_i(const CRpcClient* primary) const;
+
+    void OnHedgeResult(
+        IRpcClient*     client,
+        IRpcPacket*     result,
+        RPC_POOL_HEDGE* hedge
+        );
+
+    void ReleaseHedge(RPC_POOL_HEDGE* hedge);
+
+    static void OnHedgeResult_s(
+        IRpcClient* client,
+        IRpcPacket* result,
+        void*       context
+        );
+
+    int PickScatter_i(size_t endpointIndex) const;
+
+    void OnScatterResult(
+        IRpcClient*            client,
+        IRpcPacket*            result,
+        RPC_POOL_SCATTER_CALL* call
+        );
+
+    void ReleaseScatter(RPC_POOL_SCATTER* gather);
+
+    static void OnScatterResult_s(
+        IRpcClient* client,
+        IRpcPacket* result,
+        void*       context
+        );
+
+private:
+
+    IRpcClientPoolObserver*                       m_observer;
+    IProReactor*                                  m_reactor;
+    CProStlString                                 m_argv0;
+    CProStlString                                 m_configFileName;
+    RTP_MM_TYPE                                   m_mmType;
+    bool                                          m_hasUser;
+    RTP_MSG_USER                                  m_user;
+    CProStlString                                 m_password;
+    CProStlString                                 m_localIp;
+    RPC_CLIENT_POOL_CONFIG_INFO                   m_configInfo;
+    CProStlVector<RPC_POOL_ENDPOINT>              m_endpoints;
+    CProStlVector<RPC_POOL_MEMBER>                m_members;
+    CProStlMap<uint64_t, size_t>                  m_hashRing; /* point ==> endpoint */
+    CProStlMap<uint32_t, int>                     m_hashArgs; /* function ==> argument */
+    CProStlMap<uint32_t, RPC_FUNCTION_INFO>       m_funtionId2Info;
+    CProStlSet<uint32_t>                          m_bulkFunctionIds;
+    CProStlMultimap<uint64_t, RPC_POOL_CALL_INFO> m_requestId2Call;
+    CProStlMap<uint64_t, RPC_POOL_HEDGE*>         m_requestId2Hedge;
+    CProStlMap<uint64_t, uint64_t>                m_timerId2RequestId;
+    CProStlDeque<int64_t>                         m_latencies;
+    size_t                                        m_latencySamples;
+    int64_t                                       m_hedgeDelay;
+    double                                        m_hedgeTokens;
+    size_t                                        m_logonCount;
+    size_t                                        m_nextIndex;
+    size_t                                        m_nextInstId;
+    mutable CProThreadMutex                       m_lock;
+
+    DECLARE_SGI_POOL(0)
+};
+
+/////////////////////////////////////////////////////////////////////////////
+////
+
+#endif /* RPC_CLIENT_POOL_H */
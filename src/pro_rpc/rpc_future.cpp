@@ -0,0 +1,200 @@
+/*
+ * Copyright (C) 2018-2019 Eric Tung <libpronet@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"),
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * This file is part of LibProRpc (https://github.com/libpronet/libprorpc)
+ */
+
+#include "rpc_future.h"
+#include "pro_rpc.h"
+#include "pronet/pro_memory_pool.h"
+#include "pronet/pro_ref_count.h"
+#include "pronet/pro_stl.h"
+#include "pronet/pro_thread_mutex.h"
+#include "pronet/pro_time_util.h"
+#include "pronet/pro_z.h"
+
+/////////////////////////////////////////////////////////////////////////////
+////
+
+CRpcFuture*
+CRpcFuture::CreateInstance(uint64_t requestId)
+{
+    return new CRpcFuture(requestId);
+}
+
+CRpcFuture::CRpcFuture(uint64_t requestId)
+: m_requestId(requestId)
+{
+    m_result = NULL;
+}
+
+CRpcFuture::~CRpcFuture()
+{
+    if (m_result != NULL)
+    {
+        m_result->Release();
+        m_result = NULL;
+    }
+}
+
+unsigned long
+CRpcFuture::AddRef()
+{
+    return CProRefCount::AddRef();
+}
+
+unsigned long
+CRpcFuture::Release()
+{
+    return CProRefCount::Release();
+}
+
+uint64_t
+CRpcFuture::GetRequestId() const
+{
+    return m_requestId;
+}
+
+bool
+CRpcFuture::IsReady() const
+{
+    bool ready = false;
+
+    {
+        CProThreadMutexGuard mon(m_lock);
+
+        ready = m_result != NULL;
+    }
+
+    return ready;
+}
+
+bool
+CRpcFuture::WaitFor(unsigned int timeoutInMilliseconds)
+{
+    int64_t deadline = ProGetTickCount64() + timeoutInMilliseconds;
+
+    m_lock.Lock();
+
+    while (m_result == NULL)
+    {
+        int64_t tick = ProGetTickCount64();
+        if (timeoutInMilliseconds != (unsigned int)-1 && tick >= deadline)
+        {
+            break;
+        }
+
+        unsigned int waitTime = 1000;
+        if (timeoutInMilliseconds != (unsigned int)-1 && deadline - tick < waitTime)
+        {
+            waitTime = (unsigned int)(deadline - tick);
+        }
+
+        m_cond.Waittime(&m_lock, waitTime);
+    }
+
+    bool ready = m_result != NULL;
+
+    m_lock.Unlock();
+
+    if (ready)
+    {
+        m_cond.Signal(); /* wake up the next waiter */
+    }
+
+    return ready;
+}
+
+IRpcPacket*
+CRpcFuture::GetResult() const
+{
+    IRpcPacket* result = NULL;
+
+    {
+        CProThreadMutexGuard mon(m_lock);
+
+        result = m_result;
+    }
+
+    return result;
+}
+
+void
+CRpcFuture::Then(RPC_FUTURE_CALLBACK callback,
+                 void*               context)
+{
+    assert(callback != NULL);
+    if (callback == NULL)
+    {
+        return;
+    }
+
+    IRpcPacket* result = NULL;
+
+    {
+        CProThreadMutexGuard mon(m_lock);
+
+        if (m_result == NULL)
+        {
+            RPC_FUTURE_CALLBACK_INFO info;
+            info.callback = callback;
+            info.context  = context;
+            m_callbacks.push_back(info);
+
+            return;
+        }
+
+        m_result->AddRef();
+        result = m_result;
+    }
+
+    callback(this, result, context);
+    result->Release();
+}
+
+void
+CRpcFuture::Complete(IRpcPacket* result)
+{
+    assert(result != NULL);
+    if (result == NULL)
+    {
+        return;
+    }
+
+    CProStlVector<RPC_FUTURE_CALLBACK_INFO> callbacks;
+
+    {
+        CProThreadMutexGuard mon(m_lock);
+
+        if (m_result != NULL)
+        {
+            return;
+        }
+
+        result->AddRef();
+        m_result = result;
+        callbacks.swap(m_callbacks);
+    }
+
+    m_cond.Signal();
+
+    int i = 0;
+    int c = (int)callbacks.size();
+
+    for (; i < c; ++i)
+    {
+        callbacks[i].callback(this, result, callbacks[i].context);
+    }
+}
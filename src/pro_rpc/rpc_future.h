@@ -0,0 +1,91 @@
+/*
+ * Copyright (C) 2018-2019 Eric Tung <libpronet@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"),
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * This file is part of LibProRpc (https://github.com/libpronet/libprorpc)
+ */
+
+#if !defined(RPC_FUTURE_H)
+#define RPC_FUTURE_H
+
+#include "pro_rpc.h"
+#include "pronet/pro_memory_pool.h"
+#include "pronet/pro_ref_count.h"
+#include "pronet/pro_stl.h"
+#include "pronet/pro_thread_mutex.h"
+#include "pronet/pro_z.h"
+
+/////////////////////////////////////////////////////////////////////////////
+////
+
+struct RPC_FUTURE_CALLBACK_INFO
+{
+    RPC_FUTURE_CALLBACK callback;
+    void*               context;
+
+    DECLARE_SGI_POOL(0)
+};
+
+/////////////////////////////////////////////////////////////////////////////
+////
+
+class CRpcFuture : public IRpcFuture, public CProRefCount
+{
+public:
+
+    static CRpcFuture* CreateInstance(uint64_t requestId);
+
+    virtual unsigned long AddRef();
+
+    virtual unsigned long Release();
+
+    virtual uint64_t GetRequestId() const;
+
+    virtual bool IsReady() const;
+
+    virtual bool WaitFor(unsigned int timeoutInMilliseconds);
+
+    virtual IRpcPacket* GetResult() const;
+
+    virtual void Then(
+        RPC_FUTURE_CALLBACK callback,
+        void*               context
+        );
+
+    /*
+     * only the first call takes effect
+     */
+    void Complete(IRpcPacket* result);
+
+private:
+
+    CRpcFuture(uint64_t requestId);
+
+    virtual ~CRpcFuture();
+
+private:
+
+    const uint64_t                          m_requestId;
+    IRpcPacket*                             m_result;
+    CProStlVector<RPC_FUTURE_CALLBACK_INFO> m_callbacks;
+    CProThreadMutexCondition                m_cond;
+    mutable CProThreadMutex                 m_lock;
+
+    DECLARE_SGI_POOL(0)
+};
+
+/////////////////////////////////////////////////////////////////////////////
+////
+
+#endif /* RPC_FUTURE_H */
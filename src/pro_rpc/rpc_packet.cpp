@@ -30,6 +30,10 @@
 ////
 
 static const char      g_s_signature[8]  = "***PRPC";
+static const char      g_s_signature2[8] = "***PRPB"; /* batch */
+static const char      g_s_signature3[8] = "***PRPX"; /* control */
+static const char      g_s_signature4[8] = "***PRPL"; /* pipeline */
+static const char      g_s_creditsMark   = (char)0xC5;
 static uint64_t        g_s_nextRequestId = 1;
 static CProThreadMutex g_s_lock;
 
@@ -475,6 +479,274 @@ CRpcPacket::ParseRpcPacket(const void*                  buffer,
     return ret;
 }
 
+static
+bool
+MakeBatch_i(const char*              signature,
+            const IRpcPacket* const* packets,
+            size_t                   count,
+            const RPC_PIPELINE_REF*  refs,     /* = NULL */
+            size_t                   refCount, /* = 0 */
+            CProBuffer&              batch)
+{
+    batch.Free();
+
+    assert(packets != NULL);
+    assert(count > 0);
+    if (packets == NULL || count == 0 || (refs == NULL && refCount > 0))
+    {
+        return false;
+    }
+
+    size_t totalSize = sizeof(RPC_BATCH_HDR) + sizeof(RPC_PIPELINE_REF) * refCount;
+
+    for (int i = 0; i < (int)count; ++i)
+    {
+        assert(packets[i] != NULL);
+        if (packets[i] == NULL || packets[i]->GetTotalSize() == 0)
+        {
+            return false;
+        }
+
+        totalSize += sizeof(RPC_BATCH_ITEM_HDR);
+        totalSize += (packets[i]->GetTotalSize() + 7) / 8 * 8;
+    }
+
+    if (!batch.Resize(totalSize))
+    {
+        return false;
+    }
+
+    char* now = (char*)batch.Data();
+    memset(now, 0, totalSize);
+
+    {
+        RPC_BATCH_HDR hdr;
+        memset(&hdr, 0, sizeof(RPC_BATCH_HDR));
+        strncpy_pro(hdr.signature, sizeof(hdr.signature), signature);
+        hdr.count    = pbsd_hton32((uint32_t)count);
+        hdr.reserved = pbsd_hton32((uint32_t)refCount);
+
+        memcpy(now, &hdr, sizeof(RPC_BATCH_HDR));
+        now += sizeof(RPC_BATCH_HDR);
+    }
+
+    for (int j = 0; j < (int)refCount; ++j)
+    {
+        RPC_PIPELINE_REF ref;
+        ref.callIndex   = pbsd_hton16(refs[j].callIndex);
+        ref.argIndex    = pbsd_hton16(refs[j].argIndex);
+        ref.resultIndex = pbsd_hton16(refs[j].resultIndex);
+        ref.resultArg   = pbsd_hton16(refs[j].resultArg);
+
+        memcpy(now, &ref, sizeof(RPC_PIPELINE_REF));
+        now += sizeof(RPC_PIPELINE_REF);
+    }
+
+    for (int k = 0; k < (int)count; ++k)
+    {
+        size_t size = packets[k]->GetTotalSize();
+
+        RPC_BATCH_ITEM_HDR itemHdr;
+        itemHdr.size     = pbsd_hton32((uint32_t)size);
+        itemHdr.reserved = 0;
+
+        memcpy(now, &itemHdr, sizeof(RPC_BATCH_ITEM_HDR));
+        now += sizeof(RPC_BATCH_ITEM_HDR);
+
+        memcpy(now, packets[k]->GetTotalBuffer(), size);
+        now += (size + 7) / 8 * 8;
+    }
+
+    return true;
+}
+
+static
+bool
+ParseBatch_i(const char*                      signature,
+             const void*                      buffer,
+             size_t                           size,
+             CProStlVector<RPC_BATCH_ITEM>&   items,
+             CProStlVector<RPC_PIPELINE_REF>* refs) /* = NULL */
+{
+    items.clear();
+    if (refs != NULL)
+    {
+        refs->clear();
+    }
+
+    assert(buffer != NULL);
+    assert(size > 0);
+    if (buffer == NULL || size < sizeof(RPC_BATCH_HDR))
+    {
+        return false;
+    }
+
+    const char* now = (char*)buffer;
+    const char* end = now + size;
+
+    RPC_BATCH_HDR hdr;
+    memcpy(&hdr, now, sizeof(RPC_BATCH_HDR));
+    now += sizeof(RPC_BATCH_HDR);
+
+    hdr.count    = pbsd_ntoh32(hdr.count);
+    hdr.reserved = pbsd_ntoh32(hdr.reserved);
+
+    if (strncmp(hdr.signature, signature, sizeof(hdr.signature)) != 0 ||
+        hdr.count == 0)
+    {
+        return false;
+    }
+
+    /*
+     * the references of a pipeline
+     */
+    if (refs != NULL)
+    {
+        if ((size_t)(end - now) / sizeof(RPC_PIPELINE_REF) < hdr.reserved)
+        {
+            return false;
+        }
+
+        for (int i = 0; i < (int)hdr.reserved; ++i)
+        {
+            RPC_PIPELINE_REF ref;
+            memcpy(&ref, now, sizeof(RPC_PIPELINE_REF));
+            now += sizeof(RPC_PIPELINE_REF);
+
+            ref.callIndex   = pbsd_ntoh16(ref.callIndex);
+            ref.argIndex    = pbsd_ntoh16(ref.argIndex);
+            ref.resultIndex = pbsd_ntoh16(ref.resultIndex);
+            ref.resultArg   = pbsd_ntoh16(ref.resultArg);
+            refs->push_back(ref);
+        }
+    }
+
+    for (int j = 0; j < (int)hdr.count; ++j)
+    {
+        if ((size_t)(end - now) < sizeof(RPC_BATCH_ITEM_HDR))
+        {
+            break;
+        }
+
+        RPC_BATCH_ITEM_HDR itemHdr;
+        memcpy(&itemHdr, now, sizeof(RPC_BATCH_ITEM_HDR));
+        now += sizeof(RPC_BATCH_ITEM_HDR);
+
+        itemHdr.size = pbsd_ntoh32(itemHdr.size);
+
+        size_t bodySize = ((size_t)itemHdr.size + 7) / 8 * 8;
+        if (itemHdr.size == 0 || (size_t)(end - now) < bodySize)
+        {
+            break;
+        }
+
+        RPC_BATCH_ITEM item;
+        item.buffer = now;
+        item.size   = itemHdr.size;
+        items.push_back(item);
+
+        now += bodySize;
+    }
+
+    if (items.size() != hdr.count)
+    {
+        items.clear();
+        if (refs != NULL)
+        {
+            refs->clear();
+        }
+
+        return false;
+    }
+
+    return true;
+}
+
+/*
+ * <RPC_BATCH_HDR> + <RPC_BATCH_ITEM_HDR> + packet + [padding] + ...
+ */
+bool
+CRpcPacket::MakeRpcBatch(const IRpcPacket* const* packets,
+                         size_t                   count,
+                         CProBuffer&              batch)
+{
+    return MakeBatch_i(g_s_signature2, packets, count, NULL, 0, batch);
+}
+
+bool
+CRpcPacket::ParseRpcBatch(const void*                    buffer,
+                          size_t                         size,
+                          CProStlVector<RPC_BATCH_ITEM>& items)
+{
+    return ParseBatch_i(g_s_signature2, buffer, size, items, NULL);
+}
+
+/*
+ * <RPC_BATCH_HDR> + <RPC_PIPELINE_REF> * n + <RPC_BATCH_ITEM_HDR> + packet +
+ * [padding] + ...
+ */
+bool
+CRpcPacket::MakeRpcPipeline(const IRpcPacket* const* packets,
+                            size_t                   count,
+                            const RPC_PIPELINE_REF*  refs,     /* = NULL */
+                            size_t                   refCount, /* = 0 */
+                            CProBuffer&              pipeline)
+{
+    return MakeBatch_i(g_s_signature4, packets, count, refs, refCount, pipeline);
+}
+
+bool
+CRpcPacket::ParseRpcPipeline(const void*                      buffer,
+                             size_t                           size,
+                             CProStlVector<RPC_BATCH_ITEM>&   items,
+                             CProStlVector<RPC_PIPELINE_REF>& refs)
+{
+    return ParseBatch_i(g_s_signature4, buffer, size, items, &refs);
+}
+
+void
+CRpcPacket::MakeRpcCtrl(uint32_t      ctrlType,
+                        uint32_t      functionId,
+                        uint64_t      param,
+                        RPC_CTRL_HDR& ctrl)
+{
+    memset(&ctrl, 0, sizeof(RPC_CTRL_HDR));
+    strncpy_pro(ctrl.signature, sizeof(ctrl.signature), g_s_signature3);
+    ctrl.ctrlType   = pbsd_hton32(ctrlType);
+    ctrl.functionId = pbsd_hton32(functionId);
+    ctrl.param      = pbsd_hton64(param);
+}
+
+bool
+CRpcPacket::ParseRpcCtrl(const void*   buffer,
+                         size_t        size,
+                         RPC_CTRL_HDR& ctrl)
+{
+    memset(&ctrl, 0, sizeof(RPC_CTRL_HDR));
+
+    assert(buffer != NULL);
+    assert(size > 0);
+    if (buffer == NULL || size != sizeof(RPC_CTRL_HDR))
+    {
+        return false;
+    }
+
+    memcpy(&ctrl, buffer, sizeof(RPC_CTRL_HDR));
+
+    if (strncmp(ctrl.signature, g_s_signature3, sizeof(ctrl.signature)) != 0)
+    {
+        memset(&ctrl, 0, sizeof(RPC_CTRL_HDR));
+
+        return false;
+    }
+
+    ctrl.ctrlType   = pbsd_ntoh32(ctrl.ctrlType);
+    ctrl.functionId = pbsd_ntoh32(ctrl.functionId);
+    ctrl.param      = pbsd_ntoh64(ctrl.param);
+
+    return true;
+}
+
 CRpcPacket::CRpcPacket(uint64_t requestId,
                        uint32_t functionId,
                        bool     convertByteOrder) /* = false */
@@ -483,6 +755,7 @@ CRpcPacket::CRpcPacket(uint64_t requestId,
     m_clientId             = 0;
     m_magic1               = 0;
     m_magic2               = 0;
+    m_cancelled            = false;
 
     memset(&m_hdr, 0, sizeof(RPC_HDR));
     m_hdr.requestId        = requestId;
@@ -606,6 +879,51 @@ CRpcPacket::GetTimeout() const
     return m_hdr.timeoutInSeconds;
 }
 
+void
+CRpcPacket::SetCredits(unsigned int credits)
+{
+    if (credits > 65535)
+    {
+        credits = 65535;
+    }
+
+    m_hdr.reserved[0] = g_s_creditsMark;
+    m_hdr.reserved[1] = (char)(credits >> 8);
+    m_hdr.reserved[2] = (char)credits;
+
+    if (m_buffer.Size() >= sizeof(RPC_HDR))
+    {
+        RPC_HDR* hdr = (RPC_HDR*)m_buffer.Data();
+        memcpy(hdr->reserved, m_hdr.reserved, sizeof(hdr->reserved));
+    }
+}
+
+void
+CRpcPacket::SetPriority(RPC_PRIORITY priority)
+{
+    if (priority > RPC_PRI_INTERACTIVE)
+    {
+        priority = RPC_PRI_INTERACTIVE;
+    }
+
+    /*
+     * 0 on the wire is RPC_PRI_NORMAL, for the old clients
+     */
+    m_hdr.reserved[0] = (char)(priority + 1);
+
+    if (m_buffer.Size() >= sizeof(RPC_HDR))
+    {
+        RPC_HDR* hdr = (RPC_HDR*)m_buffer.Data();
+        hdr->reserved[0] = m_hdr.reserved[0];
+    }
+}
+
+RPC_PRIORITY
+CRpcPacket::GetPriority() const
+{
+    return GetRpcPriority(m_hdr);
+}
+
 size_t
 CRpcPacket::GetArgumentCount() const
 {
@@ -712,6 +1030,18 @@ CRpcPacket::GetMagicStr() const
     return m_magicStr.c_str();
 }
 
+void
+CRpcPacket::SetCancelled(bool cancelled)
+{
+    m_cancelled = cancelled;
+}
+
+bool
+CRpcPacket::IsCancelled() const
+{
+    return m_cancelled;
+}
+
 void
 CRpcPacket::CleanAndBeginPushArgument()
 {
@@ -836,13 +1166,14 @@ CRpcPacket::EndPushArgument()
 
     {
         RPC_HDR hdr;
-        memset(&hdr, 0, sizeof(sizeof(RPC_HDR)));
+        memset(&hdr, 0, sizeof(RPC_HDR));
         strncpy_pro(hdr.signature, sizeof(hdr.signature), g_s_signature);
         hdr.requestId        = pbsd_hton64(m_hdr.requestId);
         hdr.functionId       = pbsd_hton32(m_hdr.functionId);
         hdr.rpcCode          = pbsd_hton32(m_hdr.rpcCode);
         hdr.noreply          = m_hdr.noreply;
         hdr.timeoutInSeconds = pbsd_hton32(m_hdr.timeoutInSeconds);
+        memcpy(hdr.reserved, m_hdr.reserved, sizeof(hdr.reserved));
 
         memcpy(now, &hdr, sizeof(RPC_HDR));
         now += sizeof(RPC_HDR);
@@ -1107,3 +1438,103 @@ CmpRpcPacketTypes(const IRpcPacket*                   packet,
 
     return ret;
 }
+
+uint64_t
+CalcRpcHash(const void* buf,
+            size_t      size,
+            uint64_t    hash) /* = RPC_HASH_SEED */
+{
+    const unsigned char* p = (const unsigned char*)buf;
+
+    for (size_t i = 0; i < size; ++i)
+    {
+        hash ^= p[i];
+        hash *= 0x100000001B3ULL;
+    }
+
+    return hash;
+}
+
+uint64_t
+CalcRpcArgumentHash(const RPC_ARGUMENT& arg,
+                    uint64_t            hash) /* = RPC_HASH_SEED */
+{
+    hash = CalcRpcHash(&arg.type, sizeof(RPC_DATA_TYPE), hash);
+
+    size_t itemSize = 0;
+
+    switch (arg.type)
+    {
+    case RPC_DT_BOOL8ARRAY:
+    case RPC_DT_INT8ARRAY:
+    case RPC_DT_UINT8ARRAY:
+        itemSize = 1;
+        break;
+    case RPC_DT_INT16ARRAY:
+    case RPC_DT_UINT16ARRAY:
+        itemSize = 2;
+        break;
+    case RPC_DT_INT32ARRAY:
+    case RPC_DT_UINT32ARRAY:
+    case RPC_DT_FLOAT32ARRAY:
+        itemSize = 4;
+        break;
+    case RPC_DT_INT64ARRAY:
+    case RPC_DT_UINT64ARRAY:
+    case RPC_DT_FLOAT64ARRAY:
+        itemSize = 8;
+        break;
+    default:
+        return CalcRpcHash(&arg.uint64Value, sizeof(uint64_t), hash);
+    }
+
+    if (arg.countForArray == 0 || arg.uint8Values == NULL)
+    {
+        return hash;
+    }
+
+    return CalcRpcHash(arg.uint8Values, itemSize * arg.countForArray, hash);
+}
+
+uint64_t
+CalcRpcCacheKey(uint32_t            functionId,
+                const RPC_ARGUMENT* args,
+                size_t              count)
+{
+    uint64_t hash = CalcRpcHash(&functionId, sizeof(uint32_t), RPC_HASH_SEED);
+
+    for (int i = 0; i < (int)count; ++i)
+    {
+        hash = CalcRpcArgumentHash(args[i], hash);
+    }
+
+    if (hash == 0)
+    {
+        hash = 1;
+    }
+
+    return hash;
+}
+
+int
+GetRpcCredits(const RPC_HDR& hdr)
+{
+    if (hdr.reserved[0] != g_s_creditsMark)
+    {
+        return -1;
+    }
+
+    return ((int)(unsigned char)hdr.reserved[1] << 8) | (int)(unsigned char)hdr.reserved[2];
+}
+
+RPC_PRIORITY
+GetRpcPriority(const RPC_HDR& hdr)
+{
+    unsigned char priority = (unsigned char)hdr.reserved[0];
+    if (priority == 0 || priority > RPC_PRI_INTERACTIVE + 1)
+    {
+        return RPC_PRI_NORMAL;
+    }
+
+    return (RPC_PRIORITY)(priority - 1);
+}
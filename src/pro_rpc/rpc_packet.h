@@ -29,6 +29,53 @@
 /////////////////////////////////////////////////////////////////////////////
 ////
 
+/*
+ * a batch carries several rpc packets in one message.
+ *
+ * <RPC_BATCH_HDR> + <RPC_BATCH_ITEM_HDR> + packet + [padding] + ...
+ *
+ * a pipeline is a batch of requests that run in order at the server, with
+ * the references between them.
+ *
+ * <RPC_BATCH_HDR> + <RPC_PIPELINE_REF> * n + <RPC_BATCH_ITEM_HDR> + packet +
+ * [padding] + ...
+ */
+struct RPC_BATCH_HDR
+{
+    char     signature[8]; /* "***PRPB\0", or "***PRPL\0" for a pipeline */
+    uint32_t count;        /* > 0 */
+    uint32_t reserved;     /* n of a pipeline */
+};
+
+struct RPC_BATCH_ITEM_HDR
+{
+    uint32_t size;         /* > 0 */
+    uint32_t reserved;
+};
+
+struct RPC_BATCH_ITEM
+{
+    const void* buffer;
+    size_t      size;
+};
+
+/*
+ * a control message between the client and the server
+ */
+struct RPC_CTRL_HDR
+{
+    char     signature[8]; /* "***PRPX\0" */
+    uint32_t ctrlType;     /* RPC_CT_XXX */
+    uint32_t functionId;   /* 0 for all the functions */
+    uint64_t param;        /* cache key (0 for all the keys) or request id */
+};
+
+static const uint32_t RPC_CT_INVALIDATE = 1; /* server -> client */
+static const uint32_t RPC_CT_CANCEL     = 2; /* client -> server */
+
+/////////////////////////////////////////////////////////////////////////////
+////
+
 class CRpcPacket : public IRpcPacket, public CProRefCount
 {
 public:
@@ -62,6 +109,53 @@ public:
         CProStlVector<RPC_ARGUMENT>& args
         );
 
+    /*
+     * <RPC_BATCH_HDR> + <RPC_BATCH_ITEM_HDR> + packet + [padding] + ...
+     */
+    static bool MakeRpcBatch(
+        const IRpcPacket* const* packets,
+        size_t                   count,
+        CProBuffer&              batch
+        );
+
+    static bool ParseRpcBatch(
+        const void*                    buffer,
+        size_t                         size,
+        CProStlVector<RPC_BATCH_ITEM>& items
+        );
+
+    /*
+     * <RPC_BATCH_HDR> + <RPC_PIPELINE_REF> * n + <RPC_BATCH_ITEM_HDR> +
+     * packet + [padding] + ...
+     */
+    static bool MakeRpcPipeline(
+        const IRpcPacket* const* packets,
+        size_t                   count,
+        const RPC_PIPELINE_REF*  refs,     /* = NULL */
+        size_t                   refCount, /* = 0 */
+        CProBuffer&              pipeline
+        );
+
+    static bool ParseRpcPipeline(
+        const void*                      buffer,
+        size_t                           size,
+        CProStlVector<RPC_BATCH_ITEM>&   items,
+        CProStlVector<RPC_PIPELINE_REF>& refs
+        );
+
+    static void MakeRpcCtrl(
+        uint32_t      ctrlType,
+        uint32_t      functionId,
+        uint64_t      param,
+        RPC_CTRL_HDR& ctrl
+        );
+
+    static bool ParseRpcCtrl(
+        const void*   buffer,
+        size_t        size,
+        RPC_CTRL_HDR& ctrl
+        );
+
     virtual unsigned long AddRef();
 
     virtual unsigned long Release();
@@ -90,6 +184,19 @@ public:
 
     uint32_t GetTimeout() const;
 
+    /*
+     * the credits granted by the server to the client, carried by the
+     * results. 0 ~ 65535.
+     */
+    void SetCredits(unsigned int credits);
+
+    /*
+     * carried by the requests
+     */
+    virtual void SetPriority(RPC_PRIORITY priority);
+
+    virtual RPC_PRIORITY GetPriority() const;
+
     virtual size_t GetArgumentCount() const;
 
     virtual void GetArgument(
@@ -120,6 +227,10 @@ public:
 
     virtual const char* GetMagicStr() const;
 
+    void SetCancelled(bool cancelled);
+
+    virtual bool IsCancelled() const;
+
     /*
      * [[[[ push arguments
      */
@@ -161,6 +272,7 @@ private:
     int64_t                     m_magic1;
     int64_t                     m_magic2;
     CProStlString               m_magicStr;
+    volatile bool               m_cancelled;
 
     RPC_HDR                     m_hdr;
     CProStlVector<RPC_ARGUMENT> m_args;
@@ -172,6 +284,8 @@ private:
 /////////////////////////////////////////////////////////////////////////////
 ////
 
+static const uint64_t RPC_HASH_SEED = 0xCBF29CE484222325ULL;
+
 bool
 CheckRpcDataType(RPC_DATA_TYPE type);
 
@@ -183,6 +297,38 @@ bool
 CmpRpcPacketTypes(const IRpcPacket*                   packet,
                   const CProStlVector<RPC_DATA_TYPE>& types);
 
+/*
+ * FNV-1a. the arrays are hashed by their contents.
+ */
+uint64_t
+CalcRpcHash(const void* buf,
+            size_t      size,
+            uint64_t    hash); /* = RPC_HASH_SEED */
+
+uint64_t
+CalcRpcArgumentHash(const RPC_ARGUMENT& arg,
+                    uint64_t            hash); /* = RPC_HASH_SEED */
+
+/*
+ * the key of the cached results. it's never 0.
+ */
+uint64_t
+CalcRpcCacheKey(uint32_t            functionId,
+                const RPC_ARGUMENT* args,
+                size_t              count);
+
+/*
+ * returns -1 if the result carries no credits
+ */
+int
+GetRpcCredits(const RPC_HDR& hdr);
+
+/*
+ * returns RPC_PRI_NORMAL if the request carries no priority
+ */
+RPC_PRIORITY
+GetRpcPriority(const RPC_HDR& hdr);
+
 /////////////////////////////////////////////////////////////////////////////
 ////
 
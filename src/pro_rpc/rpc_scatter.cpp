@@ -0,0 +1,328 @@
+/*
+ * Copyright (C) 2018-2019 Eric Tung <libpronet@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"),
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * This file is part of LibProRpc (https://github.com/libpronet/libprorpc)
+ */
+
+#include "rpc_scatter.h"
+#include "pro_rpc.h"
+#include "pronet/pro_memory_pool.h"
+#include "pronet/pro_ref_count.h"
+#include "pronet/pro_stl.h"
+#include "pronet/pro_thread_mutex.h"
+#include "pronet/pro_time_util.h"
+#include "pronet/pro_z.h"
+
+/////////////////////////////////////////////////////////////////////////////
+////
+
+CRpcScatter*
+CRpcScatter::CreateInstance(size_t count,
+                            size_t quorum) /* = 0 */
+{
+    assert(count > 0);
+    assert(quorum <= count);
+    if (count == 0 || quorum > count)
+    {
+        return NULL;
+    }
+
+    return new CRpcScatter(count, quorum);
+}
+
+CRpcScatter::CRpcScatter(size_t count,
+                         size_t quorum)
+:
+m_quorum(quorum > 0 ? quorum : count),
+m_results(count, NULL),
+m_servers(count)
+{
+    m_okCount    = 0;
+    m_errorCount = 0;
+    m_done       = false;
+}
+
+CRpcScatter::~CRpcScatter()
+{
+    int i = 0;
+    int c = (int)m_results.size();
+
+    for (; i < c; ++i)
+    {
+        if (m_results[i] != NULL)
+        {
+            m_results[i]->Release();
+        }
+    }
+
+    m_results.clear();
+}
+
+unsigned long
+CRpcScatter::AddRef()
+{
+    return CProRefCount::AddRef();
+}
+
+unsigned long
+CRpcScatter::Release()
+{
+    return CProRefCount::Release();
+}
+
+size_t
+CRpcScatter::GetCallCount() const
+{
+    return m_results.size();
+}
+
+bool
+CRpcScatter::IsReady() const
+{
+    bool ready = false;
+
+    {
+        CProThreadMutexGuard mon(m_lock);
+
+        ready = m_done;
+    }
+
+    return ready;
+}
+
+bool
+CRpcScatter::WaitFor(unsigned int timeoutInMilliseconds)
+{
+    int64_t deadline = ProGetTickCount64() + timeoutInMilliseconds;
+
+    m_lock.Lock();
+
+    while (!m_done)
+    {
+        int64_t tick = ProGetTickCount64();
+        if (timeoutInMilliseconds != (unsigned int)-1 && tick >= deadline)
+        {
+            break;
+        }
+
+        unsigned int waitTime = 1000;
+        if (timeoutInMilliseconds != (unsigned int)-1 && deadline - tick < waitTime)
+        {
+            waitTime = (unsigned int)(deadline - tick);
+        }
+
+        m_cond.Waittime(&m_lock, waitTime);
+    }
+
+    bool ready = m_done;
+
+    m_lock.Unlock();
+
+    if (ready)
+    {
+        m_cond.Signal(); /* wake up the next waiter */
+    }
+
+    return ready;
+}
+
+IRpcPacket*
+CRpcScatter::GetResult(size_t index) const
+{
+    IRpcPacket* result = NULL;
+
+    {
+        CProThreadMutexGuard mon(m_lock);
+
+        if (m_done && index < m_results.size())
+        {
+            result = m_results[index];
+        }
+    }
+
+    return result;
+}
+
+const char*
+CRpcScatter::GetServerIp(size_t index,
+                         char   serverIp[64]) const
+{
+    strcpy(serverIp, "0.0.0.0");
+
+    {
+        CProThreadMutexGuard mon(m_lock);
+
+        if (index < m_servers.size() && !m_servers[index].serverIp.empty())
+        {
+            strncpy_pro(serverIp, 64, m_servers[index].serverIp.c_str());
+        }
+    }
+
+    return serverIp;
+}
+
+unsigned short
+CRpcScatter::GetServerPort(size_t index) const
+{
+    unsigned short serverPort = 0;
+
+    {
+        CProThreadMutexGuard mon(m_lock);
+
+        if (index < m_servers.size())
+        {
+            serverPort = m_servers[index].serverPort;
+        }
+    }
+
+    return serverPort;
+}
+
+size_t
+CRpcScatter::GetOkCount() const
+{
+    size_t okCount = 0;
+
+    {
+        CProThreadMutexGuard mon(m_lock);
+
+        okCount = m_okCount;
+    }
+
+    return okCount;
+}
+
+size_t
+CRpcScatter::GetErrorCount() const
+{
+    size_t errorCount = 0;
+
+    {
+        CProThreadMutexGuard mon(m_lock);
+
+        errorCount = m_errorCount;
+    }
+
+    return errorCount;
+}
+
+void
+CRpcScatter::Then(RPC_SCATTER_CALLBACK callback,
+                  void*                context)
+{
+    assert(callback != NULL);
+    if (callback == NULL)
+    {
+        return;
+    }
+
+    {
+        CProThreadMutexGuard mon(m_lock);
+
+        if (!m_done)
+        {
+            RPC_SCATTER_CALLBACK_INFO info;
+            info.callback = callback;
+            info.context  = context;
+            m_callbacks.push_back(info);
+
+            return;
+        }
+    }
+
+    callback(this, context);
+}
+
+void
+CRpcScatter::SetServer(size_t         index,
+                       const char*    serverIp,
+                       unsigned short serverPort)
+{
+    assert(serverIp != NULL);
+    if (serverIp == NULL)
+    {
+        return;
+    }
+
+    {
+        CProThreadMutexGuard mon(m_lock);
+
+        if (index < m_servers.size())
+        {
+            m_servers[index].serverIp   = serverIp;
+            m_servers[index].serverPort = serverPort;
+        }
+    }
+}
+
+bool
+CRpcScatter::Complete(size_t      index,
+                      IRpcPacket* result)
+{
+    assert(result != NULL);
+    if (result == NULL)
+    {
+        return false;
+    }
+
+    CProStlVector<RPC_SCATTER_CALLBACK_INFO> callbacks;
+
+    {
+        CProThreadMutexGuard mon(m_lock);
+
+        if (m_done || index >= m_results.size() || m_results[index] != NULL)
+        {
+            return false;
+        }
+
+        result->AddRef();
+        m_results[index] = result;
+
+        if (result->GetRpcCode() == RPCE_OK)
+        {
+            ++m_okCount;
+        }
+        else
+        {
+            ++m_errorCount;
+        }
+
+        /*
+         * all the results arrived, the quorum succeeded, or it can't be
+         * reached anymore
+         */
+        size_t count = m_results.size();
+        if (m_okCount + m_errorCount < count && m_okCount < m_quorum &&
+            m_errorCount <= count - m_quorum)
+        {
+            return false;
+        }
+
+        m_done = true;
+        callbacks.swap(m_callbacks);
+    }
+
+    m_cond.Signal();
+
+    int i = 0;
+    int c = (int)callbacks.size();
+
+    for (; i < c; ++i)
+    {
+        callbacks[i].callback(this, callbacks[i].context);
+    }
+
+    return true;
+}
@@ -0,0 +1,136 @@
+/*
+ * Copyright (C) 2018-2019 Eric Tung <libpronet@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"),
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * This file is part of LibProRpc (https://github.com/libpronet/libprorpc)
+ */
+
+#if !defined(RPC_SCATTER_H)
+#define RPC_SCATTER_H
+
+#include "pro_rpc.h"
+#include "pronet/pro_memory_pool.h"
+#include "pronet/pro_ref_count.h"
+#include "pronet/pro_stl.h"
+#include "pronet/pro_thread_mutex.h"
+#include "pronet/pro_z.h"
+
+/////////////////////////////////////////////////////////////////////////////
+////
+
+struct RPC_SCATTER_CALLBACK_INFO
+{
+    RPC_SCATTER_CALLBACK callback;
+    void*                context;
+
+    DECLARE_SGI_POOL(0)
+};
+
+struct RPC_SCATTER_SERVER
+{
+    RPC_SCATTER_SERVER()
+    {
+        serverPort = 0;
+    }
+
+    CProStlString  serverIp;
+    unsigned short serverPort;
+
+    DECLARE_SGI_POOL(0)
+};
+
+/////////////////////////////////////////////////////////////////////////////
+////
+
+class CRpcScatter : public IRpcScatter, public CProRefCount
+{
+public:
+
+    static CRpcScatter* CreateInstance(
+        size_t count,
+        size_t quorum /* = 0 */
+        );
+
+    virtual unsigned long AddRef();
+
+    virtual unsigned long Release();
+
+    virtual size_t GetCallCount() const;
+
+    virtual bool IsReady() const;
+
+    virtual bool WaitFor(unsigned int timeoutInMilliseconds);
+
+    virtual IRpcPacket* GetResult(size_t index) const;
+
+    virtual const char* GetServerIp(
+        size_t index,
+        char   serverIp[64]
+        ) const;
+
+    virtual unsigned short GetServerPort(size_t index) const;
+
+    virtual size_t GetOkCount() const;
+
+    virtual size_t GetErrorCount() const;
+
+    virtual void Then(
+        RPC_SCATTER_CALLBACK callback,
+        void*                context
+        );
+
+    void SetServer(
+        size_t         index,
+        const char*    serverIp,
+        unsigned short serverPort
+        );
+
+    /*
+     * returns true if the scatter is completed by this result. the results
+     * after the completion are ignored. the result is kept, so it must be
+     * of the call only, never one rewritten later.
+     */
+    bool Complete(
+        size_t      index,
+        IRpcPacket* result
+        );
+
+private:
+
+    CRpcScatter(
+        size_t count,
+        size_t quorum
+        );
+
+    virtual ~CRpcScatter();
+
+private:
+
+    const size_t                             m_quorum;
+    CProStlVector<IRpcPacket*>               m_results;
+    CProStlVector<RPC_SCATTER_SERVER>        m_servers;
+    size_t                                   m_okCount;
+    size_t                                   m_errorCount;
+    bool                                     m_done;
+    CProStlVector<RPC_SCATTER_CALLBACK_INFO> m_callbacks;
+    CProThreadMutexCondition                 m_cond;
+    mutable CProThreadMutex                  m_lock;
+
+    DECLARE_SGI_POOL(0)
+};
+
+/////////////////////////////////////////////////////////////////////////////
+////
+
+#endif /* RPC_SCATTER_H */
@@ -20,6 +20,7 @@
 #include "pro_rpc.h"
 #include "rpc_packet.h"
 #include "promsg/msg_server.h"
+#include "pronet/pro_buffer.h"
 #include "pronet/pro_channel_task_pool.h"
 #include "pronet/pro_config_file.h"
 #include "pronet/pro_memory_pool.h"
@@ -38,6 +39,10 @@ static const unsigned char C2S_CID    = 255;
 static const unsigned char RPC_CID    = 2;
 static const uint16_t      RPC_IID    = 1;
 
+static const uint64_t KEY_CHANNEL = (uint64_t)0xFFFFFFFF << 32; /* + worker index */
+
+#define SJF_ALPHA 0.2
+
 /////////////////////////////////////////////////////////////////////////////
 ////
 
@@ -70,25 +75,263 @@ ReadConfig_i(const CProStlVector<PRO_CONFIG_ITEM>& configs,
                 configInfo.rpcs_worker_count = value;
             }
         }
+        else if (stricmp(configName.c_str(), "rpcs_credits") == 0)
+        {
+            configInfo.rpcs_credits = atoi(configValue.c_str()) != 0;
+        }
+        else if (stricmp(configName.c_str(), "rpcs_priority") == 0)
+        {
+            configInfo.rpcs_priority = atoi(configValue.c_str()) != 0;
+        }
+        else if (stricmp(configName.c_str(), "rpcs_scheduler") == 0)
+        {
+            if (stricmp(configValue.c_str(), "fifo") == 0)
+            {
+                configInfo.rpcs_scheduler = RPC_SS_FIFO;
+            }
+            else if (stricmp(configValue.c_str(), "edf") == 0)
+            {
+                configInfo.rpcs_scheduler = RPC_SS_EDF;
+            }
+            else if (stricmp(configValue.c_str(), "sjf") == 0)
+            {
+                configInfo.rpcs_scheduler = RPC_SS_SJF;
+            }
+            else
+            {
+            }
+        }
+        else if (stricmp(configName.c_str(), "rpcs_batch_size") == 0)
+        {
+            int value = atoi(configValue.c_str());
+            if (value > 0 && value <= 1024)
+            {
+                configInfo.rpcs_batch_size = value;
+            }
+        }
+        else if (stricmp(configName.c_str(), "rpcs_coalesce_bytes") == 0)
+        {
+            int value = atoi(configValue.c_str());
+            if (value >= 0)
+            {
+                configInfo.rpcs_coalesce_bytes = value;
+            }
+        }
+        else if (stricmp(configName.c_str(), "rpcs_coalesce_delay") == 0)
+        {
+            int value = atoi(configValue.c_str());
+            if (value > 0 && value <= 1000)
+            {
+                configInfo.rpcs_coalesce_delay = value;
+            }
+        }
+        else if (configName.size() > 11 &&
+            stricmp(configName.substr(0, 11).c_str(), "rpcs_group_") == 0)
+        {
+            CProStlString name  = configName.substr(11);
+            int           value = atoi(configValue.c_str());
+
+            if (name.size() > 8 &&
+                stricmp(name.substr(name.size() - 8).c_str(), "_workers") == 0)
+            {
+                if (value > 0 && value <= 100)
+                {
+                    configInfo.rpcs_groups[name.substr(0, name.size() - 8)].workers = value;
+                }
+            }
+            else if (name.size() > 14 &&
+                stricmp(name.substr(name.size() - 14).c_str(), "_pending_calls") == 0)
+            {
+                if (value > 0)
+                {
+                    configInfo.rpcs_groups[name.substr(0, name.size() - 14)].pendingCalls = value;
+                }
+            }
+            else
+            {
+            }
+        }
         else
         {
         }
     } /* end of for () */
 }
 
+static
+void
+AddKeyChannels_i(RPC_WORKER_GROUP& group,
+                 unsigned int      workerCount)
+{
+    assert(group.taskPool != NULL);
+
+    /*
+     * one key channel per worker thread, which is also the lane of the
+     * thread
+     */
+    group.lanes.resize(workerCount);
+
+    for (unsigned int i = 0; i < workerCount; ++i)
+    {
+        group.taskPool->AddChannel(KEY_CHANNEL + i);
+        group.channel2Queue[KEY_CHANNEL + i];
+        group.lanes[i].insert(KEY_CHANNEL + i);
+    }
+
+    group.keyChannels = workerCount;
+}
+
+static
+unsigned int
+GetLane_i(const RPC_WORKER_GROUP& group,
+          uint64_t                channel)
+{
+    assert(group.keyChannels > 0);
+
+    if (channel >= KEY_CHANNEL)
+    {
+        return (unsigned int)(channel - KEY_CHANNEL);
+    }
+    else
+    {
+        return (unsigned int)(channel % group.keyChannels);
+    }
+}
+
+static
+bool
+HasTasks_i(const RPC_WORKER_GROUP& group,
+           unsigned int            lane,
+           uint64_t                clientId)
+{
+    auto itr = group.channel2Queue.find(clientId);
+    if (itr != group.channel2Queue.end() && itr->second.size > 0 &&
+        GetLane_i(group, clientId) == lane)
+    {
+        return true;
+    }
+
+    itr = group.channel2Queue.find(KEY_CHANNEL + lane);
+    if (itr == group.channel2Queue.end() || itr->second.size == 0)
+    {
+        return false;
+    }
+
+    for (int i = RPC_PRI_BATCH; i <= RPC_PRI_INTERACTIVE; ++i)
+    {
+        const CProStlDeque<RPC_SERVER_TASK>& tasks = itr->second.tasks[i];
+
+        auto itr2 = tasks.begin();
+        auto end2 = tasks.end();
+
+        for (; itr2 != end2; ++itr2)
+        {
+            if (itr2->request->GetClientId() == clientId)
+            {
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+static
+void
+DeleteGroups_i(CProStlVector<RPC_WORKER_GROUP*>& groups)
+{
+    int i = 0;
+    int c = (int)groups.size();
+
+    for (; i < c; ++i)
+    {
+        /*
+         * the task pool of the default group is deleted by the caller
+         */
+        if (i > 0)
+        {
+            delete groups[i]->taskPool;
+        }
+
+        delete groups[i];
+    }
+
+    groups.clear();
+}
+
+static
+void
+DeletePipeline_i(RPC_PIPELINE* pipeline)
+{
+    assert(pipeline != NULL);
+
+    for (int i = 0; i < (int)pipeline->calls.size(); ++i)
+    {
+        pipeline->calls[i]->Release();
+    }
+
+    for (int j = 0; j < (int)pipeline->results.size(); ++j)
+    {
+        pipeline->results[j]->Release();
+    }
+
+    delete pipeline;
+}
+
+static
+CRpcPacket*
+CreateRequest_i(uint64_t                           clientId,
+                uint64_t                           requestId,
+                uint32_t                           functionId,
+                bool                               noreply,
+                uint32_t                           timeoutInSeconds,
+                RPC_PRIORITY                       priority,
+                const CProStlVector<RPC_ARGUMENT>& args)
+{
+    CRpcPacket* request = CRpcPacket::CreateInstance(
+        requestId,
+        functionId,
+        true /* this is a rebuilt packet */
+        );
+    if (request == NULL)
+    {
+        return NULL;
+    }
+
+    request->SetClientId(clientId);
+    request->SetNoreply(noreply);
+    request->SetTimeout(timeoutInSeconds);
+    request->SetPriority(priority);
+
+    request->CleanAndBeginPushArgument();
+    if (
+        (args.size() > 0 && !request->PushArguments(&args[0], args.size()))
+        ||
+        !request->EndPushArgument()
+       )
+    {
+        request->Release();
+
+        return NULL;
+    }
+
+    return request;
+}
+
 /////////////////////////////////////////////////////////////////////////////
 ////
 
 CRpcServer*
-CRpcServer::CreateInstance()
+CRpcServer::CreateInstance(bool batchObserver) /* = false */
 {
-   return new CRpcServer;
+   return new CRpcServer(batchObserver);
 }
 
-CRpcServer::CRpcServer()
+CRpcServer::CRpcServer(bool batchObserver) /* = false */
+: m_batchObserver(batchObserver)
 {
-    m_observer = NULL;
-    m_taskPool = NULL;
+    m_observer     = NULL;
+    m_taskPool     = NULL;
+    m_flushTimerId = 0;
 }
 
 CRpcServer::~CRpcServer()
@@ -137,7 +380,8 @@ CRpcServer::Init(IRpcServerObserver* observer,
     RPC_SERVER_CONFIG_INFO configInfo;
     ReadConfig_i(configs, configInfo);
 
-    CProChannelTaskPool* taskPool = NULL;
+    CProChannelTaskPool*             taskPool = NULL;
+    CProStlVector<RPC_WORKER_GROUP*> groups;
 
     {
         CProThreadMutexGuard mon(m_lock);
@@ -160,16 +404,55 @@ CRpcServer::Init(IRpcServerObserver* observer,
             goto EXIT;
         }
 
+        RPC_WORKER_GROUP* group = new RPC_WORKER_GROUP;
+        group->taskPool     = taskPool;
+        group->pendingCalls = configInfo.rpcs_pending_calls;
+        groups.push_back(group);
+        AddKeyChannels_i(*group, configInfo.rpcs_worker_count);
+
+        auto itr = configInfo.rpcs_groups.begin();
+        auto end = configInfo.rpcs_groups.end();
+
+        for (; itr != end; ++itr)
+        {
+            const RPC_GROUP_CONFIG_INFO& groupInfo = itr->second;
+
+            group = new RPC_WORKER_GROUP;
+            group->name         = itr->first;
+            group->taskPool     = new CProChannelTaskPool;
+            group->pendingCalls = groupInfo.pendingCalls > 0
+                ? groupInfo.pendingCalls : configInfo.rpcs_pending_calls;
+            groups.push_back(group);
+
+            if (!group->taskPool->Start(groupInfo.workers))
+            {
+                goto EXIT;
+            }
+
+            AddKeyChannels_i(*group, groupInfo.workers);
+        }
+
+        /*
+         * the time bound of the coalesced results
+         */
+        if (configInfo.rpcs_coalesce_bytes > 0)
+        {
+            m_flushTimerId = reactor->SetupTimer(
+                this, configInfo.rpcs_coalesce_delay, configInfo.rpcs_coalesce_delay);
+        }
+
         observer->AddRef();
         m_observer   = observer;
         m_configInfo = configInfo;
         m_taskPool   = taskPool;
+        m_groups     = groups;
     }
 
     return true;
 
 EXIT:
 
+    DeleteGroups_i(groups);
     delete taskPool;
 
     CMsgServer::Fini();
@@ -180,8 +463,9 @@ EXIT:
 void
 CRpcServer::Fini()
 {
-    IRpcServerObserver*  observer = NULL;
-    CProChannelTaskPool* taskPool = NULL;
+    IRpcServerObserver*              observer = NULL;
+    CProChannelTaskPool*             taskPool = NULL;
+    CProStlVector<RPC_WORKER_GROUP*> groups;
 
     {
         CProThreadMutexGuard mon(m_lock);
@@ -192,13 +476,82 @@ CRpcServer::Fini()
         }
 
         m_funtionId2Info.clear();
+
+        for (int i = 0; i < (int)m_groups.size(); ++i)
+        {
+            RPC_WORKER_GROUP& group = *m_groups[i];
+
+            auto itr = group.channel2Queue.begin();
+            auto end = group.channel2Queue.end();
+
+            for (; itr != end; ++itr)
+            {
+                ReleaseQueue_i(group, itr->second);
+            }
+
+            group.channel2Queue.clear();
+        }
+
+        auto itr = m_clientId2Requests.begin();
+        auto end = m_clientId2Requests.end();
+
+        for (; itr != end; ++itr)
+        {
+            auto itr2 = itr->second.begin();
+            auto end2 = itr->second.end();
+
+            for (; itr2 != end2; ++itr2)
+            {
+                itr2->second->Release();
+            }
+        }
+
+        m_clientId2Requests.clear();
+
+        auto itr3 = m_clientId2Output.begin();
+        auto end3 = m_clientId2Output.end();
+
+        for (; itr3 != end3; ++itr3)
+        {
+            ReleaseOutput_i(itr3->second);
+        }
+
+        m_clientId2Output.clear();
+
+        auto itr4 = m_clientId2Pipelines.begin();
+        auto end4 = m_clientId2Pipelines.end();
+
+        for (; itr4 != end4; ++itr4)
+        {
+            auto itr5 = itr4->second.begin();
+            auto end5 = itr4->second.end();
+
+            for (; itr5 != end5; ++itr5)
+            {
+                DeletePipeline_i(itr5->second);
+            }
+        }
+
+        m_clientId2Pipelines.clear();
+
+        if (m_flushTimerId > 0)
+        {
+            m_reactor->CancelTimer(m_flushTimerId);
+            m_flushTimerId = 0;
+        }
+
+        groups.swap(m_groups);
         taskPool = m_taskPool;
         m_taskPool = NULL;
         observer = m_observer;
         m_observer = NULL;
     }
 
+    /*
+     * the tasks still in the task pools find no group and return
+     */
     delete taskPool;
+    DeleteGroups_i(groups);
     observer->Release();
 
     CMsgServer::Fini();
@@ -250,6 +603,18 @@ CRpcServer::RegisterFunction(uint32_t             functionId,
                              size_t               callArgCount, /* = 0 */
                              const RPC_DATA_TYPE* retnArgTypes, /* = NULL */
                              size_t               retnArgCount) /* = 0 */
+{
+    return RegisterFunction2(
+        functionId, callArgTypes, callArgCount, retnArgTypes, retnArgCount, NULL);
+}
+
+RPC_ERROR_CODE
+CRpcServer::RegisterFunction2(uint32_t             functionId,
+                              const RPC_DATA_TYPE* callArgTypes, /* = NULL */
+                              size_t               callArgCount, /* = 0 */
+                              const RPC_DATA_TYPE* retnArgTypes, /* = NULL */
+                              size_t               retnArgCount, /* = 0 */
+                              const char*          groupName)    /* = NULL */
 {
     assert(functionId > 0);
     if (functionId == 0)
@@ -294,7 +659,26 @@ CRpcServer::RegisterFunction(uint32_t             functionId,
             return RPCE_ERROR;
         }
 
+        unsigned int group = 0;
+
+        if (groupName != NULL && groupName[0] != '\0')
+        {
+            for (group = 1; group < (unsigned int)m_groups.size(); ++group)
+            {
+                if (stricmp(m_groups[group]->name.c_str(), groupName) == 0)
+                {
+                    break;
+                }
+            }
+
+            if (group == (unsigned int)m_groups.size())
+            {
+                return RPCE_INVALID_ARGUMENT; /* not configured */
+            }
+        }
+
         RPC_FUNCTION_INFO& info = m_funtionId2Info[functionId]; /* insert */
+        info.group = group;
         info.callArgTypes.clear();
         info.retnArgTypes.clear();
 
@@ -312,6 +696,43 @@ CRpcServer::RegisterFunction(uint32_t             functionId,
     return RPCE_OK;
 }
 
+RPC_ERROR_CODE
+CRpcServer::SetAffinityArgument(uint32_t functionId,
+                                int      argIndex)
+{
+    assert(functionId > 0);
+    assert(argIndex >= -1);
+    if (functionId == 0 || argIndex < -1)
+    {
+        return RPCE_INVALID_ARGUMENT;
+    }
+
+    {
+        CProThreadMutexGuard mon(m_lock);
+
+        if (m_observer == NULL || m_taskPool == NULL)
+        {
+            return RPCE_ERROR;
+        }
+
+        auto itr = m_funtionId2Info.find(functionId);
+        if (itr == m_funtionId2Info.end())
+        {
+            return RPCE_INVALID_FUNCTION;
+        }
+
+        RPC_FUNCTION_INFO& info = itr->second;
+        if (argIndex >= (int)info.callArgTypes.size())
+        {
+            return RPCE_INVALID_ARGUMENT;
+        }
+
+        info.affinityArg = argIndex;
+    }
+
+    return RPCE_OK;
+}
+
 void
 CRpcServer::UnregisterFunction(uint32_t functionId)
 {
@@ -341,6 +762,31 @@ CRpcServer::SendRpcResult(IRpcPacket* result)
         return RPCE_INVALID_ARGUMENT;
     }
 
+    return SendRpcResults(&result, 1);
+}
+
+RPC_ERROR_CODE
+CRpcServer::SendRpcResults(IRpcPacket** results,
+                           size_t       count)
+{
+    assert(results != NULL);
+    assert(count > 0);
+    if (results == NULL || count == 0)
+    {
+        return RPCE_INVALID_ARGUMENT;
+    }
+
+    for (int i = 0; i < (int)count; ++i)
+    {
+        assert(results[i] != NULL);
+        if (results[i] == NULL)
+        {
+            return RPCE_INVALID_ARGUMENT;
+        }
+    }
+
+    CProStlMap<uint64_t, CProStlVector<IRpcPacket*> > clientId2Results;
+
     {
         CProThreadMutexGuard mon(m_lock);
 
@@ -349,31 +795,217 @@ CRpcServer::SendRpcResult(IRpcPacket* result)
             return RPCE_ERROR;
         }
 
-        auto itr = m_funtionId2Info.find(result->GetFunctionId());
-        if (itr == m_funtionId2Info.end())
+        for (int j = 0; j < (int)count; ++j)
         {
-            return RPCE_INVALID_FUNCTION;
+            IRpcPacket* result = results[j];
+
+            auto itr = m_funtionId2Info.find(result->GetFunctionId());
+            if (itr == m_funtionId2Info.end())
+            {
+                return RPCE_INVALID_FUNCTION;
+            }
+
+            if (result->GetRpcCode() == RPCE_OK)
+            {
+                const RPC_FUNCTION_INFO& info = itr->second;
+                if (!CmpRpcPacketTypes(result, info.retnArgTypes))
+                {
+                    return RPCE_MISMATCHED_PARAMETER;
+                }
+            }
         }
 
-        if (result->GetRpcCode() == RPCE_OK)
+        for (int k = 0; k < (int)count; ++k)
         {
-            const RPC_FUNCTION_INFO& info = itr->second;
-            if (!CmpRpcPacketTypes(result, info.retnArgTypes))
+            IRpcPacket* result = results[k];
+
+            if (m_configInfo.rpcs_credits)
             {
-                return RPCE_MISMATCHED_PARAMETER;
+                ((CRpcPacket*)result)->SetCredits(CalcCredits_i(result->GetClientId()));
             }
-        }
 
-        RTP_MSG_USER user(RPC_CID, result->GetClientId(), RPC_IID);
+            RemoveRequest_i(result->GetClientId(), result->GetRequestId(), NULL);
 
-        if (!m_msgServer->SendMsg(result->GetTotalBuffer(), result->GetTotalSize(), 0, &user, 1))
-        {
-            return RPCE_ERROR;
+            if (PipeResult_i(result))
+            {
+                continue;
+            }
+
+            result->AddRef();
+
+            if (m_configInfo.rpcs_coalesce_bytes == 0)
+            {
+                clientId2Results[result->GetClientId()].push_back(result);
+                continue;
+            }
+
+            /*
+             * the size bound of the coalesced results
+             */
+            RPC_CLIENT_OUTPUT& output = m_clientId2Output[result->GetClientId()];
+            output.results.push_back(result);
+            output.bytes += result->GetTotalSize();
+
+            if (output.bytes >= m_configInfo.rpcs_coalesce_bytes)
+            {
+                clientId2Results[result->GetClientId()].swap(output.results);
+                m_clientId2Output.erase(result->GetClientId());
+            }
         }
     }
 
-    return RPCE_OK;
-}
+    if (clientId2Results.size() == 0)
+    {
+        return RPCE_OK;
+    }
+
+    return SendResults(clientId2Results);
+}
+
+RPC_ERROR_CODE
+CRpcServer::SendResults(CProStlMap<uint64_t, CProStlVector<IRpcPacket*> >& clientId2Results)
+{
+    /*
+     * encode the batches outside the lock
+     */
+    CProStlMap<uint64_t, CProBuffer*> clientId2Batch;
+
+    {
+        auto itr = clientId2Results.begin();
+        auto end = clientId2Results.end();
+
+        for (; itr != end; ++itr)
+        {
+            const CProStlVector<IRpcPacket*>& results = itr->second;
+            if (results.size() == 1)
+            {
+                continue;
+            }
+
+            CProBuffer* batch = new CProBuffer;
+            if (!CRpcPacket::MakeRpcBatch(&results[0], results.size(), *batch))
+            {
+                delete batch;
+                batch = NULL;
+            }
+
+            clientId2Batch[itr->first] = batch;
+        }
+    }
+
+    RPC_ERROR_CODE ret = RPCE_OK;
+
+    {
+        CProThreadMutexGuard mon(m_lock);
+
+        auto itr = clientId2Results.begin();
+        auto end = clientId2Results.end();
+
+        for (; itr != end; ++itr)
+        {
+            RTP_MSG_USER user(RPC_CID, itr->first, RPC_IID);
+
+            const void* buf  = itr->second[0]->GetTotalBuffer();
+            size_t      size = itr->second[0]->GetTotalSize();
+
+            if (itr->second.size() > 1)
+            {
+                CProBuffer* batch = clientId2Batch[itr->first];
+                if (batch == NULL)
+                {
+                    ret = RPCE_NOT_ENOUGH_MEMORY;
+                    continue;
+                }
+
+                buf  = batch->Data();
+                size = batch->Size();
+            }
+
+            if (m_msgServer == NULL || !m_msgServer->SendMsg(buf, size, 0, &user, 1))
+            {
+                ret = RPCE_ERROR;
+            }
+        }
+    }
+
+    auto itr = clientId2Results.begin();
+    auto end = clientId2Results.end();
+
+    for (; itr != end; ++itr)
+    {
+        delete clientId2Batch[itr->first];
+
+        int i = 0;
+        int c = (int)itr->second.size();
+
+        for (; i < c; ++i)
+        {
+            itr->second[i]->Release();
+        }
+    }
+
+    return ret;
+}
+
+void
+CRpcServer::FlushOutput(const CProStlSet<uint64_t>* clientIds) /* NULL for all */
+{
+    CProStlMap<uint64_t, CProStlVector<IRpcPacket*> > clientId2Results;
+
+    {
+        CProThreadMutexGuard mon(m_lock);
+
+        if (m_observer == NULL || m_taskPool == NULL || m_msgServer == NULL)
+        {
+            return;
+        }
+
+        auto itr = m_clientId2Output.begin();
+        auto end = m_clientId2Output.end();
+
+        while (itr != end)
+        {
+            if (clientIds != NULL && clientIds->find(itr->first) == clientIds->end())
+            {
+                ++itr;
+                continue;
+            }
+
+            clientId2Results[itr->first].swap(itr->second.results);
+            m_clientId2Output.erase(itr++);
+        }
+    }
+
+    if (clientId2Results.size() > 0)
+    {
+        SendResults(clientId2Results);
+    }
+}
+
+void
+CRpcServer::OnTimer(void*    factory,
+                    uint64_t timerId,
+                    int64_t  tick,
+                    int64_t  userData)
+{
+    assert(factory != NULL);
+    assert(timerId > 0);
+    if (factory == NULL || timerId == 0)
+    {
+        return;
+    }
+
+    {
+        CProThreadMutexGuard mon(m_lock);
+
+        if (timerId != m_flushTimerId || m_clientId2Output.size() == 0)
+        {
+            return;
+        }
+    }
+
+    FlushOutput(NULL);
+}
 
 bool
 CRpcServer::SendMsgToClients(const void*     buf,
@@ -437,6 +1069,25 @@ CRpcServer::KickoutClient(uint64_t clientId)
     }
 }
 
+bool
+CRpcServer::InvalidateCache(const uint64_t*     dstClients,
+                            unsigned char       dstClientCount,
+                            uint32_t            functionId, /* = 0 */
+                            const RPC_ARGUMENT* args,       /* = NULL */
+                            size_t              argCount)   /* = 0 */
+{
+    uint64_t key = 0;
+    if (functionId != 0 && args != NULL)
+    {
+        key = CalcRpcCacheKey(functionId, args, argCount);
+    }
+
+    RPC_CTRL_HDR ctrl;
+    CRpcPacket::MakeRpcCtrl(RPC_CT_INVALIDATE, functionId, key, ctrl);
+
+    return SendMsgToClients(&ctrl, sizeof(RPC_CTRL_HDR), 0, dstClients, dstClientCount);
+}
+
 bool
 CRpcServer::OnCheckUser(IRtpMsgServer*      msgServer,
                         const RTP_MSG_USER* user,
@@ -512,7 +1163,18 @@ CRpcServer::OnOkUser(IRtpMsgServer*      msgServer,
             return;
         }
 
-        m_taskPool->AddChannel(clientId);
+        for (int i = 0; i < (int)m_groups.size(); ++i)
+        {
+            RPC_WORKER_GROUP& group = *m_groups[i];
+            if (group.keyChannels == 0)
+            {
+                continue;
+            }
+
+            group.channel2Queue[clientId];
+            group.lanes[GetLane_i(group, clientId)].insert(clientId);
+        }
+        m_clientId2Requests[clientId];
 
         m_observer->AddRef();
         observer = m_observer;
@@ -557,7 +1219,53 @@ CRpcServer::OnCloseUser(IRtpMsgServer*      msgServer,
             return;
         }
 
-        m_taskPool->RemoveChannel(clientId);
+        for (int i = 0; i < (int)m_groups.size(); ++i)
+        {
+            RPC_WORKER_GROUP& group = *m_groups[i];
+
+            auto itr = group.channel2Queue.find(clientId);
+            if (itr != group.channel2Queue.end())
+            {
+                ReleaseQueue_i(group, itr->second);
+                group.channel2Queue.erase(itr);
+                group.lanes[GetLane_i(group, clientId)].erase(clientId);
+            }
+        }
+
+        auto itr = m_clientId2Requests.find(clientId);
+        if (itr != m_clientId2Requests.end())
+        {
+            auto itr2 = itr->second.begin();
+            auto end2 = itr->second.end();
+
+            for (; itr2 != end2; ++itr2)
+            {
+                itr2->second->Release();
+            }
+
+            m_clientId2Requests.erase(itr);
+        }
+
+        auto itr3 = m_clientId2Output.find(clientId);
+        if (itr3 != m_clientId2Output.end())
+        {
+            ReleaseOutput_i(itr3->second);
+            m_clientId2Output.erase(itr3);
+        }
+
+        auto itr4 = m_clientId2Pipelines.find(clientId);
+        if (itr4 != m_clientId2Pipelines.end())
+        {
+            auto itr5 = itr4->second.begin();
+            auto end5 = itr4->second.end();
+
+            for (; itr5 != end5; ++itr5)
+            {
+                DeletePipeline_i(itr5->second);
+            }
+
+            m_clientId2Pipelines.erase(itr4);
+        }
 
         m_observer->AddRef();
         observer = m_observer;
@@ -590,13 +1298,37 @@ CRpcServer::OnRecvMsg(IRtpMsgServer*      msgServer,
 
     uint64_t srcClientId = srcUser->UserId();
 
-    RPC_HDR                     hdr;
-    CProStlVector<RPC_ARGUMENT> args;
+    RPC_HDR                         hdr;
+    RPC_CTRL_HDR                    ctrl;
+    CProStlVector<RPC_ARGUMENT>     args;
+    CProStlVector<RPC_BATCH_ITEM>   items;
+    CProStlVector<RPC_PIPELINE_REF> refs;
 
     if (CRpcPacket::ParseRpcPacket(buf, size, hdr, args))
     {
         RecvRpc(msgServer, hdr, args, srcClientId);
     }
+    else if (CRpcPacket::ParseRpcBatch(buf, size, items))
+    {
+        int i = 0;
+        int c = (int)items.size();
+
+        for (; i < c; ++i)
+        {
+            if (CRpcPacket::ParseRpcPacket(items[i].buffer, items[i].size, hdr, args))
+            {
+                RecvRpc(msgServer, hdr, args, srcClientId);
+            }
+        }
+    }
+    else if (CRpcPacket::ParseRpcPipeline(buf, size, items, refs))
+    {
+        RecvPipeline(msgServer, items, refs, srcClientId);
+    }
+    else if (CRpcPacket::ParseRpcCtrl(buf, size, ctrl))
+    {
+        RecvCtrl(msgServer, ctrl, srcClientId);
+    }
     else
     {
         RecvMsg(msgServer, buf, size, charset, srcClientId);
@@ -616,180 +1348,1018 @@ CRpcServer::RecvRpc(IRtpMsgServer*                     msgServer,
         return;
     }
 
-    {
-        CProThreadMutexGuard mon(m_lock);
-
-        if (m_observer == NULL || m_taskPool == NULL || m_msgServer == NULL)
-        {
-            return;
-        }
-
-        if (msgServer != m_msgServer)
-        {
-            return;
-        }
+    /*
+     * the reserved bytes of the old clients may be garbage
+     */
+    RPC_PRIORITY priority = m_configInfo.rpcs_priority ? GetRpcPriority(hdr) : RPC_PRI_NORMAL;
 
-        {
-            auto itr = m_funtionId2Info.find(hdr.functionId);
-            if (itr == m_funtionId2Info.end())
-            {
-                return;
-            }
+    CRpcPacket* request = CreateRequest_i(srcClientId, hdr.requestId, hdr.functionId,
+        hdr.noreply, hdr.timeoutInSeconds, priority, args);
+    if (request == NULL)
+    {
+        return;
+    }
 
-            const RPC_FUNCTION_INFO& info = itr->second;
-            if (!CmpRpcArgsTypes(args, info.callArgTypes))
-            {
-                return;
-            }
-        }
+    {
+        CProThreadMutexGuard mon(m_lock);
 
-        if (m_taskPool->GetSize() >= m_configInfo.rpcs_pending_calls)
+        if (m_observer != NULL && m_taskPool != NULL && m_msgServer != NULL &&
+            msgServer == m_msgServer)
         {
-            if (!hdr.noreply)
+            if (RecvRpc_i(request) == RPCE_SERVER_BUSY && !hdr.noreply)
             {
                 SendErrorCode(srcClientId, hdr.requestId, hdr.functionId, RPCE_SERVER_BUSY);
             }
-
-            return;
         }
+    }
 
-        CRpcPacket* request = CRpcPacket::CreateInstance(
-            hdr.requestId,
-            hdr.functionId,
-            true /* this is a rebuilt packet */
-            );
-        if (request == NULL)
-        {
-            return;
-        }
+    request->Release();
+}
 
-        request->SetClientId(srcClientId);
-        request->SetNoreply(hdr.noreply);
-        request->SetTimeout(hdr.timeoutInSeconds);
+RPC_ERROR_CODE
+CRpcServer::RecvRpc_i(CRpcPacket* request)
+{
+    assert(request != NULL);
+    assert(m_msgServer != NULL);
 
-        if (args.size() > 0)
-        {
-            request->CleanAndBeginPushArgument();
-            if (!request->PushArguments(&args[0], args.size()) || !request->EndPushArgument())
-            {
-                request->Release();
-                request = NULL;
-            }
-        }
-        else
+    unsigned int groupIndex  = 0;
+    int          affinityArg = -1;
+
+    {
+        auto itr = m_funtionId2Info.find(request->GetFunctionId());
+        if (itr == m_funtionId2Info.end())
         {
-            request->CleanAndBeginPushArgument();
-            if (!request->EndPushArgument())
-            {
-                request->Release();
-                request = NULL;
-            }
+            return RPCE_INVALID_FUNCTION;
         }
 
-        if (request == NULL)
+        const RPC_FUNCTION_INFO& info = itr->second;
+        if (!CmpRpcPacketTypes(request, info.callArgTypes))
         {
-            return;
+            return RPCE_MISMATCHED_PARAMETER;
         }
 
-        m_taskPool->PostCall(
-            srcClientId,
-            *this,
-            &CRpcServer::AsyncRecvRpc,
-            request,
-            ProGetTickCount64() /* arrival time */
-            );
+        groupIndex  = info.group;
+        affinityArg = info.affinityArg;
     }
-}
 
-void
-CRpcServer::AsyncRecvRpc(CRpcPacket* request,
-                         int64_t     arrivalTick)
-{
-    /*
-     * check timeout
-     */
-    if (ProGetTickCount64() >= arrivalTick + (int64_t)request->GetTimeout() * 1000)
+    assert(groupIndex < m_groups.size());
+    if (groupIndex >= m_groups.size())
     {
-        request->Release();
-
-        return;
+        return RPCE_ERROR;
     }
 
-    IRpcServerObserver* observer = NULL;
+    RPC_WORKER_GROUP& group    = *m_groups[groupIndex];
+    uint64_t          clientId = request->GetClientId();
+    uint64_t          channel  = clientId;
 
+    /*
+     * the same key goes to the same worker thread
+     */
+    if (affinityArg >= 0 && affinityArg < (int)request->GetArgumentCount() &&
+        group.keyChannels > 0)
     {
-        CProThreadMutexGuard mon(m_lock);
+        RPC_ARGUMENT arg;
+        request->GetArgument(affinityArg, &arg);
 
-        if (m_observer != NULL)
-        {
-            m_observer->AddRef();
-            observer = m_observer;
-        }
+        uint64_t key = CalcRpcCacheKey(0, &arg, 1);
+        channel = KEY_CHANNEL + key % group.keyChannels;
     }
 
-    if (observer != NULL)
+    auto itr = group.channel2Queue.find(channel);
+    if (itr == group.channel2Queue.end())
     {
-        observer->OnRpcRequest(this, request);
-        observer->Release();
+        return RPCE_ERROR;
     }
 
-    request->Release();
-}
+    RPC_PRIORITY priority = request->GetPriority();
 
-void
-CRpcServer::RecvMsg(IRtpMsgServer* msgServer,
-                    const void*    buf,
-                    size_t         size,
-                    uint16_t       charset,
-                    uint64_t       srcClientId)
-{
-    assert(msgServer != NULL);
-    assert(buf != NULL);
-    assert(size > 0);
+    /*
+     * when it's overloaded, a queued request of a lower priority gives
+     * way to the new one
+     */
+    if (GetQueued_i(group) >= group.pendingCalls && !ShedTask_i(group, priority))
+    {
+        return RPCE_SERVER_BUSY;
+    }
 
-    IRpcServerObserver* observer = NULL;
+    /*
+     * the task pool runs the tasks of a lane in order. a posted task takes
+     * the request of the highest priority among the channels of the lane.
+     */
+    unsigned int lane = GetLane_i(group, channel);
 
+    if (!group.taskPool->PostCall(
+        KEY_CHANNEL + lane, *this, &CRpcServer::AsyncRecvRpc, groupIndex, lane))
     {
-        CProThreadMutexGuard mon(m_lock);
+        return RPCE_ERROR;
+    }
 
-        if (m_observer == NULL || m_taskPool == NULL || m_msgServer == NULL)
-        {
-            return;
-        }
+    request->AddRef();
 
-        if (msgServer != m_msgServer)
+    RPC_SERVER_TASK task;
+    task.request     = request;
+    task.arrivalTick = ProGetTickCount64();
+
+    RPC_CHANNEL_QUEUE& queue = itr->second;
+    queue.tasks[priority].push_back(task);
+    ++queue.size;
+    ++group.queued[priority];
+
+    auto itr2 = m_clientId2Requests.find(clientId);
+    if (itr2 != m_clientId2Requests.end())
+    {
+        CRpcPacket*& request2 = itr2->second[request->GetRequestId()];
+        if (request2 != NULL)
         {
-            return;
+            request2->Release(); /* a duplicate request id */
         }
 
-        m_observer->AddRef();
-        observer = m_observer;
+        request->AddRef();
+        request2 = request;
     }
 
-    observer->OnRecvMsg(this, buf, size, charset, srcClientId);
-    observer->Release();
+    return RPCE_OK;
 }
 
 void
-CRpcServer::SendErrorCode(uint64_t       clientId,
-                          uint64_t       requestId,
-                          uint32_t       functionId,
-                          RPC_ERROR_CODE rpcCode)
+CRpcServer::RecvPipeline(IRtpMsgServer*                         msgServer,
+                         const CProStlVector<RPC_BATCH_ITEM>&   items,
+                         const CProStlVector<RPC_PIPELINE_REF>& refs,
+                         uint64_t                               srcClientId)
 {
-    assert(clientId > 0);
-    assert(requestId > 0);
-    assert(functionId > 0);
-    assert(rpcCode < 0);
-    assert(m_msgServer != NULL);
+    assert(msgServer != NULL);
 
-    IRpcPacket* result = CreateRpcResult(clientId, requestId, functionId, rpcCode, NULL, 0);
-    if (result == NULL)
+    if (srcClientId == 0 || items.size() == 0 || items.size() > 65535)
     {
         return;
     }
 
-    RTP_MSG_USER user(RPC_CID, clientId, RPC_IID);
+    RPC_PIPELINE* pipeline = new RPC_PIPELINE;
+    pipeline->clientId  = srcClientId;
+    pipeline->startTick = ProGetTickCount64();
+    pipeline->refs      = refs;
 
-    m_msgServer->SendMsg(result->GetTotalBuffer(), result->GetTotalSize(), 0, &user, 1);
-    result->Release();
+    int i = 0;
+    int c = (int)items.size();
+
+    for (; i < c; ++i)
+    {
+        RPC_HDR                     hdr;
+        CProStlVector<RPC_ARGUMENT> args;
+
+        if (!CRpcPacket::ParseRpcPacket(items[i].buffer, items[i].size, hdr, args) ||
+            hdr.noreply)
+        {
+            break;
+        }
+
+        RPC_PRIORITY priority =
+            m_configInfo.rpcs_priority ? GetRpcPriority(hdr) : RPC_PRI_NORMAL;
+
+        CRpcPacket* call = CreateRequest_i(srcClientId, hdr.requestId, hdr.functionId,
+            false, hdr.timeoutInSeconds, priority, args);
+        if (call == NULL)
+        {
+            break;
+        }
+
+        pipeline->calls.push_back(call);
+    }
+
+    bool valid = pipeline->calls.size() == items.size();
+
+    /*
+     * a call refers to an argument of an earlier one
+     */
+    for (int j = 0; j < (int)refs.size() && valid; ++j)
+    {
+        const RPC_PIPELINE_REF& ref = refs[j];
+        if (ref.callIndex >= c || ref.resultIndex >= ref.callIndex ||
+            ref.argIndex >= pipeline->calls[ref.callIndex]->GetArgumentCount())
+        {
+            valid = false;
+        }
+    }
+
+    if (valid)
+    {
+        CProThreadMutexGuard mon(m_lock);
+
+        if (m_observer != NULL && m_taskPool != NULL && m_msgServer != NULL &&
+            msgServer == m_msgServer &&
+            m_clientId2Requests.find(srcClientId) != m_clientId2Requests.end())
+        {
+            RPC_ERROR_CODE rpcCode = RunPipeline_i(pipeline);
+            if (rpcCode != RPCE_OK)
+            {
+                EndPipeline_i(pipeline, rpcCode);
+            }
+
+            pipeline = NULL;
+        }
+    }
+
+    if (pipeline != NULL)
+    {
+        DeletePipeline_i(pipeline);
+    }
+}
+
+void
+CRpcServer::RecvCtrl(IRtpMsgServer*      msgServer,
+                     const RPC_CTRL_HDR& ctrl,
+                     uint64_t            srcClientId)
+{
+    assert(msgServer != NULL);
+
+    if (ctrl.ctrlType != RPC_CT_CANCEL || ctrl.param == 0)
+    {
+        return;
+    }
+
+    {
+        CProThreadMutexGuard mon(m_lock);
+
+        if (m_observer == NULL || m_taskPool == NULL || m_msgServer == NULL)
+        {
+            return;
+        }
+
+        if (msgServer != m_msgServer)
+        {
+            return;
+        }
+
+        auto itr = m_clientId2Requests.find(srcClientId);
+        if (itr == m_clientId2Requests.end())
+        {
+            return;
+        }
+
+        auto itr2 = itr->second.find(ctrl.param);
+        if (itr2 == itr->second.end())
+        {
+            return;
+        }
+
+        CRpcPacket* request    = itr2->second;
+        uint32_t    functionId = request->GetFunctionId();
+        bool        removed    = false;
+
+        /*
+         * a queued request is dropped, and a running handler can see the
+         * flag
+         */
+        request->SetCancelled(true);
+
+        /*
+         * the channel of the client, or a key channel
+         */
+        for (int i = 0; i < (int)m_groups.size() && !removed; ++i)
+        {
+            RPC_WORKER_GROUP& group = *m_groups[i];
+
+            removed = RemoveTask_i(group, srcClientId, request);
+
+            for (unsigned int j = 0; j < group.keyChannels && !removed; ++j)
+            {
+                removed = RemoveTask_i(group, KEY_CHANNEL + j, request);
+            }
+        }
+
+        /*
+         * a pipeline ends with the call
+         */
+        if (removed)
+        {
+            FailPipeCall_i(srcClientId, ctrl.param, functionId, RPCE_CANCELED);
+        }
+    }
+}
+
+void
+CRpcServer::AsyncRecvRpc(unsigned int groupIndex,
+                         unsigned int lane)
+{
+    CProStlVector<RPC_SERVER_TASK> taken;
+
+    {
+        CProThreadMutexGuard mon(m_lock);
+
+        if (groupIndex >= m_groups.size())
+        {
+            return;
+        }
+
+        RPC_WORKER_GROUP& group = *m_groups[groupIndex];
+        if (lane >= group.lanes.size())
+        {
+            return;
+        }
+
+        const CProStlSet<uint64_t>& channels = group.lanes[lane];
+
+        for (int i = RPC_PRI_INTERACTIVE; i >= RPC_PRI_BATCH; --i)
+        {
+            if (group.queued[i] == 0)
+            {
+                continue;
+            }
+
+            /*
+             * the scheduler compares the requests among the channels of the
+             * lane. the earlier one wins on a tie, and FIFO keeps the order
+             * of a channel.
+             */
+            RPC_CHANNEL_QUEUE* queue = NULL;
+            size_t             j     = 0;
+            double             bestV = 0;
+
+            auto itr = channels.begin();
+            auto end = channels.end();
+
+            for (; itr != end; ++itr)
+            {
+                auto itr2 = group.channel2Queue.find(*itr);
+                if (itr2 == group.channel2Queue.end() || itr2->second.tasks[i].empty())
+                {
+                    continue;
+                }
+
+                const CProStlDeque<RPC_SERVER_TASK>& tasks2 = itr2->second.tasks[i];
+
+                double v = 0;
+                size_t k = PickTask_i(tasks2, v);
+                if (queue == NULL || v < bestV ||
+                    (v == bestV && tasks2[k].arrivalTick < queue->tasks[i][j].arrivalTick))
+                {
+                    queue = &itr2->second;
+                    j     = k;
+                    bestV = v;
+                }
+            }
+
+            if (queue == NULL)
+            {
+                continue;
+            }
+
+            CProStlDeque<RPC_SERVER_TASK>& tasks      = queue->tasks[i];
+            uint32_t                       functionId = tasks[j].request->GetFunctionId();
+
+            taken.push_back(tasks[j]);
+            tasks.erase(tasks.begin() + j);
+
+            /*
+             * the other requests of the function, in order
+             */
+            if (m_batchObserver)
+            {
+                size_t k = 0;
+
+                while (k < tasks.size() && taken.size() < m_configInfo.rpcs_batch_size)
+                {
+                    if (tasks[k].request->GetFunctionId() == functionId)
+                    {
+                        taken.push_back(tasks[k]);
+                        tasks.erase(tasks.begin() + k);
+                    }
+                    else
+                    {
+                        ++k;
+                    }
+                }
+            }
+
+            queue->size     -= taken.size();
+            group.queued[i] -= taken.size();
+            break;
+        }
+    }
+
+    /*
+     * the requests have been shed or canceled
+     */
+    if (taken.size() == 0)
+    {
+        return;
+    }
+
+    CProStlVector<IRpcPacket*> requests;
+    IRpcServerObserver*        observer = NULL;
+    int64_t                    tick     = ProGetTickCount64();
+
+    {
+        CProThreadMutexGuard mon(m_lock);
+
+        int i = 0;
+        int c = (int)taken.size();
+
+        for (; i < c; ++i)
+        {
+            CRpcPacket* request = taken[i].request;
+
+            /*
+             * check timeout
+             */
+            if (tick >= taken[i].arrivalTick + (int64_t)request->GetTimeout() * 1000)
+            {
+                RemoveRequest_i(request->GetClientId(), request->GetRequestId(), request);
+                FailPipeCall_i(request->GetClientId(), request->GetRequestId(),
+                    request->GetFunctionId(), RPCE_NETWORK_TIMEOUT);
+                request->Release();
+            }
+            else
+            {
+                requests.push_back(request);
+            }
+        }
+
+        if (requests.size() > 0 && m_observer != NULL)
+        {
+            m_observer->AddRef();
+            observer = m_observer;
+        }
+    }
+
+    if (observer != NULL)
+    {
+        if (m_batchObserver)
+        {
+            ((IRpcServerObserver2*)observer)->OnRpcRequestBatch(
+                this, &requests[0], requests.size());
+        }
+        else
+        {
+            observer->OnRpcRequest(this, requests[0]);
+        }
+
+        observer->Release();
+    }
+
+    int64_t              handlerTime = ProGetTickCount64() - tick;
+    CProStlSet<uint64_t> clientIds;
+
+    {
+        CProThreadMutexGuard mon(m_lock);
+
+        int i = 0;
+        int c = (int)requests.size();
+
+        for (; i < c; ++i)
+        {
+            CRpcPacket* request = (CRpcPacket*)requests[i];
+            RemoveRequest_i(request->GetClientId(), request->GetRequestId(), request);
+        }
+
+        /*
+         * the results wait while the lane still has the tasks of the client.
+         * the size bound and rpcs_coalesce_delay send them in the meantime.
+         */
+        if (m_configInfo.rpcs_coalesce_bytes > 0 && groupIndex < m_groups.size())
+        {
+            const RPC_WORKER_GROUP& group = *m_groups[groupIndex];
+
+            i = 0;
+
+            for (; i < c; ++i)
+            {
+                uint64_t clientId = requests[i]->GetClientId();
+                if (!HasTasks_i(group, lane, clientId))
+                {
+                    clientIds.insert(clientId);
+                }
+            }
+        }
+
+        if (c > 0)
+        {
+            auto itr = m_funtionId2Info.find(requests[0]->GetFunctionId());
+            if (itr != m_funtionId2Info.end())
+            {
+                RPC_FUNCTION_INFO& info = itr->second;
+                info.handlerTime += SJF_ALPHA * ((double)handlerTime / c - info.handlerTime);
+            }
+        }
+    }
+
+    int i = 0;
+    int c = (int)requests.size();
+
+    for (; i < c; ++i)
+    {
+        requests[i]->Release();
+    }
+
+    /*
+     * the results of the drained clients go out together
+     */
+    if (clientIds.size() > 0)
+    {
+        FlushOutput(&clientIds);
+    }
+}
+
+void
+CRpcServer::RecvMsg(IRtpMsgServer* msgServer,
+                    const void*    buf,
+                    size_t         size,
+                    uint16_t       charset,
+                    uint64_t       srcClientId)
+{
+    assert(msgServer != NULL);
+    assert(buf != NULL);
+    assert(size > 0);
+
+    IRpcServerObserver* observer = NULL;
+
+    {
+        CProThreadMutexGuard mon(m_lock);
+
+        if (m_observer == NULL || m_taskPool == NULL || m_msgServer == NULL)
+        {
+            return;
+        }
+
+        if (msgServer != m_msgServer)
+        {
+            return;
+        }
+
+        m_observer->AddRef();
+        observer = m_observer;
+    }
+
+    observer->OnRecvMsg(this, buf, size, charset, srcClientId);
+    observer->Release();
+}
+
+void
+CRpcServer::SendErrorCode(uint64_t       clientId,
+                          uint64_t       requestId,
+                          uint32_t       functionId,
+                          RPC_ERROR_CODE rpcCode)
+{
+    assert(clientId > 0);
+    assert(requestId > 0);
+    assert(functionId > 0);
+    assert(rpcCode < 0);
+    assert(m_msgServer != NULL);
+
+    IRpcPacket* result = CreateRpcResult(clientId, requestId, functionId, rpcCode, NULL, 0);
+    if (result == NULL)
+    {
+        return;
+    }
+
+    if (m_configInfo.rpcs_credits)
+    {
+        ((CRpcPacket*)result)->SetCredits(CalcCredits_i(clientId));
+    }
+
+    if (PipeResult_i(result))
+    {
+        result->Release();
+
+        return;
+    }
+
+    RTP_MSG_USER user(RPC_CID, clientId, RPC_IID);
+
+    m_msgServer->SendMsg(result->GetTotalBuffer(), result->GetTotalSize(), 0, &user, 1);
+    result->Release();
+}
+
+unsigned int
+CRpcServer::CalcCredits_i(uint64_t clientId) const
+{
+    assert(m_taskPool != NULL);
+
+    /*
+     * the calls of the client in the queues, and an equal share of the rest
+     * of the queues
+     */
+    size_t queued = 0;
+    size_t total  = 0;
+    size_t limit  = 0;
+    size_t count  = 0;
+
+    if (m_groups.size() > 0)
+    {
+        count = m_groups[0]->channel2Queue.size() - m_groups[0]->keyChannels;
+    }
+
+    for (int i = 0; i < (int)m_groups.size(); ++i)
+    {
+        const RPC_WORKER_GROUP& group = *m_groups[i];
+
+        total += GetQueued_i(group);
+        limit += group.pendingCalls;
+
+        auto itr = group.channel2Queue.find(clientId);
+        if (itr != group.channel2Queue.end())
+        {
+            queued += itr->second.size;
+        }
+    }
+
+    size_t share = 0;
+    if (total < limit)
+    {
+        share = (limit - total) / (count > 0 ? count : 1);
+    }
+
+    return (unsigned int)(queued + share);
+}
+
+void
+CRpcServer::RemoveRequest_i(uint64_t          clientId,
+                            uint64_t          requestId,
+                            const CRpcPacket* request) /* = NULL */
+{
+    auto itr = m_clientId2Requests.find(clientId);
+    if (itr == m_clientId2Requests.end())
+    {
+        return;
+    }
+
+    auto itr2 = itr->second.find(requestId);
+    if (itr2 == itr->second.end() || (request != NULL && itr2->second != request))
+    {
+        return;
+    }
+
+    itr2->second->Release();
+    itr->second.erase(itr2);
+}
+
+size_t
+CRpcServer::GetQueued_i(const RPC_WORKER_GROUP& group) const
+{
+    return group.queued[RPC_PRI_BATCH] + group.queued[RPC_PRI_NORMAL] +
+        group.queued[RPC_PRI_INTERACTIVE];
+}
+
+size_t
+CRpcServer::PickTask_i(const CProStlDeque<RPC_SERVER_TASK>& tasks,
+                       double&                              value) const
+{
+    assert(!tasks.empty());
+
+    /*
+     * FIFO: the arrival of the first request
+     */
+    if (m_configInfo.rpcs_scheduler == RPC_SS_FIFO)
+    {
+        value = (double)tasks[0].arrivalTick;
+
+        return 0;
+    }
+
+    size_t best  = 0;
+    double bestV = 0;
+
+    int i = 0;
+    int c = (int)tasks.size();
+
+    for (; i < c; ++i)
+    {
+        const RPC_SERVER_TASK& task = tasks[i];
+
+        /*
+         * EDF: the deadline of the request.
+         * SJF: the average handler time of the function.
+         */
+        double v = 0;
+        if (m_configInfo.rpcs_scheduler == RPC_SS_EDF)
+        {
+            v = (double)(task.arrivalTick + (int64_t)task.request->GetTimeout() * 1000);
+        }
+        else
+        {
+            auto itr = m_funtionId2Info.find(task.request->GetFunctionId());
+            if (itr != m_funtionId2Info.end())
+            {
+                v = itr->second.handlerTime;
+            }
+        }
+
+        if (i == 0 || v < bestV) /* the earlier one on a tie */
+        {
+            best  = i;
+            bestV = v;
+        }
+    }
+
+    value = bestV;
+
+    return best;
+}
+
+bool
+CRpcServer::ShedTask_i(RPC_WORKER_GROUP& group,
+                       RPC_PRIORITY      priority)
+{
+    assert(m_msgServer != NULL);
+
+    /*
+     * the latest request of the lowest priority below the given one
+     */
+    for (int i = RPC_PRI_BATCH; i < (int)priority; ++i)
+    {
+        if (group.queued[i] == 0)
+        {
+            continue;
+        }
+
+        auto itr = group.channel2Queue.begin();
+        auto end = group.channel2Queue.end();
+
+        for (; itr != end; ++itr)
+        {
+            RPC_CHANNEL_QUEUE&             queue = itr->second;
+            CProStlDeque<RPC_SERVER_TASK>& tasks = queue.tasks[i];
+            if (tasks.empty())
+            {
+                continue;
+            }
+
+            CRpcPacket* request = tasks.back().request;
+            tasks.pop_back();
+            --queue.size;
+            --group.queued[i];
+
+            RemoveRequest_i(request->GetClientId(), request->GetRequestId(), request);
+
+            if (!request->GetNoreply())
+            {
+                SendErrorCode(
+                    request->GetClientId(),
+                    request->GetRequestId(),
+                    request->GetFunctionId(),
+                    RPCE_SERVER_BUSY
+                    );
+            }
+
+            request->Release();
+
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool
+CRpcServer::RemoveTask_i(RPC_WORKER_GROUP& group,
+                         uint64_t          channel,
+                         CRpcPacket*       request)
+{
+    assert(request != NULL);
+
+    auto itr = group.channel2Queue.find(channel);
+    if (itr == group.channel2Queue.end())
+    {
+        return false;
+    }
+
+    RPC_PRIORITY                   priority = request->GetPriority();
+    RPC_CHANNEL_QUEUE&             queue    = itr->second;
+    CProStlDeque<RPC_SERVER_TASK>& tasks    = queue.tasks[priority];
+
+    auto itr2 = tasks.begin();
+    auto end2 = tasks.end();
+
+    for (; itr2 != end2; ++itr2)
+    {
+        if (itr2->request == request)
+        {
+            break;
+        }
+    }
+
+    if (itr2 == end2)
+    {
+        return false;
+    }
+
+    tasks.erase(itr2);
+    --queue.size;
+    --group.queued[priority];
+
+    RemoveRequest_i(request->GetClientId(), request->GetRequestId(), request);
+    request->Release();
+
+    return true;
+}
+
+void
+CRpcServer::ReleaseQueue_i(RPC_WORKER_GROUP&  group,
+                           RPC_CHANNEL_QUEUE& queue)
+{
+    for (int i = RPC_PRI_BATCH; i <= RPC_PRI_INTERACTIVE; ++i)
+    {
+        CProStlDeque<RPC_SERVER_TASK>& tasks = queue.tasks[i];
+
+        group.queued[i] -= tasks.size();
+
+        auto itr = tasks.begin();
+        auto end = tasks.end();
+
+        for (; itr != end; ++itr)
+        {
+            itr->request->Release();
+        }
+
+        tasks.clear();
+    }
+
+    queue.size = 0;
+}
+
+void
+CRpcServer::ReleaseOutput_i(RPC_CLIENT_OUTPUT& output)
+{
+    int i = 0;
+    int c = (int)output.results.size();
+
+    for (; i < c; ++i)
+    {
+        output.results[i]->Release();
+    }
+
+    output.results.clear();
+    output.bytes = 0;
+}
+
+RPC_ERROR_CODE
+CRpcServer::RunPipeline_i(RPC_PIPELINE* pipeline)
+{
+    assert(pipeline != NULL);
+    assert(pipeline->results.size() < pipeline->calls.size());
+
+    size_t            index = pipeline->results.size();
+    const CRpcPacket* call  = pipeline->calls[index];
+
+    CProStlVector<RPC_ARGUMENT> args(call->GetArgumentCount());
+    if (args.size() > 0)
+    {
+        call->GetArguments(&args[0], args.size());
+    }
+
+    /*
+     * the placeholders take the arguments of the earlier results
+     */
+    for (int i = 0; i < (int)pipeline->refs.size(); ++i)
+    {
+        const RPC_PIPELINE_REF& ref = pipeline->refs[i];
+        if (ref.callIndex != index)
+        {
+            continue;
+        }
+
+        const IRpcPacket* result = pipeline->results[ref.resultIndex];
+        if (ref.resultArg >= result->GetArgumentCount())
+        {
+            return RPCE_MISMATCHED_PARAMETER;
+        }
+
+        RPC_ARGUMENT arg;
+        result->GetArgument(ref.resultArg, &arg);
+        if (arg.type != args[ref.argIndex].type)
+        {
+            return RPCE_MISMATCHED_PARAMETER;
+        }
+
+        args[ref.argIndex] = arg;
+    }
+
+    /*
+     * the rest of the time of the pipeline
+     */
+    int64_t  elapsed = (ProGetTickCount64() - pipeline->startTick) / 1000;
+    uint32_t timeout = call->GetTimeout();
+    timeout = elapsed < (int64_t)timeout ? timeout - (uint32_t)elapsed : 1;
+
+    CRpcPacket* request = CreateRequest_i(pipeline->clientId, call->GetRequestId(),
+        call->GetFunctionId(), false, timeout, call->GetPriority(), args);
+    if (request == NULL)
+    {
+        return RPCE_NOT_ENOUGH_MEMORY;
+    }
+
+    m_clientId2Pipelines[pipeline->clientId][call->GetRequestId()] = pipeline;
+
+    RPC_ERROR_CODE rpcCode = RecvRpc_i(request);
+    if (rpcCode != RPCE_OK)
+    {
+        m_clientId2Pipelines[pipeline->clientId].erase(call->GetRequestId());
+    }
+
+    request->Release();
+
+    return rpcCode;
+}
+
+bool
+CRpcServer::PipeResult_i(IRpcPacket* result)
+{
+    assert(result != NULL);
+
+    auto itr = m_clientId2Pipelines.find(result->GetClientId());
+    if (itr == m_clientId2Pipelines.end())
+    {
+        return false;
+    }
+
+    auto itr2 = itr->second.find(result->GetRequestId());
+    if (itr2 == itr->second.end())
+    {
+        return false;
+    }
+
+    RPC_PIPELINE* pipeline = itr2->second;
+    itr->second.erase(itr2);
+
+    result->AddRef();
+    pipeline->results.push_back(result);
+
+    /*
+     * the next call, or the end
+     */
+    RPC_ERROR_CODE rpcCode = RPCE_CANCELED;
+
+    if (result->GetRpcCode() == RPCE_OK &&
+        pipeline->results.size() < pipeline->calls.size())
+    {
+        rpcCode = RunPipeline_i(pipeline);
+        if (rpcCode == RPCE_OK)
+        {
+            return true;
+        }
+    }
+
+    EndPipeline_i(pipeline, rpcCode);
+
+    return true;
+}
+
+void
+CRpcServer::FailPipeCall_i(uint64_t       clientId,
+                           uint64_t       requestId,
+                           uint32_t       functionId,
+                           RPC_ERROR_CODE rpcCode)
+{
+    auto itr = m_clientId2Pipelines.find(clientId);
+    if (itr == m_clientId2Pipelines.end() ||
+        itr->second.find(requestId) == itr->second.end())
+    {
+        return;
+    }
+
+    IRpcPacket* result = CreateRpcResult(clientId, requestId, functionId, rpcCode, NULL, 0);
+    if (result != NULL)
+    {
+        PipeResult_i(result);
+        result->Release();
+    }
+}
+
+void
+CRpcServer::EndPipeline_i(RPC_PIPELINE*  pipeline,
+                          RPC_ERROR_CODE rpcCode) /* of the next call */
+{
+    assert(pipeline != NULL);
+    assert(m_msgServer != NULL);
+
+    /*
+     * the calls not run fail
+     */
+    for (size_t i = pipeline->results.size(); i < pipeline->calls.size(); ++i)
+    {
+        const CRpcPacket* call   = pipeline->calls[i];
+        IRpcPacket*       result = CreateRpcResult(pipeline->clientId,
+            call->GetRequestId(), call->GetFunctionId(), rpcCode, NULL, 0);
+        if (result == NULL)
+        {
+            break;
+        }
+
+        pipeline->results.push_back(result);
+        rpcCode = RPCE_CANCELED;
+    }
+
+    /*
+     * all the results in one message
+     */
+    CProBuffer batch;
+    if (pipeline->results.size() > 0 &&
+        CRpcPacket::MakeRpcBatch(&pipeline->results[0], pipeline->results.size(), batch))
+    {
+        RTP_MSG_USER user(RPC_CID, pipeline->clientId, RPC_IID);
+
+        m_msgServer->SendMsg(batch.Data(), batch.Size(), 0, &user, 1);
+    }
+
+    DeletePipeline_i(pipeline);
 }
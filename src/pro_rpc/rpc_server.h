@@ -25,6 +25,7 @@
 #include "pronet/pro_memory_pool.h"
 #include "pronet/pro_stl.h"
 #include "pronet/pro_thread_mutex.h"
+#include "pronet/pro_timer_factory.h"
 #include "pronet/pro_z.h"
 #include "pronet/rtp_base.h"
 #include "pronet/rtp_msg.h"
@@ -34,24 +35,165 @@
 
 class CProChannelTaskPool;
 
+typedef unsigned char RPC_SERVER_SCHEDULER;
+
+static const RPC_SERVER_SCHEDULER RPC_SS_FIFO = 0; /* first in, first out */
+static const RPC_SERVER_SCHEDULER RPC_SS_EDF  = 1; /* earliest deadline first */
+static const RPC_SERVER_SCHEDULER RPC_SS_SJF  = 2; /* shortest expected job first */
+
+struct RPC_GROUP_CONFIG_INFO
+{
+    RPC_GROUP_CONFIG_INFO()
+    {
+        workers      = 1;
+        pendingCalls = 0;
+    }
+
+    unsigned int workers;      /* 1 ~ 100 */
+    unsigned int pendingCalls; /* 0 for "rpcs_pending_calls" */
+
+    DECLARE_SGI_POOL(0)
+};
+
 struct RPC_SERVER_CONFIG_INFO
 {
     RPC_SERVER_CONFIG_INFO()
     {
-        rpcs_pending_calls = 10000;
-        rpcs_worker_count  = 2;
+        rpcs_pending_calls  = 10000;
+        rpcs_worker_count   = 2;
+        rpcs_credits        = false;
+        rpcs_priority       = false;
+        rpcs_scheduler      = RPC_SS_FIFO;
+        rpcs_batch_size     = 64;
+        rpcs_coalesce_bytes = 0;
+        rpcs_coalesce_delay = 2;
     }
 
-    unsigned int rpcs_pending_calls;
-    unsigned int rpcs_worker_count; /* 1 ~ 100 */
+    unsigned int         rpcs_pending_calls;
+    unsigned int         rpcs_worker_count;   /* 1 ~ 100 */
+    bool                 rpcs_credits;
+    bool                 rpcs_priority;       /* the clients set the priorities */
+    RPC_SERVER_SCHEDULER rpcs_scheduler;
+    unsigned int         rpcs_batch_size;     /* 1 ~ 1024 */
+    unsigned int         rpcs_coalesce_bytes; /* 0 for no coalescing */
+    unsigned int         rpcs_coalesce_delay; /* 1 ~ 1000, ms */
+
+    /*
+     * "rpcs_group_<name>_workers" and "rpcs_group_<name>_pending_calls"
+     */
+    CProStlMap<CProStlString, RPC_GROUP_CONFIG_INFO> rpcs_groups;
 
     DECLARE_SGI_POOL(0)
 };
 
 struct RPC_FUNCTION_INFO
 {
+    RPC_FUNCTION_INFO()
+    {
+        flags       = 0;
+        group       = 0;
+        affinityArg = -1;
+        handlerTime = 0;
+    }
+
     CProStlVector<RPC_DATA_TYPE> callArgTypes;
     CProStlVector<RPC_DATA_TYPE> retnArgTypes;
+    uint32_t                     flags;       /* RPC_FF_XXX */
+    unsigned int                 group;       /* index of the worker group */
+    int                          affinityArg; /* -1 for the client */
+    double                       handlerTime; /* moving average, ms */
+
+    DECLARE_SGI_POOL(0)
+};
+
+struct RPC_SERVER_TASK
+{
+    CRpcPacket* request;
+    int64_t     arrivalTick;
+
+    DECLARE_SGI_POOL(0)
+};
+
+/*
+ * the queued requests of a channel, one queue per priority. a channel is a
+ * client, or a key channel of the affinity argument.
+ */
+struct RPC_CHANNEL_QUEUE
+{
+    RPC_CHANNEL_QUEUE()
+    {
+        size = 0;
+    }
+
+    CProStlDeque<RPC_SERVER_TASK> tasks[RPC_PRI_INTERACTIVE + 1];
+    size_t                        size;
+
+    DECLARE_SGI_POOL(0)
+};
+
+/*
+ * a bulkhead. the functions of a group run in its own task pool, with its
+ * own queues and pending-call cap. a lane is a worker thread, and the
+ * requests of its channels are picked by priority.
+ */
+struct RPC_WORKER_GROUP
+{
+    RPC_WORKER_GROUP()
+    {
+        taskPool     = NULL;
+        pendingCalls = 0;
+        keyChannels  = 0;
+
+        for (int i = 0; i <= RPC_PRI_INTERACTIVE; ++i)
+        {
+            queued[i] = 0;
+        }
+    }
+
+    CProStlString                           name; /* empty for the default group */
+    CProChannelTaskPool*                    taskPool;
+    unsigned int                            pendingCalls;
+    unsigned int                            keyChannels;
+    CProStlMap<uint64_t, RPC_CHANNEL_QUEUE> channel2Queue;
+    CProStlVector<CProStlSet<uint64_t> >    lanes; /* the channels of each lane */
+    size_t                                  queued[RPC_PRI_INTERACTIVE + 1];
+
+    DECLARE_SGI_POOL(0)
+};
+
+/*
+ * the calls of a pipeline run one by one, and the results are sent back
+ * together
+ */
+struct RPC_PIPELINE
+{
+    RPC_PIPELINE()
+    {
+        clientId  = 0;
+        startTick = 0;
+    }
+
+    uint64_t                        clientId;
+    int64_t                         startTick;
+    CProStlVector<CRpcPacket*>      calls;   /* as sent, with the placeholders */
+    CProStlVector<RPC_PIPELINE_REF> refs;
+    CProStlVector<IRpcPacket*>      results; /* of the calls done */
+
+    DECLARE_SGI_POOL(0)
+};
+
+/*
+ * the coalesced results of a client, not sent yet
+ */
+struct RPC_CLIENT_OUTPUT
+{
+    RPC_CLIENT_OUTPUT()
+    {
+        bytes = 0;
+    }
+
+    CProStlVector<IRpcPacket*> results;
+    size_t                     bytes;
 
     DECLARE_SGI_POOL(0)
 };
@@ -59,11 +201,15 @@ struct RPC_FUNCTION_INFO
 /////////////////////////////////////////////////////////////////////////////
 ////
 
-class CRpcServer : public IRpcServer, public CMsgServer
+class CRpcServer
+:
+public IRpcServer,
+public IProOnTimer,
+public CMsgServer
 {
 public:
 
-    static CRpcServer* CreateInstance();
+    static CRpcServer* CreateInstance(bool batchObserver); /* = false */
 
     bool Init(
         IRpcServerObserver* observer,
@@ -92,10 +238,29 @@ public:
         size_t               retnArgCount  /* = 0 */
         );
 
+    virtual RPC_ERROR_CODE RegisterFunction2(
+        uint32_t             functionId,
+        const RPC_DATA_TYPE* callArgTypes, /* = NULL */
+        size_t               callArgCount, /* = 0 */
+        const RPC_DATA_TYPE* retnArgTypes, /* = NULL */
+        size_t               retnArgCount, /* = 0 */
+        const char*          groupName     /* = NULL */
+        );
+
+    virtual RPC_ERROR_CODE SetAffinityArgument(
+        uint32_t functionId,
+        int      argIndex
+        );
+
     virtual void UnregisterFunction(uint32_t functionId);
 
     virtual RPC_ERROR_CODE SendRpcResult(IRpcPacket* result);
 
+    virtual RPC_ERROR_CODE SendRpcResults(
+        IRpcPacket** results,
+        size_t       count
+        );
+
     virtual bool SendMsgToClients(
         const void*     buf,
         size_t          size,
@@ -106,9 +271,17 @@ public:
 
     virtual void KickoutClient(uint64_t clientId);
 
+    virtual bool InvalidateCache(
+        const uint64_t*     dstClients,
+        unsigned char       dstClientCount,
+        uint32_t            functionId, /* = 0 */
+        const RPC_ARGUMENT* args,       /* = NULL */
+        size_t              argCount    /* = 0 */
+        );
+
 private:
 
-    CRpcServer();
+    CRpcServer(bool batchObserver); /* = false */
 
     virtual ~CRpcServer();
 
@@ -155,6 +328,21 @@ private:
         uint64_t                           srcClientId
         );
 
+    void RecvPipeline(
+        IRtpMsgServer*                         msgServer,
+        const CProStlVector<RPC_BATCH_ITEM>&   items,
+        const CProStlVector<RPC_PIPELINE_REF>& refs,
+        uint64_t                               srcClientId
+        );
+
+    void RecvCtrl(
+        IRtpMsgServer*      msgServer,
+        const RPC_CTRL_HDR& ctrl,
+        uint64_t            srcClientId
+        );
+
+    RPC_ERROR_CODE RecvRpc_i(CRpcPacket* request);
+
     void RecvMsg(
         IRtpMsgServer* msgServer,
         const void*    buf,
@@ -163,6 +351,19 @@ private:
         uint64_t       srcClientId
         );
 
+    virtual void OnTimer(
+        void*    factory,
+        uint64_t timerId,
+        int64_t  tick,
+        int64_t  userData
+        );
+
+    RPC_ERROR_CODE SendResults(
+        CProStlMap<uint64_t, CProStlVector<IRpcPacket*> >& clientId2Results
+        );
+
+    void FlushOutput(const CProStlSet<uint64_t>* clientIds); /* NULL for all */
+
     void SendErrorCode(
         uint64_t       clientId,
         uint64_t       requestId,
@@ -171,16 +372,79 @@ private:
         );
 
     void AsyncRecvRpc(
-        CRpcPacket* request,
-        int64_t     arrivalTick
+        unsigned int groupIndex,
+        unsigned int lane
+        );
+
+    size_t GetQueued_i(const RPC_WORKER_GROUP& group) const;
+
+    size_t PickTask_i(
+        const CProStlDeque<RPC_SERVER_TASK>& tasks,
+        double&                              value
+        ) const;
+
+    bool ShedTask_i(
+        RPC_WORKER_GROUP& group,
+        RPC_PRIORITY      priority
+        );
+
+    bool RemoveTask_i(
+        RPC_WORKER_GROUP& group,
+        uint64_t          channel,
+        CRpcPacket*       request
+        );
+
+    void ReleaseQueue_i(
+        RPC_WORKER_GROUP&  group,
+        RPC_CHANNEL_QUEUE& queue
+        );
+
+    void ReleaseOutput_i(RPC_CLIENT_OUTPUT& output);
+
+    RPC_ERROR_CODE RunPipeline_i(RPC_PIPELINE* pipeline);
+
+    bool PipeResult_i(IRpcPacket* result);
+
+    void FailPipeCall_i(
+        uint64_t       clientId,
+        uint64_t       requestId,
+        uint32_t       functionId,
+        RPC_ERROR_CODE rpcCode
+        );
+
+    void EndPipeline_i(
+        RPC_PIPELINE*  pipeline,
+        RPC_ERROR_CODE rpcCode /* of the next call */
+        );
+
+    unsigned int CalcCredits_i(uint64_t clientId) const;
+
+    void RemoveRequest_i(
+        uint64_t          clientId,
+        uint64_t          requestId,
+        const CRpcPacket* request /* = NULL */
         );
 
 private:
 
+    const bool                              m_batchObserver; /* IRpcServerObserver2 */
     IRpcServerObserver*                     m_observer;
     RPC_SERVER_CONFIG_INFO                  m_configInfo;
     CProChannelTaskPool*                    m_taskPool;
     CProStlMap<uint32_t, RPC_FUNCTION_INFO> m_funtionId2Info;
+    CProStlVector<RPC_WORKER_GROUP*>        m_groups; /* [0] is the default group */
+    CProStlMap<uint64_t, RPC_CLIENT_OUTPUT> m_clientId2Output;
+    uint64_t                                m_flushTimerId;
+
+    /*
+     * the requests that are queued or being handled, for the cancellation
+     */
+    CProStlMap<uint64_t, CProStlMap<uint64_t, CRpcPacket*> > m_clientId2Requests;
+
+    /*
+     * the pipelines, by the request id of the running call
+     */
+    CProStlMap<uint64_t, CProStlMap<uint64_t, RPC_PIPELINE*> > m_clientId2Pipelines;
 
     DECLARE_SGI_POOL(0)
 };